@@ -0,0 +1,624 @@
+#include "BenchUtils.h"
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+__thread ssmem_allocator_t *volatileAlloc;
+__thread unsigned int randSeed;
+static uchar get_random_level()
+{
+    int i;
+    uchar level = 1;
+
+    for (i = 0; i < MAX_LEVEL - 1; i++)
+    {
+        if ((rand_r_32(&randSeed) & 0xFF) < LEVEL_THRESHOLD)
+            level++;
+        else
+            break;
+    }
+    return level;
+}
+
+#include "LinkFreeList.h"
+#include "SOFTList.h"
+#include "LinkFreeUnrolledList.h"
+#include "LinkFreeHashTable.h"
+#include "SOFTHashTable.h"
+#include "LinkFreeSplitHashTable.h"
+#include "SOFTSplitHashTable.h"
+#include "LinkFreeSkipList.h"
+#include "SOFTSkipList.h"
+
+// small chunks, so that the cycles fill some of them and the restarts go on in the
+// ones of the previous cycles
+#define CRASH_CHUNK_SIZE SSMEM_POOL_ALIGN
+
+// the SOFT sets keep their volatile nodes in volatileAlloc, whatever their keys and values
+template <class T, class K, class Traits>
+static void initVolatileAlloc(SOFTList<T, K, Traits> *, int id)
+{
+    volatileAlloc = (ssmem_allocator_t *)malloc(sizeof(ssmem_allocator_t));
+    ssmem_alloc_init(volatileAlloc, CRASH_CHUNK_SIZE, id);
+}
+
+template <class T, class K, class Traits>
+static void initVolatileAlloc(SOFTHashTable<T, K, Traits> *, int id)
+{
+    volatileAlloc = (ssmem_allocator_t *)malloc(sizeof(ssmem_allocator_t));
+    ssmem_alloc_init(volatileAlloc, CRASH_CHUNK_SIZE, id);
+}
+
+template <class T, class K, class Traits>
+static void initVolatileAlloc(SOFTSplitHashTable<T, K, Traits> *, int id)
+{
+    volatileAlloc = (ssmem_allocator_t *)malloc(sizeof(ssmem_allocator_t));
+    ssmem_alloc_init(volatileAlloc, CRASH_CHUNK_SIZE, id);
+}
+
+static void initVolatileAlloc(void *, int id)
+{
+}
+
+template<class SET>
+void specificInit(int id)
+{
+    initVolatileAlloc((SET *)nullptr, id);
+    randSeed = id + 2;
+}
+
+// Crash test: a worker process runs the workload on a pool and is killed at a
+// random point, then a checker process recovers the pool and compares it with
+// the side log of the worker. The keys are split between the worker threads, so
+// every key has a single writer and the log only keeps its last state.
+// In buffered durability (-B) the worker syncs every BUFFERED_PERIOD ms, and the log
+// also keeps for every key the number of syncs that were started when its last
+// operation returned: the operation must survive once a later sync is done.
+// Half of the reads are gets and the insertions are split between insert, upsert and
+// compareAndSwapValue, so the log also keeps the value of every key and the value of the
+// update in flight, and the recovered values are checked as well.
+// The keys are taken from both ends of the 64-bit domain, next to the sentinels of the sets.
+// With -s they are strings of their bytes, which share their first bytes at each end.
+// With -v the values are blobs of their bytes, which the checks read back in full.
+// With -b the operations run on batches of keys, see crashBatch.
+
+enum keyState : uchar
+{
+    ABSENT,
+    PRESENT,
+    INSERTING, // an insert was issued and not acknowledged
+    REMOVING,  // a remove was issued and not acknowledged
+    UPDATING   // a value update of a present key was issued and not acknowledged
+};
+
+struct crash_log_t
+{
+    std::atomic<uint64_t> acked;
+    std::atomic<uint32_t> recovered; // the last cycle whose worker recovered and started its threads
+    std::atomic<uint32_t> syncsStarted, syncsDone;
+    std::atomic<uint32_t> poolChunks; // the chunks in the pool directory after the last check
+    std::atomic<uchar> keys[];
+};
+
+// exit codes of the worker and the checker
+enum
+{
+    CRASH_OK,
+    CRASH_VIOLATION,
+    CRASH_ERROR
+};
+
+// the key of log slot i: the even slots are the smallest keys and the odd ones the largest
+static intptr_t crashKey(uint32_t i)
+{
+    return i % 2 == 0 ? INTPTR_MIN + i / 2 : INTPTR_MAX - i / 2;
+}
+
+static crash_log_t *crashLog;
+static std::atomic<uint32_t> *keySyncs; // after the keys of crashLog
+static std::atomic<intptr_t> *keyValues;  // after keySyncs, the value of every present key
+static std::atomic<intptr_t> *keyPending; // after keyValues, the value of the operation in flight
+
+static size_t keysSize()
+{
+    return (KEY_RANGE + sizeof(intptr_t) - 1) & ~(sizeof(intptr_t) - 1);
+}
+
+static size_t syncsSize()
+{
+    return (KEY_RANGE * sizeof(uint32_t) + sizeof(intptr_t) - 1) & ~(sizeof(intptr_t) - 1);
+}
+
+static size_t logSize()
+{
+    return sizeof(crash_log_t) + keysSize() + syncsSize() + 2 * KEY_RANGE * sizeof(intptr_t);
+}
+
+// maps the side log shared by the parent, the workers and the checkers
+static crash_log_t *mapLog(const string &path)
+{
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, logSize()) != 0)
+    {
+        perror("crash log");
+        exit(CRASH_ERROR);
+    }
+    void *log = mmap(nullptr, logSize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (log == MAP_FAILED)
+    {
+        perror("crash log");
+        exit(CRASH_ERROR);
+    }
+    char *arrays = static_cast<char *>(log) + sizeof(crash_log_t) + keysSize();
+    keySyncs = reinterpret_cast<std::atomic<uint32_t> *>(arrays);
+    keyValues = reinterpret_cast<std::atomic<intptr_t> *>(arrays + syncsSize());
+    keyPending = keyValues + KEY_RANGE;
+    return static_cast<crash_log_t *>(log);
+}
+
+// an empty set: a new pool and a log of absent keys. The count of the acknowledged
+// operations is kept, since it covers every cycle of the run
+static void resetPool(const string &path)
+{
+    unlink(path.c_str());
+    uint64_t acked = crashLog->acked.load();
+    memset((void *)crashLog, 0, logSize());
+    crashLog->acked.store(acked);
+}
+
+// opens the pool and rebuilds the set from it
+template <class SET>
+static SET *openSet(const string &path, RecoveryStats *stats)
+{
+    int poolState = ssmem_pool_open(path.c_str());
+    if (poolState < 0)
+        exit(CRASH_ERROR);
+    specificInit<SET>(0);
+    initPersistentAlloc(0, CRASH_CHUNK_SIZE);
+    SET *set = new SET();
+    *stats = {0, 0, 0};
+    if (poolState == 1)
+    {
+        ssmem_pool_adopt(alloc);
+        *stats = set->recover(NUM_THREADS);
+        ssmem_pool_recovered();
+    }
+    return set;
+}
+
+// the value that a compareAndSwapValue of key expects, when the log says that the value
+// of key is logged
+template <class SET, class K>
+static intptr_t expectedValue(SET *set, K key, intptr_t logged, intptr_t *)
+{
+    return logged;
+}
+
+// a blob is compared by its reference, which a get returns. The key has a single writer,
+// so the value stays until the compareAndSwapValue
+template <class SET, class K>
+static Blob expectedValue(SET *set, K key, intptr_t logged, Blob *)
+{
+    Blob current;
+    if (set->get(key, current, 0) && fromValue(current) == logged)
+        return current;
+    return Blob();
+}
+
+// a batch (-b) of distinct keys of the thread: reads run containsBatch, insertions insertBatch
+// with one value and removals removeBatch. The keys are in flight until the batch returns,
+// and the number of operations that succeeded is checked against the log
+template <class SET>
+static void crashBatch(SET *set, int id, int op, int cRatio, int iRatio, uint32_t *seed, intptr_t &nextValue)
+{
+    typedef typename setKey<SET>::type K;
+    typedef typename setValue<SET>::type T;
+    uint32_t ownKeys = KEY_RANGE / NUM_THREADS;
+    vector<int> slots;
+    for (uint32_t i = 0; i < BATCH_SIZE; i++)
+        slots.push_back((rand_r_32(seed) % ownKeys) * NUM_THREADS + id - 1);
+    std::sort(slots.begin(), slots.end());
+    slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+
+    vector<keyState> before;
+    vector<K> keys;
+    vector<std::pair<K, T>> items;
+    size_t expected = 0, result;
+    intptr_t value = nextValue += NUM_THREADS;
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        before.push_back((keyState)crashLog->keys[slots[i]].load());
+        keys.push_back(toKey<K>(crashKey(slots[i]), i));
+    }
+    if (op < cRatio)
+    {
+        for (keyState st : before)
+            expected += st == PRESENT;
+        result = containsBatchOf(set, keys, id, 0);
+    }
+    else if (op < iRatio)
+    {
+        for (size_t i = 0; i < slots.size(); i++)
+        {
+            expected += before[i] == ABSENT;
+            items.push_back({keys[i], toValue<T>(value)});
+            keyPending[slots[i]].store(value);
+            if (before[i] == ABSENT)
+                crashLog->keys[slots[i]].store(INSERTING);
+        }
+        result = insertBatchOf(set, items, id, 0);
+        for (size_t i = 0; i < slots.size(); i++)
+        {
+            keySyncs[slots[i]].store(crashLog->syncsStarted.load());
+            if (before[i] == ABSENT)
+                keyValues[slots[i]].store(value);
+            crashLog->keys[slots[i]].store(PRESENT);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < slots.size(); i++)
+        {
+            expected += before[i] == PRESENT;
+            crashLog->keys[slots[i]].store(REMOVING);
+        }
+        result = removeBatchOf(set, keys, id, 0);
+        for (size_t i = 0; i < slots.size(); i++)
+        {
+            keySyncs[slots[i]].store(crashLog->syncsStarted.load());
+            crashLog->keys[slots[i]].store(ABSENT);
+        }
+    }
+    if (result != expected)
+    {
+        fprintf(stderr, "batch op %d on %zu keys returned %zu, the log says %zu\n", op, slots.size(), result, expected);
+        _exit(CRASH_VIOLATION);
+    }
+    crashLog->acked.fetch_add(slots.size(), std::memory_order_relaxed);
+}
+
+template <class SET>
+void crashOpsThread(SET *set, int id)
+{
+    int cRatio = RO_RATIO * 10;
+    int iRatio = cRatio + (1000 - cRatio) / 2;
+    uint32_t seed1 = id + getpid();
+    uint32_t seed2 = seed1 + 1;
+    uint32_t ownKeys = KEY_RANGE / NUM_THREADS;
+    // the values are unique to the thread and never 0, which no key has
+    intptr_t nextValue = id;
+    typedef typename setKey<SET>::type K;
+    typedef typename setValue<SET>::type T;
+    specificInit<SET>(id);
+    initPersistentAlloc(id, CRASH_CHUNK_SIZE);
+    barrier_cross(&init_barrier);
+
+    while (true)
+    {
+        int op = rand_r_32(&seed1) % 1000;
+        if (BATCH_SIZE > 1)
+        {
+            crashBatch(set, id, op, cRatio, iRatio, &seed2, nextValue);
+            continue;
+        }
+        int key = (rand_r_32(&seed2) % ownKeys) * NUM_THREADS + id - 1;
+        keyState before = (keyState)crashLog->keys[key].load();
+        bool result, expected;
+        intptr_t value;
+        if (op < cRatio && op % 2 == 0)
+        {
+            result = set->contains(toKey<K>(crashKey(key)), id);
+            expected = before == PRESENT;
+        }
+        else if (op < cRatio)
+        {
+            T got;
+            result = set->get(toKey<K>(crashKey(key)), got, id);
+            value = fromValue(got);
+            expected = before == PRESENT;
+            if (result && value != keyValues[key].load())
+            {
+                fprintf(stderr, "get of key %d returned %lld, the log says %lld\n", key, (long long)value,
+                        (long long)keyValues[key].load());
+                _exit(CRASH_VIOLATION);
+            }
+        }
+        else if (op < iRatio)
+        {
+            value = nextValue += NUM_THREADS;
+            keyPending[key].store(value);
+            crashLog->keys[key].store(before == PRESENT ? UPDATING : INSERTING);
+            if (op % 3 == 0)
+            {
+                result = set->insert(toKey<K>(crashKey(key)), toValue<T>(value), id);
+                expected = before == ABSENT;
+            }
+            else if (op % 3 == 1)
+            {
+                result = set->upsert(toKey<K>(crashKey(key)), toValue<T>(value), id);
+                expected = before == ABSENT;
+            }
+            else
+            {
+                // an absent key fails with any expected value
+                T current = expectedValue(set, toKey<K>(crashKey(key)), keyValues[key].load(), (T *)nullptr);
+                result = set->compareAndSwapValue(toKey<K>(crashKey(key)), current, toValue<T>(value), id);
+                expected = before == PRESENT;
+            }
+            keySyncs[key].store(crashLog->syncsStarted.load());
+            // insert leaves the value of a present key and compareAndSwapValue leaves an absent key out
+            if (op % 3 != 0 || before == ABSENT)
+                keyValues[key].store(value);
+            crashLog->keys[key].store(op % 3 == 2 && before == ABSENT ? ABSENT : PRESENT);
+        }
+        else
+        {
+            crashLog->keys[key].store(REMOVING);
+            result = set->remove(toKey<K>(crashKey(key)), id);
+            keySyncs[key].store(crashLog->syncsStarted.load());
+            crashLog->keys[key].store(ABSENT);
+            expected = before == PRESENT;
+        }
+        if (result != expected)
+        {
+            fprintf(stderr, "op %d on key %d returned %d, the log says %d\n", op, key, result, before);
+            _exit(CRASH_VIOLATION);
+        }
+        crashLog->acked.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// runs the workload until it is killed
+template <class SET>
+static void crashWorker(const string &path, uint32_t cycle)
+{
+    RecoveryStats stats;
+    SET *set = openSet<SET>(path, &stats);
+    if (BUFFERED_PERIOD >= 0)
+        epochUtils::start(0);
+    barrier_init(&init_barrier, NUM_THREADS + 1);
+    vector<thread> thrs;
+    for (int j = 1; j < NUM_THREADS + 1; j++)
+        thrs.emplace_back(crashOpsThread<SET>, set, j);
+    barrier_cross(&init_barrier);
+    crashLog->recovered.store(cycle);
+    while (BUFFERED_PERIOD >= 0)
+    {
+        usleep(std::max(BUFFERED_PERIOD, 1) * 1000);
+        uint32_t syncs = crashLog->syncsStarted.fetch_add(1) + 1;
+        epochUtils::sync();
+        crashLog->syncsDone.store(syncs);
+    }
+    for (auto &t : thrs)
+        t.join();
+    _exit(CRASH_ERROR);
+}
+
+// every acknowledged operation must be in the recovered set (in buffered durability,
+// the ones that a sync covers); a key with an operation in flight may be in either
+// state, and the log takes the state it was recovered to
+template <class SET>
+static void crashChecker(const string &path)
+{
+    RecoveryStats stats;
+    SET *set = openSet<SET>(path, &stats);
+    typedef typename setKey<SET>::type K;
+    typedef typename setValue<SET>::type T;
+    uint64_t present = 0, violations = 0;
+    for (uint32_t key = 0; key < KEY_RANGE; key++)
+    {
+        T got = T();
+        bool found = set->get(toKey<K>(crashKey(key)), got, 0);
+        intptr_t value = found ? fromValue(got) : 0;
+        keyState st = (keyState)crashLog->keys[key].load();
+        bool durable = BUFFERED_PERIOD < 0 || keySyncs[key].load() < crashLog->syncsDone.load();
+        if (durable && ((st == ABSENT && found) || ((st == PRESENT || st == UPDATING) && !found)))
+        {
+            if (violations++ < 10)
+                fprintf(stderr, "key %u: the log says %d and the recovered set %s it\n", key, st,
+                        found ? "contains" : "does not contain");
+        }
+        // the value of an operation in flight may or may not survive
+        bool valueOk = value == keyValues[key].load() || ((st == INSERTING || st == UPDATING) && value == keyPending[key].load());
+        if (durable && found && !valueOk)
+        {
+            if (violations++ < 10)
+                fprintf(stderr, "key %u: the log says %d with value %lld (%lld in flight) and the recovered value is %lld\n",
+                        key, st, (long long)keyValues[key].load(), (long long)keyPending[key].load(), (long long)value);
+        }
+        crashLog->keys[key].store(found ? PRESENT : ABSENT);
+        keyValues[key].store(value);
+        keySyncs[key].store(0);
+        present += found;
+    }
+    crashLog->syncsStarted.store(0);
+    crashLog->syncsDone.store(0);
+    if (stats.recovered != present)
+    {
+        fprintf(stderr, "recovered %llu nodes for %llu keys\n", (unsigned long long)stats.recovered,
+                (unsigned long long)present);
+        violations++;
+    }
+    if (violations > 0)
+        _exit(CRASH_VIOLATION);
+    crashLog->poolChunks.store(ssmem_pool_chunk_num());
+    _exit(CRASH_OK);
+}
+
+static int runChild(void (*child)(const string &), const string &path)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(CRASH_ERROR);
+    }
+    if (pid == 0)
+        child(path);
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : CRASH_ERROR;
+}
+
+template <class SET>
+static bool runCrashTest()
+{
+    string path = POOL_PATH.empty() ? "/tmp/crash-test-" + to_string(getpid()) + ".pool" : POOL_PATH;
+    string logPath = path + ".log";
+    crashLog = mapLog(logPath);
+    resetPool(path);
+    cout << "Crash testing " << ALG_NAME << ": Reads " << RO_RATIO << " Key Range " << KEY_RANGE;
+    cout << " Num Threads " << NUM_THREADS << " Cycles " << CRASH_CYCLES;
+    if (BUFFERED_PERIOD >= 0)
+        cout << " Buffered " << BUFFERED_PERIOD << " ms";
+    if (BATCH_SIZE > 1)
+        cout << " Batch " << BATCH_SIZE;
+    cout << endl;
+
+    uint32_t seed = getpid();
+    for (uint32_t cycle = 1; cycle <= CRASH_CYCLES; cycle++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            perror("fork");
+            return false;
+        }
+        if (pid == 0)
+            crashWorker<SET>(path, cycle);
+
+        // the delay starts once the worker is running, except in one cycle
+        // out of 8 that kills it during the recovery
+        int status;
+        bool exited = false;
+        while (cycle % 8 != 0 && crashLog->recovered.load() != cycle && !exited)
+        {
+            usleep(100);
+            exited = waitpid(pid, &status, WNOHANG) == pid;
+        }
+        if (!exited)
+        {
+            usleep(rand_r_32(&seed) % (CRASH_DELAY * 1000 + 1));
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+        }
+        if (!WIFSIGNALED(status))
+        {
+            cout << "Cycle " << cycle << ": the worker failed before the kill, exit code ";
+            cout << WEXITSTATUS(status) << endl;
+            return false;
+        }
+
+        int result = runChild(crashChecker<SET>, path);
+        if (result != CRASH_OK)
+        {
+            cout << "Cycle " << cycle << ": the recovered set does not match the log, see " << path;
+            cout << " and " << logPath << endl;
+            return false;
+        }
+        if (cycle % 100 == 0)
+            cout << "Cycle " << cycle << ": " << crashLog->acked.load() << " acknowledged operations" << endl;
+    }
+
+    cout << "Passed " << CRASH_CYCLES << " cycles (" << crashLog->acked.load() << " acknowledged operations, ";
+    cout << crashLog->poolChunks.load() << " pool chunks)" << endl;
+    munmap(crashLog, logSize());
+    unlink(path.c_str());
+    unlink(logPath.c_str());
+    return true;
+}
+
+// runs the crash test on the set S with keys of type K and the values of the run
+template <template <class, class, class> class S, class K>
+static bool runCrashTestWithValues()
+{
+    if (VALUE_BYTES > 0)
+        return runCrashTest<S<Blob, K, KeyTraits<K>>>();
+    return runCrashTest<S<intptr_t, K, KeyTraits<K>>>();
+}
+
+// and with the keys of the run
+template <template <class, class, class> class S>
+static bool runCrashTestWithKeys()
+{
+    if (STRING_KEY_BYTES > 0)
+        return runCrashTestWithValues<S, StringKey>();
+    return runCrashTestWithValues<S, intptr_t>();
+}
+
+int main(int argc, char **argv)
+{
+    if (!parseArgs(argc, argv))
+    {
+        return 0;
+    }
+    if (KEY_RANGE < (uint32_t)NUM_THREADS)
+    {
+        cout << "The key range must have a key for every thread." << endl;
+        return 1;
+    }
+    if (VALUE_BYTES > 0 && VALUE_BYTES < sizeof(intptr_t))
+    {
+        cout << "The blob values must hold a whole value." << endl;
+        return 1;
+    }
+
+    bool passed;
+    if (STRING_KEY_BYTES > 0 && ALG_NAME.find("Split") != string::npos)
+    {
+        // split ordering needs a hash that tells the keys apart
+        cout << ALG_NAME << " does not take string keys." << endl;
+        return 1;
+    }
+    else if (!ALG_NAME.compare("LinkFreeList"))
+    {
+        passed = runCrashTestWithKeys<LinkFreeList>();
+    }
+    else if (!ALG_NAME.compare("SOFTList"))
+    {
+        passed = runCrashTestWithKeys<SOFTList>();
+    }
+    else if (!ALG_NAME.compare("LinkFreeUnrolledList"))
+    {
+        // the nodes compare integer keys and keep the values in line
+        if (STRING_KEY_BYTES > 0 || VALUE_BYTES > 0)
+        {
+            cout << ALG_NAME << " does not take string keys or blob values." << endl;
+            return 1;
+        }
+        passed = runCrashTest<LinkFreeUnrolledList<intptr_t, intptr_t>>();
+    }
+    else if (!ALG_NAME.compare("LinkFreeHashTable"))
+    {
+        passed = runCrashTestWithKeys<LinkFreeHashTable>();
+    }
+    else if (!ALG_NAME.compare("SOFTHashTable"))
+    {
+        passed = runCrashTestWithKeys<SOFTHashTable>();
+    }
+    else if (!ALG_NAME.compare("LinkFreeSplitHashTable"))
+    {
+        passed = runCrashTestWithValues<LinkFreeSplitHashTable, intptr_t>();
+    }
+    else if (!ALG_NAME.compare("SOFTSplitHashTable"))
+    {
+        passed = runCrashTestWithValues<SOFTSplitHashTable, intptr_t>();
+    }
+    else if (!ALG_NAME.compare("LinkFreeSkipList"))
+    {
+        passed = runCrashTestWithKeys<LinkFreeSkipList>();
+    }
+    else if (!ALG_NAME.compare("SOFTSkipList"))
+    {
+        passed = runCrashTestWithKeys<SOFTSkipList>();
+    }
+    else
+    {
+        cout << "Algorithm not found." << endl;
+        cout << ALG_NAME << endl;
+        return 1;
+    }
+    return passed ? 0 : 1;
+}
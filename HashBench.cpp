@@ -4,17 +4,32 @@ __thread ssmem_allocator_t *volatileAlloc;
 
 #include "LinkFreeHashTable.h"
 #include "SOFTHashTable.h"
+#include "LinkFreeSplitHashTable.h"
+#include "SOFTSplitHashTable.h"
 
-template<>
-void specificInit<SOFTHashTable<intptr_t>>(int id){
+// the SOFT tables keep their volatile nodes in volatileAlloc, whatever their keys and values
+template <class T, class K, class Traits>
+static void initVolatileAlloc(SOFTHashTable<T, K, Traits> *, int id)
+{
     volatileAlloc = (ssmem_allocator_t *)malloc(sizeof(ssmem_allocator_t));
     ssmem_alloc_init(volatileAlloc, SSMEM_DEFAULT_MEM_SIZE, id);
 }
 
+template <class T, class K, class Traits>
+static void initVolatileAlloc(SOFTSplitHashTable<T, K, Traits> *, int id)
+{
+    volatileAlloc = (ssmem_allocator_t *)malloc(sizeof(ssmem_allocator_t));
+    ssmem_alloc_init(volatileAlloc, SSMEM_DEFAULT_MEM_SIZE, id);
+}
+
+static void initVolatileAlloc(void *, int id)
+{
+}
+
 template<class SET>
 void specificInit(int id)
 {
-    return;
+    initVolatileAlloc((SET *)nullptr, id);
 }
 
 
@@ -42,16 +57,34 @@ int main(int argc, char **argv)
                 if(ITERATION == 1)
                     file << "Reads: " << RO_RATIO << endl;
                 break;
+            case 4:
+                file.open(ALG_NAME + "-RECOVERY-KEY_RANGE-" + to_string(KEY_RANGE) + "-THREADS-" + to_string(NUM_THREADS) + ".txt", ofstream::app);
+                break;
+            case 5:
+                file.open(ALG_NAME + "-GROWTH-KEY_RANGE-" + to_string(KEY_RANGE) + "-THREADS-" + to_string(NUM_THREADS) + ".txt", ofstream::app);
+                break;
         }
 
     if (!ALG_NAME.compare("LinkFreeHashTable"))
     {
-
-            runBench<LinkFreeHashTable<intptr_t>>();
+            runBenchWithKeys<LinkFreeHashTable>();
     }
     else if (!ALG_NAME.compare("SOFTHashTable"))
     {
-            runBench<SOFTHashTable<intptr_t>>();
+            runBenchWithKeys<SOFTHashTable>();
+    }
+    else if (STRING_KEY_BYTES > 0 && ALG_NAME.find("Split") != string::npos)
+    {
+        // split ordering needs a hash that tells the keys apart
+        cout << ALG_NAME << " does not take string keys." << endl;
+    }
+    else if (!ALG_NAME.compare("LinkFreeSplitHashTable"))
+    {
+            runBenchWithValues<LinkFreeSplitHashTable, intptr_t>();
+    }
+    else if (!ALG_NAME.compare("SOFTSplitHashTable"))
+    {
+            runBenchWithValues<SOFTSplitHashTable, intptr_t>();
     }
     else
     {
@@ -3,40 +3,107 @@
 
 #include "utilities.h"
 #include "LinkFreeList.h"
-#include <cmath>
 
-template <class T>
+// A fixed number of buckets, each a Link-Free list. The heads of the buckets are in one
+// array and all the buckets end at the same tail, so a lookup misses once in the array
+// and then only on the nodes of its bucket
+template <class T, class K = intptr_t, class Traits = KeyTraits<K>>
 class LinkFreeHashTable
 {
   public:
-    bool insert(int k, T item, int tid)
+    typedef LinkFreeList<T, K, Traits> List;
+    typedef typename List::Node Node;
+
+    // numBuckets is rounded up to a power of two, of at least 2
+    LinkFreeHashTable(uint64_t numBuckets = BUCKET_NUM) : size(roundUpPow2(std::max(numBuckets, (uint64_t)2))), shift(64 - __builtin_ctzll(size))
+    {
+        tail = new Node(Traits::max(), T(), nullptr);
+        size_t bytes = (size * sizeof(Node) + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+        heads = static_cast<Node *>(aligned_alloc(CACHE_LINE_SIZE, bytes));
+        assert(heads != nullptr);
+        for (uint64_t b = 0; b < size; b++)
+            new (&heads[b]) Node(Traits::min(), T(), tail);
+    }
+
+    bool insert(K k, T item, int tid)
+    {
+        return List::insertFrom(getBucket(k), k, item);
+    }
+
+    bool remove(K k, int tid)
+    {
+        return List::removeFrom(getBucket(k), k);
+    }
+
+    bool contains(K k, int tid)
+    {
+        return List::containsFrom(getBucket(k), k);
+    }
+
+    bool get(K k, T &value, int tid)
     {
-        LinkFreeList<T> &bucket = getBucket(k);
-        return bucket.insert(k, item, tid);
+        return List::getFrom(getBucket(k), k, value);
     }
 
-    bool remove(int k, int tid)
+    bool upsert(K k, T item, int tid)
     {
-        LinkFreeList<T> &bucket = getBucket(k);
-        return bucket.remove(k, tid);
+        return List::upsertFrom(getBucket(k), k, item);
     }
 
-    bool contains(int k, int tid)
+    bool compareAndSwapValue(K k, T expected, T desired, int tid)
     {
-        LinkFreeList<T> &bucket = getBucket(k);
-        return bucket.contains(k, tid);
+        return List::compareAndSwapValueFrom(getBucket(k), k, expected, desired);
     }
 
     std::string myName(){
         return "Link Free Hash Table";
     }
 
+    uint64_t buckets(){
+        return size;
+    }
+
+    // rebuilds the buckets from the nodes in the chunks of alloc, which all the buckets
+    // share: the chunks are scanned once, the surviving nodes are grouped by bucket and
+    // the buckets are sorted and linked in parallel
+    RecoveryStats recover(int numThreads = 1)
+    {
+        typedef typename List::Entry Entry;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::vector<Entry>> valid(numThreads);
+        RecoveryStats stats = {0, List::collect(numThreads, valid), 0};
+
+        std::vector<uint64_t> offsets;
+        auto nodes = recoveryUtils::partition(valid, size, offsets, numThreads,
+                                              [&](const Entry &e) { return bucketOf(e.key); });
+        recoveryUtils::parallelRun(numThreads, [&](int tid) {
+            uint64_t begin, end;
+            recoveryUtils::split(size, tid, numThreads, &begin, &end);
+            for (uint64_t b = begin; b < end; b++)
+            {
+                std::sort(nodes.begin() + offsets[b], nodes.begin() + offsets[b + 1]);
+                List::linkSorted(&heads[b], nodes.data() + offsets[b], offsets[b + 1] - offsets[b], 1);
+            }
+        });
+
+        stats.recovered = nodes.size();
+        stats.seconds = recoveryUtils::secondsSince(start);
+        return stats;
+    }
+
   private:
-    LinkFreeList<T>& getBucket(int k){
-        return table[std::abs(k % BUCKET_NUM)];
+    uint64_t bucketOf(K k){
+        return Traits::hash(k) >> shift;
+    }
+
+    Node *getBucket(K k){
+        return &heads[bucketOf(k)];
     }
 
-    LinkFreeList<T> table[BUCKET_NUM];
+    const uint64_t size;
+    const int shift;
+    Node *heads;
+    Node *tail;
 };
 
-#endif
\ No newline at end of file
+#endif
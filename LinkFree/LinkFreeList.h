@@ -2,18 +2,23 @@
 #define LINK_FREE_LIST_H_
 
 #include <vector>
+#include <algorithm>
 #include <climits>
 #include "utilities.h"
 #include <atomic>
 #include <cassert>
 #include "ssmem.h"
+#include "RecoveryUtils.h"
+#include "EpochUtils.h"
+#include "KeyTraits.h"
+#include "ValueTraits.h"
 #include <stdint.h>
 #include <stdlib.h>
 
 //#define LOAD_MO std::memory_order_relaxed
 #define LOAD_MO
 
-template <class T>
+template <class T, class K = intptr_t, class Traits = KeyTraits<K>>
 class LinkFreeList
 {
 public:
@@ -23,13 +28,20 @@ public:
         std::atomic<uchar> metaData;
         std::atomic<bool> insertFlag;
         std::atomic<bool> deleteFlag;
-        intptr_t key;
-        T value;
+        // the value updates in flight, whose values the readers flush
+        std::atomic<uchar> valueWriters;
+        // the epochs of the insertion and the deletion in buffered durability, 0 otherwise
+        std::atomic<epochUtils::stamp_t> insertStamp;
+        std::atomic<epochUtils::stamp_t> deleteStamp;
+        K key;
+        std::atomic<T> value;
         std::atomic<Node *> next;
 
-        Node() : metaData(0), next(nullptr), insertFlag(false), deleteFlag(false) {}
+        Node() : metaData(0), insertFlag(false), deleteFlag(false), valueWriters(0), insertStamp(0), deleteStamp(0),
+                 next(nullptr) {}
 
-        Node(intptr_t key, T value, Node *next) : key(key), value(value), next(next), insertFlag(false), deleteFlag(false) {}
+        Node(K key, T value, Node *next) : insertFlag(false), deleteFlag(false), valueWriters(0), insertStamp(0),
+                                           deleteStamp(0), key(key), value(value), next(next) {}
 
         bool isMarked()
         {
@@ -38,62 +50,202 @@ public:
     } __attribute__((aligned((32))));
 
 private:
-    Node *allocNode(intptr_t key, T value, Node *next)
+    typedef linkFreeUtils::FlushBatch<Node> Batch;
+
+    static Node *allocNode(K key, T value, Node *next, epochUtils::stamp_t insertStamp = 0)
     {
         Node *newNode = static_cast<Node *>(ssmem_alloc(alloc, sizeof(Node)));
         linkFreeUtils::flipV1(&newNode->metaData);
         std::atomic_thread_fence(std::memory_order_release);
         newNode->insertFlag.store(false, std::memory_order_relaxed);
         newNode->deleteFlag.store(false, std::memory_order_relaxed);
-        newNode->key = key;
-        newNode->value = value;
+        newNode->valueWriters.store(0, std::memory_order_relaxed);
+        newNode->insertStamp.store(insertStamp, std::memory_order_relaxed);
+        newNode->deleteStamp.store(0, std::memory_order_relaxed);
+        newNode->key = Traits::store(key, newNode);
+        newNode->value.store(ValueTraits<T>::store(value, newNode), std::memory_order_relaxed);
         newNode->next.store(next, std::memory_order_relaxed);
         return newNode;
     }
 
-    void FLUSH_DELETE(Node *n)
+    // frees what the key and the value of a node refer to. The value is taken out of the
+    // node, since an update that raced with the removal may still replace it (see writeValue)
+    static void releaseNode(void *n)
+    {
+        Traits::release(static_cast<Node *>(n)->key);
+        if (ValueTraits<T>::outOfLine)
+            ValueTraits<T>::release(static_cast<Node *>(n)->value.exchange(T()));
+    }
+
+    // frees a node that was in the list, or failed to get in
+    static void freeNode(Node *n)
+    {
+        releaseNode(n);
+        ssmem_free(alloc, n);
+    }
+
+    // the flags let other threads skip the flush, so they are set only after
+    // the line is persistent
+    static void FLUSH_DELETE(Node *n)
     {
         if (LIKELY(n->deleteFlag.load()))
+        {
+            flush_elided(FLUSH_SITE_LINK_FREE_DELETE);
             return;
-        FLUSH(n);
+        }
+        BARRIER(n, FLUSH_SITE_LINK_FREE_DELETE);
         n->deleteFlag.store(true, std::memory_order_release);
     }
 
-    void FLUSH_INSERT(Node *n)
+    static void FLUSH_INSERT(Node *n)
     {
         if (LIKELY(n->insertFlag.load()))
+        {
+            flush_elided(FLUSH_SITE_LINK_FREE_INSERT);
             return;
-        FLUSH(n);
+        }
+        BARRIER(n, FLUSH_SITE_LINK_FREE_INSERT);
         n->insertFlag.store(true, std::memory_order_release);
     }
 
-    //trim curr
-    bool trim(Node *pred, Node *curr)
+    // a value update is persistent before it returns, and a thread that reads the value
+    // while an update is in flight flushes it before it returns it. update(v, stored, old)
+    // replaces v with stored, the value as the node keeps it, puts the value it replaced in
+    // old and returns whether it did. The value that is left out is released
+    template <class Update>
+    static bool writeValue(Node *n, T value, Update update)
+    {
+        T stored = ValueTraits<T>::store(value, n), old = stored;
+        n->valueWriters.fetch_add(1);
+        bool changed = update(n->value, stored, old);
+        // a failed update returns the value of another update, which may not be persistent yet
+        if (changed || n->valueWriters.load() > 1)
+            BARRIER(n, FLUSH_SITE_VALUE);
+        n->valueWriters.fetch_sub(1);
+        // the removal of the node may have released its value before this update replaced it.
+        // The node is done with before the values are released, since a release lets the other
+        // threads reclaim it
+        T expected = stored;
+        bool orphaned = ValueTraits<T>::outOfLine && changed && n->isMarked() &&
+                        n->value.compare_exchange_strong(expected, T());
+        ValueTraits<T>::release(changed ? old : stored);
+        if (orphaned)
+            ValueTraits<T>::release(stored);
+        return changed;
+    }
+
+    //trim curr, a node of a batch is freed with the batch
+    static bool trim(Node *pred, Node *curr, Batch *batch = nullptr)
     {
         FLUSH_DELETE(curr);
         Node *succ = linkFreeUtils::getRef<Node>(curr->next.load());
         bool result = pred->next.compare_exchange_strong(curr, succ);
         if (LIKELY(result))
-            ssmem_free(alloc, curr);
+        {
+            if (batch != nullptr)
+                batch->retired.push_back(curr);
+            else
+                freeNode(curr);
+        }
         return result;
     }
 
-    Node *find(intptr_t key, Node **predPtr)
+    // head is a node that was in the list when the search started, it may be removed since
+    static Node *find(Node *head, K key, Node **predPtr, Batch *batch = nullptr)
     {
-        Node *prev = head, *curr = head->next.load();
+        Node *prev = head, *curr = linkFreeUtils::getRef<Node>(head->next.load());
 
         while (true)
         {
             // curr is not marked
             if (LIKELY(!linkFreeUtils::isMarked(curr->next)))
             {
-                if (UNLIKELY(curr->key >= key))
+                if (UNLIKELY(!Traits::less(curr->key, key)))
+                    break;
+                prev = curr;
+            }
+            else
+            {
+                trim(prev, curr, batch);
+            }
+            curr = linkFreeUtils::getRef<Node>(curr->next);
+        }
+        *predPtr = prev;
+        return curr;
+    }
+
+    // where a search of a batch starts: pred, the predecessor of the previous key of the
+    // batch, unless it was removed since
+    static Node *resume(Node *head, Node *pred)
+    {
+        return pred->isMarked() ? head : pred;
+    }
+
+    // the search of contains from start: the first node that is not smaller than key, and in
+    // predPtr the last node before it that was not marked. It trims nothing, so the batches
+    // pass their own marked nodes without flushing them
+    static Node *seek(Node *start, K key, Node **predPtr)
+    {
+        Node *pred = start, *curr = linkFreeUtils::getRef<Node>(start->next.load());
+        while (Traits::less(curr->key, key))
+        {
+            Node *next = curr->next.load();
+            if (!linkFreeUtils::isMarked(next))
+                pred = curr;
+            curr = linkFreeUtils::getRef<Node>(next);
+        }
+        *predPtr = pred;
+        return curr;
+    }
+
+    // whether n, the first node of a search that is not smaller than key, has key. The tail
+    // has the largest key too (see KeyTraits.h), and it is the only node without a successor
+    static bool hasKey(Node *n, K key)
+    {
+        return Traits::equal(n->key, key) &&
+               (LIKELY(!Traits::equal(key, Traits::max())) || linkFreeUtils::getRef<Node>(n->next.load()) != nullptr);
+    }
+
+    // Buffered durability (see EpochUtils.h): the updates stamp the nodes with their epoch
+    // instead of flushing them. A remover claims a node by stamping its deletion and then
+    // marks it, so a node is deleted once it has a delete stamp
+
+    static void markBuffered(Node *n)
+    {
+        Node *next = n->next.load();
+        while (!linkFreeUtils::isMarked(next) &&
+               !n->next.compare_exchange_weak(next, linkFreeUtils::mark<Node>(next)))
+            ;
+    }
+
+    static bool trimBuffered(Node *pred, Node *curr)
+    {
+        epochUtils::waitUnlinkable(curr->deleteStamp.load());
+        Node *succ = linkFreeUtils::getRef<Node>(curr->next.load());
+        bool result = pred->next.compare_exchange_strong(curr, succ);
+        if (LIKELY(result))
+            epochUtils::retire(curr, releaseNode);
+        return result;
+    }
+
+    // find of an operation of epoch e, which moves to a later epoch if it passes one of its deletions
+    static Node *findBuffered(Node *head, K key, Node **predPtr, uint64_t &e)
+    {
+        Node *prev = head, *curr = head->next.load();
+
+        while (true)
+        {
+            if (LIKELY(!linkFreeUtils::isMarked(curr->next)))
+            {
+                if (UNLIKELY(!Traits::less(curr->key, key)))
                     break;
                 prev = curr;
             }
             else
             {
-                trim(prev, curr);
+                if (epochUtils::newer(curr->deleteStamp.load(), e))
+                    e = epochUtils::restart();
+                trimBuffered(prev, curr);
             }
             curr = linkFreeUtils::getRef<Node>(curr->next);
         }
@@ -101,22 +253,293 @@ private:
         return curr;
     }
 
+    static bool insertBuffered(Node *head, K key, T value)
+    {
+        uint64_t e = epochUtils::enter();
+        bool result;
+        while (true)
+        {
+            Node *pred = nullptr;
+            Node *curr = findBuffered(head, key, &pred, e);
+
+            if (hasKey(curr, key))
+            {
+                if (epochUtils::newer(curr->insertStamp.load(), e) || epochUtils::newer(curr->deleteStamp.load(), e))
+                {
+                    e = epochUtils::restart();
+                    continue;
+                }
+                if (curr->deleteStamp.load() != 0)
+                {
+                    markBuffered(curr);
+                    continue;
+                }
+                linkFreeUtils::makeValid(&curr->metaData);
+                result = false;
+                break;
+            }
+
+            Node *newNode = allocNode(key, value, curr, epochUtils::stampOf(e));
+
+            if (pred->next.compare_exchange_strong(curr, newNode))
+            {
+                linkFreeUtils::makeValid(&newNode->metaData);
+                epochUtils::dirty(e, newNode, &newNode->insertStamp, 0);
+                result = true;
+                break;
+            }
+
+            newNode->next.store(linkFreeUtils::mark<Node>(nullptr));
+            linkFreeUtils::makeValid(&newNode->metaData);
+            freeNode(newNode);
+        }
+        epochUtils::exit();
+        return result;
+    }
+
+    static bool removeBuffered(Node *head, K key)
+    {
+        uint64_t e = epochUtils::enter();
+        bool result = false;
+        while (true)
+        {
+            Node *pred = nullptr;
+            Node *curr = findBuffered(head, key, &pred, e);
+            if (!hasKey(curr, key))
+                break;
+            if (epochUtils::newer(curr->insertStamp.load(), e))
+            {
+                e = epochUtils::restart();
+                continue;
+            }
+
+            linkFreeUtils::makeValid(&curr->metaData);
+            epochUtils::stamp_t claimed = 0;
+            if (!curr->deleteStamp.compare_exchange_strong(claimed, epochUtils::stampOf(e)))
+            {
+                // removed by another thread, which is helped before looking again
+                if (epochUtils::newer(claimed, e))
+                    e = epochUtils::restart();
+                markBuffered(curr);
+                continue;
+            }
+            markBuffered(curr);
+            epochUtils::dirty(e, curr, &curr->deleteStamp, epochUtils::DELETED);
+            trimBuffered(pred, curr);
+            result = true;
+            break;
+        }
+        epochUtils::exit();
+        return result;
+    }
+
+    // the value updates stay strictly durable, so that the recovered value of a key is never older
+    // than its last acknowledged update
+    template <class Update>
+    static bool updateBuffered(Node *head, K key, T value, Update update)
+    {
+        uint64_t e = epochUtils::enter();
+        bool result;
+        while (true)
+        {
+            Node *pred = nullptr;
+            Node *curr = findBuffered(head, key, &pred, e);
+            if (hasKey(curr, key) &&
+                (epochUtils::newer(curr->insertStamp.load(), e) || epochUtils::newer(curr->deleteStamp.load(), e)))
+            {
+                e = epochUtils::restart();
+                continue;
+            }
+            result = hasKey(curr, key) && curr->deleteStamp.load() == 0;
+            if (result)
+            {
+                linkFreeUtils::makeValid(&curr->metaData);
+                writeValue(curr, value, update);
+            }
+            break;
+        }
+        epochUtils::exit();
+        return result;
+    }
+
+    static bool containsBuffered(Node *head, K key)
+    {
+        Node *curr = head->next.load();
+        while (Traits::less(curr->key, key))
+        {
+            curr = linkFreeUtils::getRef<Node>(curr->next.load());
+        }
+        return hasKey(curr, key) && !linkFreeUtils::isMarked(curr->next.load()) && curr->deleteStamp.load() == 0;
+    }
+
 public:
     LinkFreeList()
     {
-        Node *max = new Node(INT_MAX, 0, nullptr);
-        Node *min = new Node(INT_MIN, 0, max);
+        Node *max = new Node(Traits::max(), T(), nullptr);
+        Node *min = new Node(Traits::min(), T(), max);
         head = min;
     }
 
-    bool insert(intptr_t key, T value, int tid)
+    bool insert(K key, T value, int tid)
+    {
+        return insertFrom(head, key, value);
+    }
+
+    bool remove(K key, int tid)
+    {
+        return removeFrom(head, key);
+    }
+
+    bool contains(K key, int tid)
+    {
+        return containsFrom(head, key);
+    }
+
+    bool get(K key, T &value, int tid)
+    {
+        return getFrom(head, key, value);
+    }
+
+    bool upsert(K key, T value, int tid)
+    {
+        return upsertFrom(head, key, value);
+    }
+
+    bool compareAndSwapValue(K key, T expected, T desired, int tid)
+    {
+        return compareAndSwapValueFrom(head, key, expected, desired);
+    }
+
+    // The batches run the operation of every key in key order, each search from the
+    // predecessor of the previous key, and wait for all their flushes at once at the end
+    // (see FlushBatch). Every operation is linearizable on its own, the batch is not atomic.
+    // They return how many of the operations succeeded, and with buffered durability they
+    // run the operations one by one
+
+    size_t insertBatch(std::vector<std::pair<K, T>> batch, int tid)
+    {
+        std::sort(batch.begin(), batch.end(),
+                  [](const std::pair<K, T> &a, const std::pair<K, T> &b) { return Traits::less(a.first, b.first); });
+        size_t inserted = 0;
+        if (epochUtils::enabled)
+        {
+            for (auto &item : batch)
+                inserted += insertBuffered(head, item.first, item.second);
+            return inserted;
+        }
+        Batch flushes;
+        Node *pred = head;
+        for (auto &item : batch)
+        {
+            while (true)
+            {
+                Node *curr = find(resume(head, pred), item.first, &pred, &flushes);
+                if (hasKey(curr, item.first))
+                {
+                    linkFreeUtils::makeValid(&curr->metaData);
+                    flushes.flushInsert(curr);
+                    break;
+                }
+                Node *newNode = allocNode(item.first, item.second, curr);
+                if (pred->next.compare_exchange_strong(curr, newNode))
+                {
+                    linkFreeUtils::makeValid(&newNode->metaData);
+                    flushes.flushInsert(newNode);
+                    inserted++;
+                    break;
+                }
+                newNode->next.store(linkFreeUtils::mark<Node>(nullptr));
+                linkFreeUtils::makeValid(&newNode->metaData);
+                flushes.retired.push_back(newNode);
+            }
+        }
+        flushes.wait();
+        flushes.release(freeNode);
+        return inserted;
+    }
+
+    // marks the nodes of the keys first, and trims them once their marks are persistent
+    size_t removeBatch(std::vector<K> keys, int tid)
+    {
+        std::sort(keys.begin(), keys.end(), [](const K &a, const K &b) { return Traits::less(a, b); });
+        size_t removed = 0;
+        if (epochUtils::enabled)
+        {
+            for (K &key : keys)
+                removed += removeBuffered(head, key);
+            return removed;
+        }
+        Batch flushes;
+        Node *pred = head;
+        for (K &key : keys)
+        {
+            Node *curr = seek(resume(head, pred), key, &pred);
+            if (!hasKey(curr, key))
+                continue;
+            linkFreeUtils::makeValid(&curr->metaData);
+            Node *succ = curr->next.load();
+            while (!linkFreeUtils::isMarked(succ))
+            {
+                if (curr->next.compare_exchange_weak(succ, linkFreeUtils::mark<Node>(succ)))
+                {
+                    removed++;
+                    break;
+                }
+            }
+            flushes.flushDelete(curr);
+        }
+        flushes.wait();
+        pred = head;
+        for (size_t i = 0; i < keys.size() && removed > 0; i++)
+            find(resume(head, pred), keys[i], &pred, &flushes);
+        flushes.release(freeNode);
+        return removed;
+    }
+
+    size_t containsBatch(std::vector<K> keys, int tid)
+    {
+        std::sort(keys.begin(), keys.end(), [](const K &a, const K &b) { return Traits::less(a, b); });
+        size_t found = 0;
+        if (epochUtils::enabled)
+        {
+            for (K &key : keys)
+                found += containsBuffered(head, key);
+            return found;
+        }
+        Batch flushes;
+        Node *pred = head;
+        for (K &key : keys)
+        {
+            Node *curr = seek(resume(head, pred), key, &pred);
+            if (!hasKey(curr, key))
+                continue;
+            if (curr->isMarked())
+            {
+                flushes.flushDelete(curr);
+                continue;
+            }
+            linkFreeUtils::makeValid(&curr->metaData);
+            flushes.flushInsert(curr);
+            found++;
+        }
+        flushes.wait();
+        return found;
+    }
+
+    // The operations on the list that starts at head (a node that is never removed) and
+    // ends with a node of a larger key than all the others, for the structures that
+    // build on the list
+
+    static bool insertFrom(Node *head, K key, T value)
     {
+        if (epochUtils::enabled)
+            return insertBuffered(head, key, value);
         do
         {
             Node *pred = nullptr;
-            Node *curr = find(key, &pred);
+            Node *curr = find(head, key, &pred);
 
-            if (curr->key == key)
+            if (hasKey(curr, key))
             {
                 linkFreeUtils::makeValid(&curr->metaData);
                 FLUSH_INSERT(curr);
@@ -135,18 +558,20 @@ public:
             // freeing newNode in a deleted and valid state
             newNode->next.store(linkFreeUtils::mark<Node>(nullptr));
             linkFreeUtils::makeValid(&newNode->metaData);
-            ssmem_free(alloc, newNode);
+            freeNode(newNode);
         } while (true);
     }
 
-    bool remove(intptr_t key, int tid)
+    static bool removeFrom(Node *head, K key)
     {
+        if (epochUtils::enabled)
+            return removeBuffered(head, key);
         bool result = false;
         Node *pred, *curr, *succ, *markedSucc;
         do
         {
-            curr = find(key, &pred);
-            if (curr->key != key)
+            curr = find(head, key, &pred);
+            if (!hasKey(curr, key))
                 return false;
 
             succ = linkFreeUtils::getRef<Node>(curr->next);
@@ -158,16 +583,18 @@ public:
         return true;
     }
 
-    bool contains(intptr_t key, int tid)
+    static bool containsFrom(Node *head, K key)
     {
+        if (epochUtils::enabled)
+            return containsBuffered(head, key);
         Node *curr = head->next.load();
         bool marked = false;
         //wait free find
-        while (curr->key < key)
+        while (Traits::less(curr->key, key))
         {
             curr = linkFreeUtils::getRef<Node>(curr->next.load());
         }
-        if (curr->key != key)
+        if (!hasKey(curr, key))
             return false;
 
         marked = linkFreeUtils::isMarked(curr->next.load());
@@ -182,66 +609,216 @@ public:
         return true;
     }
 
-    void quickInsert(Node *newNode)
+    // reads the value of key into value, returns false if the key is not in the list
+    static bool getFrom(Node *head, K key, T &value)
+    {
+        Node *curr = head->next.load();
+        while (Traits::less(curr->key, key))
+        {
+            curr = linkFreeUtils::getRef<Node>(curr->next.load());
+        }
+        if (!hasKey(curr, key))
+            return false;
+
+        // the node is checked after the value is read, so it was in the list when it was read
+        T currValue = curr->value.load();
+        if (epochUtils::enabled)
+        {
+            if (linkFreeUtils::isMarked(curr->next.load()) || curr->deleteStamp.load() != 0)
+                return false;
+        }
+        else if (linkFreeUtils::isMarked(curr->next.load()))
+        {
+            FLUSH_DELETE(curr);
+            return false;
+        }
+        else
+        {
+            linkFreeUtils::makeValid(&curr->metaData);
+            FLUSH_INSERT(curr);
+        }
+        if (UNLIKELY(curr->valueWriters.load() != 0))
+            BARRIER(curr, FLUSH_SITE_VALUE);
+        value = currValue;
+        return true;
+    }
+
+    // applies update with value to the value of the node of key (see writeValue) and returns
+    // false if there is no such node. An update that races with the removal of the node takes
+    // effect right before it
+    template <class Update>
+    static bool updateFrom(Node *head, K key, T value, Update update)
+    {
+        if (epochUtils::enabled)
+            return updateBuffered(head, key, value, update);
+        Node *pred = nullptr;
+        Node *curr = find(head, key, &pred);
+        if (!hasKey(curr, key))
+            return false;
+        linkFreeUtils::makeValid(&curr->metaData);
+        FLUSH_INSERT(curr);
+        writeValue(curr, value, update);
+        return true;
+    }
+
+    // sets the value of key, inserting it if it is not in the list. Returns whether it
+    // inserted the key
+    static bool upsertFrom(Node *head, K key, T value)
     {
-        intptr_t key = newNode->key;
-        Node *pred = nullptr, *curr = nullptr, *succ = nullptr;
-    retry:
-        pred = const_cast<Node *>(head);
-        curr = linkFreeUtils::getRef<Node>(pred->next.load());
-        //inline the find function
+        // a removal or an insertion of the key may come in between, until one of the two finds
+        // the key in the state it needs
         while (true)
         {
-            succ = curr->next.load();
-            //trimming
-            while (linkFreeUtils::isMarked(succ))
-            {
-                assert(false);
-            }
-            //continue searching
-            if (curr->key < key)
-            {
-                pred = curr;
-                curr = succ;
-            }
-            //found the same
-            else if (curr->key == key)
-            {
-                assert(false);
-            }
-            else
-            {
-                newNode->next.store(curr, std::memory_order_relaxed);
-                if (!pred->next.compare_exchange_strong(curr, newNode))
-                    goto retry;
-                return;
-            }
+            if (updateFrom(head, key, value, [](std::atomic<T> &v, T stored, T &old) {
+                    old = v.exchange(stored);
+                    return true;
+                }))
+                return false;
+            if (insertFrom(head, key, value))
+                return true;
         }
     }
 
-    void recover()
+    // sets the value of key to desired if it is expected
+    static bool compareAndSwapValueFrom(Node *head, K key, T expected, T desired)
+    {
+        bool swapped = false;
+        updateFrom(head, key, desired, [&](std::atomic<T> &v, T stored, T &old) {
+            old = expected;
+            return swapped = v.compare_exchange_strong(old, stored);
+        });
+        return swapped;
+    }
+
+    // links node, a volatile node that is never removed, into the list that starts at head
+    // unless the list has a node with its key. Returns the node of the list with the key
+    static Node *linkFrom(Node *head, Node *node)
     {
-        auto curr = alloc->mem_chunks;
-        for (; curr != nullptr; curr = curr->next)
+        bool buffered = epochUtils::enabled;
+        uint64_t e = buffered ? epochUtils::enter() : 0;
+        Node *pred, *curr;
+        while (true)
         {
-            Node *currChunk = static_cast<Node *>(curr->obj);
-            uint64_t numOfNodes = SSMEM_DEFAULT_MEM_SIZE / sizeof(Node);
-            for (uint64_t i = 0; i < numOfNodes; i++)
+            curr = buffered ? findBuffered(head, node->key, &pred, e) : find(head, node->key, &pred);
+            if (hasKey(curr, node->key))
+                break;
+            node->next.store(curr, std::memory_order_relaxed);
+            if (pred->next.compare_exchange_strong(curr, node))
             {
-                Node *currNode = currChunk[i];
+                curr = node;
+                break;
+            }
+        }
+        if (buffered)
+            epochUtils::exit();
+        return curr;
+    }
+
+    typedef recoveryUtils::SortEntry<Node, K, Traits> Entry;
+
+    // rebuilds the list from the nodes in the chunks of alloc, using numThreads threads
+    RecoveryStats recover(int numThreads = 1)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::vector<Entry>> valid(numThreads);
+        RecoveryStats stats = {0, collect(numThreads, valid), 0};
+
+        auto nodes = recoveryUtils::gather(valid, numThreads);
+        recoveryUtils::parallelSort(nodes, numThreads);
+        linkSorted(head, nodes.data(), nodes.size(), numThreads);
+
+        stats.recovered = nodes.size();
+        stats.seconds = recoveryUtils::secondsSince(start);
+        return stats;
+    }
+
+    // scans the chunks of alloc with numThreads threads: every thread adds the nodes
+    // that are in the set to its vector in valid, and the rest are reclaimed with their
+    // keys. Returns the number of reclaimed nodes
+    static uint64_t collect(int numThreads, std::vector<std::vector<Entry>> &valid)
+    {
+        auto chunks = recoveryUtils::getChunks(alloc);
+        std::vector<std::vector<Node *>> garbage(numThreads);
+        uint64_t persisted = epochUtils::persistedEpoch();
+
+        recoveryUtils::parallelRun(numThreads, [&](int tid) {
+            recoveryUtils::forEachSlot<Node>(chunks, tid, numThreads, [&](Node *currNode) {
                 // the node was never initialized, no need to free it or add it
                 if (currNode->next.load() == nullptr && linkFreeUtils::isValid(currNode->metaData.load()))
-                    continue;
-                if (!linkFreeUtils::isValid(currNode->metaData.load()) || currNode->isMarked())
+                    return;
+                epochUtils::stamp_t insertStamp = currNode->insertStamp.load();
+                epochUtils::stamp_t deleteStamp = currNode->deleteStamp.load();
+                // a deletion of an epoch that was not persisted is undone
+                if (epochUtils::lost(deleteStamp, persisted))
+                {
+                    currNode->next.store(linkFreeUtils::getRef<Node>(currNode->next.load()));
+                    deleteStamp = 0;
+                }
+                if (!linkFreeUtils::isValid(currNode->metaData.load()) || currNode->isMarked() ||
+                    epochUtils::lost(insertStamp, persisted) || deleteStamp != 0)
                 {
                     currNode->next.store(linkFreeUtils::mark<Node>(nullptr));
                     linkFreeUtils::makeValid(&currNode->metaData);
-                    ssmem_free(alloc, currNode);
+                    garbage[tid].push_back(currNode);
                 }
                 else
-                    quickInsert(currNode);
-            }
+                {
+                    // the updates in flight were lost with the crash
+                    currNode->valueWriters.store(0, std::memory_order_relaxed);
+                    valid[tid].push_back({currNode->key, currNode});
+                }
+                // the stamps are cleared for the epochs that start after the recovery
+                if (insertStamp != 0 || currNode->deleteStamp.load() != 0)
+                {
+                    currNode->insertStamp.store(0, std::memory_order_relaxed);
+                    currNode->deleteStamp.store(0, std::memory_order_relaxed);
+                    FLUSH(currNode);
+                }
+            });
+            SFENCE();
+        });
+
+        // alloc is thread-local, so only this thread can free into it
+        uint64_t reclaimed = 0;
+        for (int tid = 0; tid < numThreads; tid++)
+        {
+            for (Node *n : garbage[tid])
+                ssmem_free(alloc, n);
+            reclaimed += garbage[tid].size();
         }
+        recoverRefs(numThreads);
+        return reclaimed;
+    }
+
+    // frees what the keys and the values of the nodes that are not in the list refer to,
+    // once the recovery classified the nodes
+    static void recoverRefs(int numThreads)
+    {
+        auto inList = [](Node *n) { return linkFreeUtils::isValid(n->metaData.load()) && !n->isMarked(); };
+        Traits::recover(numThreads, [&](void *owner, K &key) {
+            key = static_cast<Node *>(owner)->key;
+            return inList(static_cast<Node *>(owner));
+        });
+        ValueTraits<T>::recover(numThreads, [&](void *owner, T &value) {
+            value = static_cast<Node *>(owner)->value.load();
+            return inList(static_cast<Node *>(owner));
+        });
+    }
+
+    // links n nodes, sorted by key, into the empty list that starts at head in one pass
+    static void linkSorted(Node *head, Entry *nodes, uint64_t n, int numThreads)
+    {
+        Node *max = head->next.load();
+        recoveryUtils::parallelRun(numThreads, [&](int tid) {
+            uint64_t begin, end;
+            recoveryUtils::split(n, tid, numThreads, &begin, &end);
+            for (uint64_t i = begin; i < end; i++)
+            {
+                assert(i + 1 == n || Traits::less(nodes[i].key, nodes[i + 1].key));
+                nodes[i].node->next.store(i + 1 < n ? nodes[i + 1].node : max, std::memory_order_relaxed);
+            }
+        });
+        head->next.store(n > 0 ? nodes[0].node : max);
     }
 
 private:
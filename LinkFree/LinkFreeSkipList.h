@@ -2,15 +2,22 @@
 #define LINK_FREE_SKIP_LIST_H_
 
 #include <vector>
+#include <algorithm>
 #include <climits>
+#include <new>
 #include "utilities.h"
 #include <atomic>
 #include <cassert>
 #include "ssmem.h"
+#include "RecoveryUtils.h"
+#include "KeyTraits.h"
+#include "ValueTraits.h"
+#include "ScanUtils.h"
+#include "TowerUtils.h"
 #include <stdint.h>
 #include <stdlib.h>
 
-template <class T>
+template <class T, class K = intptr_t, class Traits = KeyTraits<K>>
 class LinkFreeSkipList
 {
 public:
@@ -21,59 +28,186 @@ public:
         std::atomic<bool> insertFlag;
         std::atomic<bool> deleteFlag;
         uchar topLevel;
-        intptr_t key;
-        T value;
-        std::atomic<Node *> next[MAX_LEVEL];
+        // the value updates in flight, whose values the readers flush
+        std::atomic<uchar> valueWriters;
+        K key;
+        std::atomic<T> value;
+        // topLevel links, as many as the size class of the node holds (see TowerUtils.h)
+        std::atomic<Node *> next[];
 
-        Node() : metaData(0), insertFlag(false), deleteFlag(false) {}
+        Node() : metaData(0), insertFlag(false), deleteFlag(false), valueWriters(0) {}
 
-        Node(intptr_t key, T value, uchar topLevel) : key(key), value(value), topLevel(topLevel),
-                                                      insertFlag(false), deleteFlag(false) {}
+        Node(K key, T value, uchar topLevel) : insertFlag(false), deleteFlag(false), topLevel(topLevel),
+                                               valueWriters(0), key(key), value(value) {}
 
         bool isMarked()
         {
             return linkFreeUtils::isMarked(next[0].load());
         }
-    } __attribute__((aligned((64))));
+    };
 
 private:
-    Node *allocNode(intptr_t key, T value, uchar topLevel)
+    typedef linkFreeUtils::FlushBatch<Node> Batch;
+
+    // the flushes of a node only cover its first cache line
+    static_assert(sizeof(Node) + sizeof(std::atomic<Node *>) <= CACHE_LINE_SIZE, "the bottom link is on the first line");
+    static_assert(sizeof(Node) + MAX_LEVEL * sizeof(std::atomic<Node *>) <= towerUtils::MAX_TOWER, "the towers fit a class");
+
+    static size_t nodeSize(int topLevel)
+    {
+        return sizeof(Node) + topLevel * sizeof(std::atomic<Node *>);
+    }
+
+    // the sentinels are as high as a tower can be
+    static Node *newSentinel(K key)
+    {
+        void *mem = aligned_alloc(CACHE_LINE_SIZE, towerUtils::MAX_TOWER);
+        assert(mem != nullptr);
+        return new (mem) Node(key, T(), MAX_LEVEL);
+    }
+
+    // the levels the searches start from: no node was linked above the highest tower so far
+    int height()
+    {
+        return maxLevel.load(std::memory_order_acquire);
+    }
+
+    void raiseHeight(int topLevel)
     {
-        Node *newNode = static_cast<Node *>(ssmem_alloc(alloc, sizeof(Node)));
+        int h = maxLevel.load();
+        while (h < topLevel && !maxLevel.compare_exchange_weak(h, topLevel))
+            ;
+    }
+
+    // the levels of a search from head that are above h: only the links of the head
+    // can be there, so they are its predecessors and successors
+    void fillAbove(int h, Node **preds, Node **succs)
+    {
+        for (int i = h; i < MAX_LEVEL; i++)
+        {
+            preds[i] = head;
+            succs[i] = head->next[i].load();
+        }
+    }
+
+    Node *allocNode(K key, T value, uchar topLevel)
+    {
+        Node *newNode = static_cast<Node *>(towerUtils::allocTower(true, nodeSize(topLevel)));
         linkFreeUtils::flipV1(&newNode->metaData);
         std::atomic_thread_fence(std::memory_order_release);
         newNode->insertFlag.store(false, std::memory_order_relaxed);
         newNode->deleteFlag.store(false, std::memory_order_relaxed);
-        newNode->key = key;
-        newNode->value = value;
+        newNode->valueWriters.store(0, std::memory_order_relaxed);
+        newNode->key = Traits::store(key, newNode);
+        newNode->value.store(ValueTraits<T>::store(value, newNode), std::memory_order_relaxed);
         newNode->topLevel = topLevel;
         return newNode;
     }
 
+    // frees a node that was in the list, or failed to get in, with what its key and its value
+    // refer to. The value is taken out of the node, since an update that raced with the
+    // removal may still replace it (see writeValue)
+    static void freeNode(Node *n)
+    {
+        Traits::release(n->key);
+        if (ValueTraits<T>::outOfLine)
+            ValueTraits<T>::release(n->value.exchange(T()));
+        towerUtils::freeTower(true, n, nodeSize(n->topLevel));
+    }
+
     void FLUSH_DELETE(Node *n)
     {
         if (LIKELY(n->deleteFlag.load()))
+        {
+            flush_elided(FLUSH_SITE_LINK_FREE_DELETE);
             return;
-        FLUSH(n);
+        }
+        BARRIER(n, FLUSH_SITE_LINK_FREE_DELETE);
         n->deleteFlag.store(true, std::memory_order_release);
     }
 
     void FLUSH_INSERT(Node *n)
     {
         if (LIKELY(n->insertFlag.load()))
+        {
+            flush_elided(FLUSH_SITE_LINK_FREE_INSERT);
             return;
-        FLUSH(n);
+        }
+        BARRIER(n, FLUSH_SITE_LINK_FREE_INSERT);
         n->insertFlag.store(true, std::memory_order_release);
     }
 
-    bool find(intptr_t key, Node **preds, Node **succs)
+    // a value update is persistent before it returns, and a thread that reads the value
+    // while an update is in flight flushes it before it returns it. update(v, stored, old)
+    // replaces v with stored, the value as the node keeps it, puts the value it replaced in
+    // old and returns whether it did. The value that is left out is released
+    template <class Update>
+    bool writeValue(Node *n, T value, Update update)
+    {
+        T stored = ValueTraits<T>::store(value, n), old = stored;
+        n->valueWriters.fetch_add(1);
+        bool changed = update(n->value, stored, old);
+        // a failed update returns the value of another update, which may not be persistent yet
+        if (changed || n->valueWriters.load() > 1)
+            BARRIER(n, FLUSH_SITE_VALUE);
+        n->valueWriters.fetch_sub(1);
+        // the removal of the node may have released its value before this update replaced it.
+        // The node is done with before the values are released, since a release lets the other
+        // threads reclaim it
+        T expected = stored;
+        bool orphaned = ValueTraits<T>::outOfLine && changed && n->isMarked() &&
+                        n->value.compare_exchange_strong(expected, T());
+        ValueTraits<T>::release(changed ? old : stored);
+        if (orphaned)
+            ValueTraits<T>::release(stored);
+        return changed;
+    }
+
+    // applies update with value to the value of the node of k (see writeValue) and returns
+    // false if there is no such node. An update that races with the removal of the node
+    // takes effect right before it
+    template <class Update>
+    bool update(K k, T value, Update update)
+    {
+        Node *succs[MAX_LEVEL];
+        if (!findSuccsNoCleanup(k, succs))
+            return false;
+        Node *node = succs[0];
+        linkFreeUtils::makeValid(&node->metaData);
+        FLUSH_INSERT(node);
+        scans.write(k, [&]() { return writeValue(node, value, update); });
+        return true;
+    }
+
+    // whether n, the first node of a search that is not smaller than key, has key. The tail
+    // has the largest key too (see KeyTraits.h), and it is the only node without a successor
+    static bool hasKey(Node *n, K key)
+    {
+        return Traits::equal(n->key, key) &&
+               (LIKELY(!Traits::equal(key, Traits::max())) || linkFreeUtils::getRef<Node>(n->next[0].load()) != nullptr);
+    }
+
+    // where a search of a batch goes on at level i from pred: finger, the predecessor of the
+    // previous key of the batch at that level, if it is further and was not removed since
+    static Node *resume(Node *pred, Node *finger, int i)
+    {
+        return Traits::less(pred->key, finger->key) && !linkFreeUtils::isMarked(finger->next[i].load()) ? finger : pred;
+    }
+
+    // the searches start from fingers (see resume) if they have them, fingers may be preds
+    bool find(K key, Node **preds, Node **succs, Node **fingers = nullptr)
     {
-        Node *pred, *predNext, *succ, *succNext;
+        Node *pred, *predNext, *succ = nullptr, *succNext;
 
     retry:
         pred = this->head;
-        for (int i = MAX_LEVEL - 1; i >= 0; i--)
+        int h = height();
+        if (preds != nullptr)
+            fillAbove(h, preds, succs);
+        for (int i = h - 1; i >= 0; i--)
         {
+            if (fingers != nullptr)
+                pred = resume(pred, fingers[i], i);
             predNext = pred->next[i].load();
             if (linkFreeUtils::isMarked(predNext))
                 goto retry;
@@ -90,7 +224,7 @@ private:
                     succ = linkFreeUtils::getRef<Node>(succNext);
                     succNext = succ->next[i].load();
                 }
-                if (succ->key >= key)
+                if (!Traits::less(succ->key, key))
                     break;
                 pred = succ;
                 predNext = succNext;
@@ -106,22 +240,26 @@ private:
             }
         }
 
-        return succ->key == key;
+        return hasKey(succ, key);
     }
 
-    bool findNoCleanup(intptr_t key, Node **preds, Node **succs)
+    bool findNoCleanup(K key, Node **preds, Node **succs, Node **fingers = nullptr)
     {
-        Node *pred, *succ;
+        Node *pred, *succ = nullptr;
 
         pred = this->head;
-        for (int i = MAX_LEVEL - 1; i >= 0; i--)
+        int h = height();
+        fillAbove(h, preds, succs);
+        for (int i = h - 1; i >= 0; i--)
         {
+            if (fingers != nullptr)
+                pred = resume(pred, fingers[i], i);
             succ = linkFreeUtils::getRef<Node>(pred->next[i].load());
             while (true)
             {
                 if (!linkFreeUtils::isMarked(succ->next[i].load()))
                 {
-                    if (succ->key >= key)
+                    if (!Traits::less(succ->key, key))
                         break;
                     pred = succ;
                 }
@@ -131,22 +269,22 @@ private:
             succs[i] = succ;
         }
 
-        return succ->key == key;
+        return hasKey(succ, key);
     }
 
-    bool findSuccsNoCleanup(intptr_t key, Node **succs)
+    bool findSuccsNoCleanup(K key, Node **succs)
     {
-        Node *pred, *succ;
+        Node *pred, *succ = nullptr;
 
         pred = this->head;
-        for (int i = MAX_LEVEL - 1; i >= 0; i--)
+        for (int i = height() - 1; i >= 0; i--)
         {
             succ = linkFreeUtils::getRef<Node>(pred->next[i].load());
             while (true)
             {
                 if (!linkFreeUtils::isMarked(succ->next[i].load()))
                 {
-                    if (succ->key >= key)
+                    if (!Traits::less(succ->key, key))
                         break;
                     pred = succ;
                 }
@@ -155,7 +293,7 @@ private:
             succs[i] = succ;
         }
 
-        return succ->key == key;
+        return hasKey(succ, key);
     }
 
     inline bool markNode(Node *node)
@@ -182,34 +320,28 @@ private:
         return result;
     }
 
-public:
-    LinkFreeSkipList()
-    {
-        this->head = new Node(INT_MIN, 0, MAX_LEVEL);
-        Node *last = new Node(INT_MAX, 0, MAX_LEVEL);
-        for (int i = 0; i < MAX_LEVEL; i++)
-        {
-            this->head->next[i].store(last);
-            last->next[i].store(nullptr);
-        }
-    }
-
-    bool insert(intptr_t k, T item, int tid)
+    // inserts k with its search from fingers (see resume), and leaves its predecessors in
+    // preds. A batch waits for the flush of the node, and frees the nodes that failed to get in
+    bool insertFrom(K k, T item, Node **preds, Node **fingers, Batch *batch)
     {
         Node *newNode, *pred, *succ, *next;
-        Node *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+        Node *succs[MAX_LEVEL];
 
     retry:
 
-        bool found = findNoCleanup(k, preds, succs);
+        bool found = findNoCleanup(k, preds, succs, fingers);
         if (found)
         {
             linkFreeUtils::makeValid(&succs[0]->metaData);
-            FLUSH_INSERT(succs[0]);
+            if (batch != nullptr)
+                batch->flushInsert(succs[0]);
+            else
+                FLUSH_INSERT(succs[0]);
             return false;
         }
 
         newNode = allocNode(k, item, get_random_level());
+        raiseHeight(newNode->topLevel);
 
         for (int i = 0; i < newNode->topLevel; i++)
         {
@@ -217,16 +349,22 @@ public:
         }
 
         Node *before = linkFreeUtils::getRef<Node>(succs[0]);
-        if (!preds[0]->next[0].compare_exchange_strong(before, newNode))
+        if (!scans.write(k, [&]() { return preds[0]->next[0].compare_exchange_strong(before, newNode); }))
         {
             newNode->next[0].store(linkFreeUtils::mark<Node>(nullptr));
             linkFreeUtils::makeValid(&newNode->metaData);
-            ssmem_free(alloc, newNode);
+            if (batch != nullptr)
+                batch->retired.push_back(newNode);
+            else
+                freeNode(newNode);
             goto retry;
         }
 
         linkFreeUtils::makeValid(&newNode->metaData);
-        FLUSH_INSERT(newNode);
+        if (batch != nullptr)
+            batch->flushInsert(newNode);
+        else
+            FLUSH_INSERT(newNode);
 
         for (int i = 1; i < newNode->topLevel; i++)
         {
@@ -247,13 +385,72 @@ public:
                 if (pred->next[i].compare_exchange_strong(succ, newNode))
                     break;
 
-                find(k, preds, succs);
+                find(k, preds, succs, fingers);
             }
         }
         return true;
     }
 
-    bool remove(intptr_t k, int tid)
+    // contains with its search from fingers, which it moves to the predecessors of k
+    bool containsFrom(K k, Node **fingers, Batch *batch)
+    {
+        Node *pred = this->head, *curr;
+
+        for (int i = height() - 1; i >= 0; i--)
+        {
+            if (fingers != nullptr)
+                pred = resume(pred, fingers[i], i);
+            curr = linkFreeUtils::getRef<Node>(pred->next[i].load());
+            while (Traits::less(curr->key, k) || linkFreeUtils::isMarked(curr->next[i].load()))
+            {
+                if (!linkFreeUtils::isMarked(curr->next[i].load()))
+                    pred = curr;
+                else if (i == 0 && Traits::equal(curr->key, k))
+                {
+                    if (batch != nullptr)
+                        batch->flushDelete(curr);
+                    else
+                        FLUSH_DELETE(curr);
+                    return false;
+                }
+                curr = linkFreeUtils::getRef<Node>(curr->next[i].load());
+            }
+            if (fingers != nullptr)
+                fingers[i] = pred;
+
+            // we found the right node
+            if (hasKey(curr, k))
+            {
+                linkFreeUtils::makeValid(&curr->metaData);
+                if (batch != nullptr)
+                    batch->flushInsert(curr);
+                else
+                    FLUSH_INSERT(curr);
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    LinkFreeSkipList()
+    {
+        this->head = newSentinel(Traits::min());
+        Node *last = newSentinel(Traits::max());
+        for (int i = 0; i < MAX_LEVEL; i++)
+        {
+            this->head->next[i].store(last);
+            last->next[i].store(nullptr);
+        }
+    }
+
+    bool insert(K k, T item, int tid)
+    {
+        Node *preds[MAX_LEVEL];
+        return insertFrom(k, item, preds, nullptr, nullptr);
+    }
+
+    bool remove(K k, int tid)
     {
         Node *succs[MAX_LEVEL];
 
@@ -263,49 +460,310 @@ public:
 
         Node *node = succs[0];
         linkFreeUtils::makeValid(&node->metaData);
-        bool result = markNode(node);
+        bool result = scans.write(k, [&]() { return markNode(node); });
         FLUSH_DELETE(node);
         if (result)
         {
             find(k, nullptr, nullptr);
-            ssmem_free(alloc, node);
+            freeNode(node);
             return true;
         }
         return false;
     }
 
-    bool contains(intptr_t k, int tid)
+    bool contains(K k, int tid)
+    {
+        return containsFrom(k, nullptr, nullptr);
+    }
+
+    // The batches run the operation of every key in key order, each search from the
+    // predecessors of the previous key, and wait for all their flushes at once at the end
+    // (see FlushBatch). Every operation is linearizable on its own, the batch is not atomic.
+    // They return how many of the operations succeeded
+
+    size_t insertBatch(std::vector<std::pair<K, T>> batch, int tid)
+    {
+        std::sort(batch.begin(), batch.end(),
+                  [](const std::pair<K, T> &a, const std::pair<K, T> &b) { return Traits::less(a.first, b.first); });
+        Batch flushes;
+        Node *preds[MAX_LEVEL];
+        std::fill(preds, preds + MAX_LEVEL, head);
+        size_t inserted = 0;
+        for (auto &item : batch)
+            inserted += insertFrom(item.first, item.second, preds, preds, &flushes);
+        flushes.wait();
+        flushes.release(freeNode);
+        return inserted;
+    }
+
+    // marks the nodes of the keys first, and unlinks them once their marks are persistent
+    size_t removeBatch(std::vector<K> keys, int tid)
+    {
+        std::sort(keys.begin(), keys.end(), [](const K &a, const K &b) { return Traits::less(a, b); });
+        Batch flushes;
+        Node *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+        std::fill(preds, preds + MAX_LEVEL, head);
+        for (K &k : keys)
+        {
+            if (!findNoCleanup(k, preds, succs, preds))
+                continue;
+            Node *node = succs[0];
+            linkFreeUtils::makeValid(&node->metaData);
+            if (scans.write(k, [&]() { return markNode(node); }))
+                flushes.retired.push_back(node);
+            flushes.flushDelete(node);
+        }
+        flushes.wait();
+        std::fill(preds, preds + MAX_LEVEL, head);
+        for (Node *node : flushes.retired)
+            find(node->key, preds, succs, preds);
+        size_t removed = flushes.retired.size();
+        flushes.release(freeNode);
+        return removed;
+    }
+
+    size_t containsBatch(std::vector<K> keys, int tid)
+    {
+        std::sort(keys.begin(), keys.end(), [](const K &a, const K &b) { return Traits::less(a, b); });
+        Batch flushes;
+        Node *preds[MAX_LEVEL];
+        std::fill(preds, preds + MAX_LEVEL, head);
+        size_t found = 0;
+        for (K &k : keys)
+            found += containsFrom(k, preds, &flushes);
+        flushes.wait();
+        return found;
+    }
+
+    bool get(K k, T &value, int tid)
     {
         Node *pred = this->head, *curr;
 
-        for (int i = MAX_LEVEL - 1; i >= 0; i--)
+        for (int i = height() - 1; i >= 0; i--)
         {
             curr = linkFreeUtils::getRef<Node>(pred->next[i].load());
-            while (curr->key < k || linkFreeUtils::isMarked(curr->next[i].load()))
+            while (Traits::less(curr->key, k) || linkFreeUtils::isMarked(curr->next[i].load()))
             {
                 if (!linkFreeUtils::isMarked(curr->next[i].load()))
                     pred = curr;
-                else if (i == 0 && curr->key == k)
-                {
-                    FLUSH_DELETE(curr);
-                    return false;
-                }
                 curr = linkFreeUtils::getRef<Node>(curr->next[i].load());
             }
 
-            // we found the right node
-            if (curr->key == k)
+            if (hasKey(curr, k))
             {
+                // the node is checked after the value is read, so it was in the list when it was read
+                T currValue = curr->value.load();
+                if (curr->isMarked())
+                {
+                    FLUSH_DELETE(curr);
+                    return false;
+                }
                 linkFreeUtils::makeValid(&curr->metaData);
                 FLUSH_INSERT(curr);
+                if (UNLIKELY(curr->valueWriters.load() != 0))
+                    BARRIER(curr, FLUSH_SITE_VALUE);
+                value = currValue;
                 return true;
             }
         }
         return false;
     }
 
+    // sets the value of k, inserting it if it is not in the list. Returns whether it inserted k
+    bool upsert(K k, T item, int tid)
+    {
+        // a removal or an insertion of k may come in between, until one of the two finds
+        // k in the state it needs
+        while (true)
+        {
+            if (update(k, item, [](std::atomic<T> &v, T stored, T &old) {
+                    old = v.exchange(stored);
+                    return true;
+                }))
+                return false;
+            if (insert(k, item, tid))
+                return true;
+        }
+    }
+
+    // sets the value of k to desired if it is expected
+    bool compareAndSwapValue(K k, T expected, T desired, int tid)
+    {
+        bool swapped = false;
+        update(k, desired, [&](std::atomic<T> &v, T stored, T &old) {
+            old = expected;
+            return swapped = v.compare_exchange_strong(old, stored);
+        });
+        return swapped;
+    }
+
+    // walks the keys of level 0 in order. Like a contains, every key it stops at was in the
+    // list at some point since the iterator was made, and is persistent by then. It never
+    // holds up the updates, and it is no snapshot: see scan for that
+    class Iterator
+    {
+    public:
+        bool valid() const
+        {
+            return curr != nullptr;
+        }
+
+        const K &key() const
+        {
+            return curr->key;
+        }
+
+        T value() const
+        {
+            return currValue;
+        }
+
+        void next()
+        {
+            settle(linkFreeUtils::getRef<Node>(curr->next[0].load()));
+        }
+
+    private:
+        friend class LinkFreeSkipList;
+
+        LinkFreeSkipList *list;
+        Node *curr;
+        T currValue;
+
+        Iterator(LinkFreeSkipList *list, Node *start) : list(list)
+        {
+            settle(start);
+        }
+
+        // moves to the first node from n on that is in the list, or past the end at the tail
+        void settle(Node *n)
+        {
+            for (;; n = linkFreeUtils::getRef<Node>(n->next[0].load()))
+            {
+                if (linkFreeUtils::getRef<Node>(n->next[0].load()) == nullptr)
+                {
+                    curr = nullptr;
+                    return;
+                }
+                // the node is checked after the value is read, as in get
+                T value = n->value.load();
+                if (n->isMarked())
+                {
+                    list->FLUSH_DELETE(n);
+                    continue;
+                }
+                linkFreeUtils::makeValid(&n->metaData);
+                list->FLUSH_INSERT(n);
+                if (UNLIKELY(n->valueWriters.load() != 0))
+                    BARRIER(n, FLUSH_SITE_VALUE);
+                curr = n;
+                currValue = value;
+                return;
+            }
+        }
+    };
+
+    // an iterator at the first key that is not smaller than from
+    Iterator iterate(K from, int tid)
+    {
+        Node *succs[MAX_LEVEL];
+        findSuccsNoCleanup(from, succs);
+        return Iterator(this, succs[0]);
+    }
+
+    // calls callback(key, value) for the keys from lo to hi in order, as they all were at one
+    // point during the scan, and returns how many there were. The scan collects the range
+    // again when an update of a key in it runs into it, and never holds up an update (see
+    // ScanUtils.h). The keys and the values are the ones of the nodes, as in get
+    template <class Callback>
+    size_t scan(K lo, K hi, Callback callback, int tid)
+    {
+        std::vector<std::pair<K, T>> entries;
+        scans.scan(lo, hi, [&]() {
+            entries.clear();
+            for (Iterator it = iterate(lo, tid); it.valid() && !Traits::less(hi, it.key()); it.next())
+                entries.emplace_back(it.key(), it.value());
+        });
+        for (auto &e : entries)
+            callback(e.first, e.second);
+        return entries.size();
+    }
+
+    // rebuilds every level of the skip list from the nodes in the chunks of the towers,
+    // using numThreads threads
+    RecoveryStats recover(int numThreads = 1)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::vector<recoveryUtils::SortEntry<Node, K, Traits>>> valid(numThreads);
+        RecoveryStats stats = {0, 0, 0};
+
+        auto chunks = towerUtils::adoptChunks();
+        // the garbage nodes with the size of their slots, since their heights may be anything
+        std::vector<std::vector<std::pair<Node *, size_t>>> garbage(numThreads);
+
+        recoveryUtils::parallelRun(numThreads, [&](int tid) {
+            recoveryUtils::forEachSizedSlot(chunks, tid, numThreads, [&](void *slot, size_t size) {
+                Node *currNode = static_cast<Node *>(slot);
+                // the node was never initialized, no need to free it or add it
+                if (currNode->next[0].load() == nullptr && linkFreeUtils::isValid(currNode->metaData.load()))
+                    return;
+                if (!linkFreeUtils::isValid(currNode->metaData.load()) || currNode->isMarked() ||
+                    currNode->topLevel == 0 || currNode->topLevel > MAX_LEVEL ||
+                    ssmem_class_size(nodeSize(currNode->topLevel)) != size)
+                {
+                    currNode->next[0].store(linkFreeUtils::mark<Node>(nullptr));
+                    linkFreeUtils::makeValid(&currNode->metaData);
+                    garbage[tid].push_back({currNode, size});
+                }
+                else
+                {
+                    // the updates in flight were lost with the crash
+                    currNode->valueWriters.store(0, std::memory_order_relaxed);
+                    valid[tid].push_back({currNode->key, currNode});
+                }
+            });
+        });
+
+        // the allocator is thread-local, so only this thread can free into it
+        for (int tid = 0; tid < numThreads; tid++)
+        {
+            for (auto &g : garbage[tid])
+                towerUtils::freeTower(true, g.first, g.second);
+            stats.reclaimed += garbage[tid].size();
+        }
+
+        auto nodes = recoveryUtils::gather(valid, numThreads);
+        recoveryUtils::parallelSort(nodes, numThreads);
+        Node *last = head->next[0].load();
+        recoveryUtils::linkLevels(nodes.data(), nodes.size(), head, last, numThreads,
+                                  [](Node *pred, int level, Node *succ) {
+                                      pred->next[level].store(succ, std::memory_order_relaxed);
+                                  });
+        int h = 1;
+        for (auto &e : nodes)
+            h = std::max<int>(h, e.node->topLevel);
+        maxLevel.store(h);
+        stats.recovered = nodes.size();
+
+        // and what the keys and the values of the nodes that are not in the list refer to
+        auto inList = [](Node *n) { return linkFreeUtils::isValid(n->metaData.load()) && !n->isMarked(); };
+        Traits::recover(numThreads, [&](void *owner, K &key) {
+            key = static_cast<Node *>(owner)->key;
+            return inList(static_cast<Node *>(owner));
+        });
+        ValueTraits<T>::recover(numThreads, [&](void *owner, T &value) {
+            value = static_cast<Node *>(owner)->value.load();
+            return inList(static_cast<Node *>(owner));
+        });
+        stats.seconds = recoveryUtils::secondsSince(start);
+        return stats;
+    }
+
 private:
     Node *head;
+    // the height of the highest tower so far, 1 at least, which never goes down
+    std::atomic<int> maxLevel{1};
+    scanUtils::RangeScans<K, Traits> scans;
 };
 
 #endif
@@ -0,0 +1,139 @@
+#ifndef LINK_FREE_SPLIT_HASH_TABLE_H_
+#define LINK_FREE_SPLIT_HASH_TABLE_H_
+
+#include "utilities.h"
+#include "LinkFreeList.h"
+#include "SplitOrderUtils.h"
+
+// A hash table that grows and shrinks with its keys: the Link-Free list in split order
+// (see SplitOrderUtils.h). The nodes of the keys are the persistent Link-Free nodes and
+// the dummies of the buckets are volatile, so resizing never writes to the NVRAM
+template <class T, class K = intptr_t, class Traits = KeyTraits<K>>
+class LinkFreeSplitHashTable
+{
+    static_assert(Traits::uniqueHash, "split ordering tells the keys apart by their hash");
+
+  public:
+    typedef LinkFreeList<T, splitOrderUtils::OrderKey> List;
+    typedef typename List::Node Node;
+
+    LinkFreeSplitHashTable(uint64_t initialBuckets = 2) : directory(initialBuckets)
+    {
+        tail = new Node(splitOrderUtils::OrderTraits::max(), T(), nullptr);
+        directory.set(0, new Node(splitOrderUtils::dummyKey(0), T(), tail));
+    }
+
+    bool insert(K k, T item, int tid)
+    {
+        bool result = List::insertFrom(getBucket(k), orderKey(k), item);
+        if (result)
+            directory.count(tid, 1);
+        return result;
+    }
+
+    bool remove(K k, int tid)
+    {
+        bool result = List::removeFrom(getBucket(k), orderKey(k));
+        if (result)
+            directory.count(tid, -1);
+        return result;
+    }
+
+    bool contains(K k, int tid)
+    {
+        return List::containsFrom(getBucket(k), orderKey(k));
+    }
+
+    bool get(K k, T &value, int tid)
+    {
+        return List::getFrom(getBucket(k), orderKey(k), value);
+    }
+
+    bool upsert(K k, T item, int tid)
+    {
+        bool result = List::upsertFrom(getBucket(k), orderKey(k), item);
+        if (result)
+            directory.count(tid, 1);
+        return result;
+    }
+
+    bool compareAndSwapValue(K k, T expected, T desired, int tid)
+    {
+        return List::compareAndSwapValueFrom(getBucket(k), orderKey(k), expected, desired);
+    }
+
+    std::string myName()
+    {
+        return "Link Free Split Hash Table";
+    }
+
+    uint64_t buckets()
+    {
+        return directory.buckets();
+    }
+
+    // rebuilds the list from the nodes in the chunks of alloc, with as many buckets as
+    // the recovered keys need: the nodes are sorted in split order and linked together
+    // with a new dummy for every bucket, in parallel
+    RecoveryStats recover(int numThreads = 1)
+    {
+        typedef typename List::Entry Entry;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::vector<Entry>> valid(numThreads);
+        RecoveryStats stats = {0, List::collect(numThreads, valid), 0};
+
+        auto nodes = recoveryUtils::gather(valid, numThreads);
+        recoveryUtils::parallelSort(nodes, numThreads);
+        uint64_t size = splitOrderUtils::recoveredSize(nodes.size(), directory.buckets());
+
+        // the dummies of all the buckets but 0, which the constructor made
+        Node *dummies = static_cast<Node *>(aligned_alloc(alignof(Node), size * sizeof(Node)));
+        assert(dummies != nullptr);
+        recoveryUtils::parallelRun(numThreads, [&](int tid) {
+            uint64_t begin, end;
+            recoveryUtils::split(size, tid, numThreads, &begin, &end);
+            for (uint64_t b = std::max(begin, (uint64_t)1); b < end; b++)
+                directory.set(b, new (&dummies[b]) Node(splitOrderUtils::dummyKey(b), T(), nullptr));
+        });
+        splitOrderUtils::linkSplitOrdered(
+            nodes.data(), nodes.size(), size, tail, numThreads, [&](uint64_t i) { return nodes[i].node; },
+            [&](uint64_t b) { return directory.get(b); },
+            [](Node *pred, Node *succ) { pred->next.store(succ, std::memory_order_relaxed); });
+        directory.reset(nodes.size(), size);
+
+        stats.recovered = nodes.size();
+        stats.seconds = recoveryUtils::secondsSince(start);
+        return stats;
+    }
+
+  private:
+    // the dummy of the bucket of k, which is linked after the dummy of its parent
+    // bucket if this is the first time the bucket is used
+    Node *getBucket(K k)
+    {
+        return getDummy(directory.bucketOf(Traits::hash(k)));
+    }
+
+    static splitOrderUtils::OrderKey orderKey(K k)
+    {
+        return splitOrderUtils::regularKey(Traits::hash(k));
+    }
+
+    Node *getDummy(uint64_t bucket)
+    {
+        Node *dummy = directory.get(bucket);
+        if (LIKELY(dummy != nullptr))
+            return dummy;
+        Node *parent = getDummy(splitOrderUtils::parentOf(bucket));
+        Node *newDummy = new Node(splitOrderUtils::dummyKey(bucket), T(), nullptr);
+        dummy = List::linkFrom(parent, newDummy);
+        if (dummy != newDummy)
+            delete newDummy;
+        return directory.set(bucket, dummy);
+    }
+
+    splitOrderUtils::Buckets<Node> directory;
+    Node *tail;
+};
+
+#endif
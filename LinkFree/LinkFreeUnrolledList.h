@@ -0,0 +1,1014 @@
+#ifndef LINK_FREE_UNROLLED_LIST_H_
+#define LINK_FREE_UNROLLED_LIST_H_
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <type_traits>
+#include <immintrin.h>
+#include "utilities.h"
+#include "ssmem.h"
+#include "RecoveryUtils.h"
+#include "KeyTraits.h"
+#include "ValueTraits.h"
+#include <stdint.h>
+
+// A link-free list with several keys in a node. The keys of a node are in its first line,
+// unsorted, and a lookup compares them all with a few SIMD compares; the states of the slots
+// are one word next to them, so an update of the node is one CAS of that word and one flush
+// of the line. The values are in the second line, and a slot is only valid if the tag of its
+// value matches the validity bit of the node (flipV1), so the two lines need no fence between
+// them. A slot is used once: an update writes the key with its new value to a free slot and
+// swaps the two slots in one CAS, and a full node is rebuilt. The rebuild freezes the node,
+// copies its keys to one or two new nodes (a split) and replaces it by them with a CAS on
+// its next pointer; a node left with few keys is rebuilt together with the next one (a
+// merge). Every thread that finds a frozen node runs its rebuild, so none waits for another
+template <class T, class K = intptr_t, class Traits = KeyTraits<K>>
+class LinkFreeUnrolledList
+{
+    static_assert(std::is_integral<K>::value && sizeof(K) == sizeof(int64_t), "the nodes compare 64-bit integer keys");
+    static_assert(sizeof(T) <= sizeof(int64_t) && !ValueTraits<T>::outOfLine, "the values are kept in the node");
+
+public:
+    static const int SLOTS = 6;
+
+    class Node
+    {
+    public:
+        // the first line. keys[0] is the smallest key that the node takes, the keys below it
+        // go to the nodes before it
+        K keys[SLOTS];
+        std::atomic<uint64_t> states;
+        std::atomic<Node *> next;
+        // the second line. A value is written once, before its slot is published
+        T values[SLOTS];
+        std::atomic<uchar> tags[SLOTS];
+        std::atomic<uchar> metaData;
+        // the node that the rebuild which allocated this node replaces, until the replacement
+        // is persistent. In a node frozen to merge, the node that it merges with
+        std::atomic<Node *> source;
+
+        Node() : states(0), next(nullptr), metaData(0), source(nullptr) {}
+    } __attribute__((aligned((64))));
+
+private:
+    static_assert(sizeof(Node) == 2 * 64, "a node is two lines");
+
+    // the state of a slot, a byte of states: its status, and whether its insertion and its
+    // removal are known to be persistent. A slot is claimed by one thread, which writes its
+    // key and value before it publishes it
+    enum : uchar
+    {
+        FREE = 0,
+        CLAIMED = 1,
+        INSERTED = 2,
+        DELETED = 3,
+        DEAD = 4,
+        STATUS = 0x7,
+        INSERT_FLAG = 0x10,
+        DELETE_FLAG = 0x20
+    };
+
+    // the byte of states after the slots is the tag of the first line, the last one has the
+    // flags of the node
+    static const int TAG_BYTE = SLOTS;
+    static const int FLAGS_BYTE = 7;
+
+    enum : uchar
+    {
+        FROZEN = 0x1,   // the slots do not change anymore
+        MERGE = 0x2,    // frozen to be rebuilt with the next node
+        VICTIM = 0x4,   // frozen to be rebuilt with the node before it
+        PAIR = 0x8,     // the first of the two nodes of a split
+        COMMITTED = 0x10 // replaced, and the replacement is persistent
+    };
+
+    // the bits of next: the node is replaced by the node it points to, and no node is linked
+    // or unlinked after it anymore
+    static const uintptr_t MARK_BIT = 1;
+    static const uintptr_t FROZEN_BIT = 2;
+
+    static uchar stateOf(uint64_t states, int i)
+    {
+        return (uchar)(states >> (8 * i));
+    }
+
+    static uint64_t withState(uint64_t states, int i, uchar state)
+    {
+        return (states & ~(0xffULL << (8 * i))) | ((uint64_t)state << (8 * i));
+    }
+
+    static uchar flagsOf(uint64_t states)
+    {
+        return stateOf(states, FLAGS_BYTE);
+    }
+
+    static uint64_t flagBits(uchar flags)
+    {
+        return (uint64_t)flags << (8 * FLAGS_BYTE);
+    }
+
+    // the slots of states in status, a bit per slot
+    static unsigned slotsIn(uint64_t states, uchar status)
+    {
+        unsigned slots = 0;
+        for (int i = 0; i < SLOTS; i++)
+        {
+            if ((stateOf(states, i) & STATUS) == status)
+                slots |= 1u << i;
+        }
+        return slots;
+    }
+
+    static unsigned slotsWith(uint64_t states, uchar flag)
+    {
+        unsigned slots = 0;
+        for (int i = 0; i < SLOTS; i++)
+        {
+            if (stateOf(states, i) & flag)
+                slots |= 1u << i;
+        }
+        return slots;
+    }
+
+    static uint64_t flagSlots(unsigned slots, uchar flag)
+    {
+        uint64_t bits = 0;
+        for (int i = 0; i < SLOTS; i++)
+        {
+            if (slots & (1u << i))
+                bits |= (uint64_t)flag << (8 * i);
+        }
+        return bits;
+    }
+
+    // the slots of n whose key is key, a bit per slot: the keys are compared two at a time,
+    // or four at a time with AVX2
+    static unsigned matchKeys(const Node *n, K key)
+    {
+        const long long *keys = reinterpret_cast<const long long *>(n->keys);
+#ifdef __AVX2__
+        static_assert(SLOTS == 6, "the keys are compared four and two at a time");
+        __m256i k = _mm256_set1_epi64x((long long)key);
+        __m256i low = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)keys), k);
+        __m128i high = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i *)(keys + 4)), _mm256_castsi256_si128(k));
+        return (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(low)) |
+               (unsigned)_mm_movemask_pd(_mm_castsi128_pd(high)) << 4;
+#else
+        __m128i k = _mm_set1_epi64x((long long)key);
+        unsigned slots = 0;
+        for (int i = 0; i < SLOTS; i += 2)
+        {
+            // SSE2 compares 32 bits at a time, a key is equal if both of its halves are
+            __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(keys + i)), k);
+            eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+            slots |= (unsigned)_mm_movemask_pd(_mm_castsi128_pd(eq)) << i;
+        }
+        return slots;
+#endif
+    }
+
+    // the inserted slot of key in states, -1 if there is none. states is read before the keys,
+    // so the keys of its inserted slots are final
+    static int slotOf(const Node *n, uint64_t states, K key)
+    {
+        unsigned slots = matchKeys(n, key) & slotsIn(states, INSERTED);
+        return slots != 0 ? __builtin_ctz(slots) : -1;
+    }
+
+    static Node *ref(Node *ptr)
+    {
+        return (Node *)((uintptr_t)ptr & ~(MARK_BIT | FROZEN_BIT));
+    }
+
+    static bool isMarked(Node *ptr)
+    {
+        return (uintptr_t)ptr & MARK_BIT;
+    }
+
+    static bool isFrozen(Node *ptr)
+    {
+        return (uintptr_t)ptr & FROZEN_BIT;
+    }
+
+    static Node *withBits(Node *ptr, uintptr_t bits)
+    {
+        return (Node *)((uintptr_t)ptr | bits);
+    }
+
+
+    // the validity bit of the node, which tags its first line and the values of its slots
+    static uchar tagOf(Node *n)
+    {
+        return (n->metaData.load() & HIGH_CHAR_MASK) >> 7;
+    }
+
+    // a node with the count items, all in status, allocated by the rebuild of source
+    static Node *allocNode(const std::pair<K, T> *items, int count, uchar status, Node *next, Node *source,
+                           uchar flags = 0)
+    {
+        Node *n = static_cast<Node *>(ssmem_alloc(alloc, sizeof(Node)));
+        linkFreeUtils::flipV1(&n->metaData);
+        std::atomic_thread_fence(std::memory_order_release);
+        uchar tag = tagOf(n);
+        uint64_t states = flagBits(flags) | (uint64_t)tag << (8 * TAG_BYTE);
+        for (int i = 0; i < SLOTS; i++)
+        {
+            if (i < count)
+            {
+                n->keys[i] = items[i].first;
+                n->values[i] = items[i].second;
+                states = withState(states, i, status);
+            }
+            n->tags[i].store(i < count ? tag : tag ^ 1, std::memory_order_relaxed);
+        }
+        n->source.store(source, std::memory_order_relaxed);
+        n->next.store(next, std::memory_order_relaxed);
+        n->states.store(states, std::memory_order_release);
+        linkFreeUtils::makeValid(&n->metaData);
+        return n;
+    }
+
+    static std::vector<Node *> &retired()
+    {
+        static thread_local std::vector<Node *> nodes;
+        return nodes;
+    }
+
+    // the nodes that were unlinked or never published are freed at the end of the operation,
+    // so none of the nodes it holds is reused while it runs
+    static void retire(Node *n)
+    {
+        retired().push_back(n);
+    }
+
+    static void releaseRetired()
+    {
+        for (Node *n : retired())
+            ssmem_free(alloc, n);
+        retired().clear();
+    }
+
+    // the flags let other threads skip the flushes, so they are set only after the lines
+    // are persistent
+    static void flushInsert(Node *n, uint64_t states, int slot)
+    {
+        if (LIKELY(stateOf(states, slot) & INSERT_FLAG))
+        {
+            flush_elided(FLUSH_SITE_LINK_FREE_INSERT);
+            return;
+        }
+        FLUSH(n, FLUSH_SITE_LINK_FREE_INSERT);
+        FLUSH(n->values, FLUSH_SITE_LINK_FREE_INSERT);
+        SFENCE();
+        n->states.fetch_or((uint64_t)INSERT_FLAG << (8 * slot));
+    }
+
+    // the removals of key in n that are not known to be persistent
+    static void flushDelete(Node *n, uint64_t states, K key)
+    {
+        unsigned removed = matchKeys(n, key) & slotsIn(states, DELETED);
+        if (LIKELY((removed & ~slotsWith(states, DELETE_FLAG)) == 0))
+        {
+            if (removed != 0)
+                flush_elided(FLUSH_SITE_LINK_FREE_DELETE);
+            return;
+        }
+        BARRIER(n, FLUSH_SITE_LINK_FREE_DELETE);
+        n->states.fetch_or(flagSlots(removed, DELETE_FLAG));
+    }
+
+    // the replacement of n is persistent once the mark of n is, and no thread relies on it before
+    static void persistCommit(Node *n)
+    {
+        if (LIKELY(flagsOf(n->states.load()) & COMMITTED))
+        {
+            flush_elided(FLUSH_SITE_LINK_FREE_REBUILD);
+            return;
+        }
+        BARRIER(n, FLUSH_SITE_LINK_FREE_REBUILD);
+        n->states.fetch_or(flagBits(COMMITTED));
+    }
+
+    // completes the replacement of x, whose next pointer is marked: once it is persistent, the
+    // victim of a merge is dead on its own and the new nodes forget x, the second of a split
+    // first, so that x can be freed and the new nodes can be rebuilt in turn
+    static void finish(Node *x)
+    {
+        persistCommit(x);
+        Node *victim = (flagsOf(x->states.load()) & MERGE) ? x->source.load() : nullptr;
+        if (victim != nullptr)
+        {
+            uint64_t states = victim->states.load();
+            while ((flagsOf(states) & VICTIM) &&
+                   !victim->states.compare_exchange_weak(states, states & ~flagBits(VICTIM)))
+                ;
+            BARRIER(victim, FLUSH_SITE_LINK_FREE_REBUILD);
+        }
+        Node *first = ref(x->next.load());
+        if (first->source.load() != x)
+            return;
+        Node *expected = x;
+        if (flagsOf(first->states.load()) & PAIR)
+        {
+            Node *second = ref(first->next.load());
+            second->source.compare_exchange_strong(expected, nullptr);
+            BARRIER(&second->source, FLUSH_SITE_LINK_FREE_REBUILD);
+            expected = x;
+        }
+        first->source.compare_exchange_strong(expected, nullptr);
+        BARRIER(&first->source, FLUSH_SITE_LINK_FREE_REBUILD);
+    }
+
+    // unlinks x, a replaced node, from pred
+    static void trim(Node *pred, Node *x)
+    {
+        finish(x);
+        Node *expected = x;
+        if (pred->next.compare_exchange_strong(expected, ref(x->next.load())))
+        {
+            Node *victim = (flagsOf(x->states.load()) & MERGE) ? x->source.load() : nullptr;
+            retire(x);
+            if (victim != nullptr)
+                retire(victim);
+        }
+    }
+
+    // a node is frozen only once the rebuild that allocated it is done with it
+    static void freeze(Node *n, uchar flags)
+    {
+        uint64_t states = n->states.load();
+        while (!(flagsOf(states) & FROZEN))
+        {
+            Node *source = n->source.load();
+            if (source != nullptr)
+                finish(source);
+            if (n->states.compare_exchange_weak(states, states | flagBits(FROZEN | flags)))
+                break;
+        }
+    }
+
+    // sets the frozen bit of the next pointer of n, a frozen node, and returns the pointer
+    static Node *freezeNext(Node *n)
+    {
+        Node *next = n->next.load();
+        while (!isMarked(next) && !isFrozen(next))
+        {
+            if (n->next.compare_exchange_weak(next, withBits(next, FROZEN_BIT)))
+                return withBits(next, FROZEN_BIT);
+        }
+        return next;
+    }
+
+    // freezes y, the node after x, as the victim of the merge of x unless it is frozen already.
+    // Returns y if x merges with it, nullptr if not
+    static Node *absorb(Node *x, Node *y)
+    {
+        if (y->next.load() == nullptr)
+            return nullptr;
+        // the flag tells what the source of x is, so it is persistent before the source is set
+        BARRIER(x, FLUSH_SITE_LINK_FREE_REBUILD);
+        freeze(y, VICTIM);
+        if (!(flagsOf(y->states.load()) & VICTIM))
+            return nullptr;
+        freezeNext(y);
+        x->source.store(y);
+        return y;
+    }
+
+    // copies the inserted slots of n, a frozen node, to items from count on
+    static int gather(Node *n, std::pair<K, T> *items, int count)
+    {
+        uint64_t states = n->states.load();
+        for (int i = 0; i < SLOTS; i++)
+        {
+            if ((stateOf(states, i) & STATUS) == INSERTED)
+                items[count++] = {n->keys[i], n->values[i]};
+        }
+        return count;
+    }
+
+    // the persistent nodes of the keys of x, and of victim if it is not nullptr, followed by
+    // succ. Returns the first of them, or succ if there are no keys
+    static Node *build(Node *x, Node *victim, Node *succ, Node **nodes, int *numNodes)
+    {
+        std::pair<K, T> items[2 * SLOTS];
+        int count = gather(x, items, 0);
+        if (victim != nullptr)
+            count = gather(victim, items, count);
+        // an insertion sort, as std::sort does for so few items
+        for (int i = 1; i < count; i++)
+        {
+            std::pair<K, T> item = items[i];
+            int j = i;
+            for (; j > 0 && Traits::less(item.first, items[j - 1].first); j--)
+                items[j] = items[j - 1];
+            items[j] = item;
+        }
+        // a node keeps two free slots, or it would be rebuilt on its next insertion
+        *numNodes = count == 0 ? 0 : count <= SLOTS - 2 ? 1 : 2;
+        if (*numNodes == 1)
+        {
+            nodes[0] = allocNode(items, count, INSERTED | INSERT_FLAG, succ, x);
+        }
+        else if (*numNodes == 2)
+        {
+            int half = count / 2;
+            nodes[1] = allocNode(items + half, count - half, INSERTED | INSERT_FLAG, succ, x);
+            nodes[0] = allocNode(items, half, INSERTED | INSERT_FLAG, nodes[1], x, PAIR);
+        }
+        for (int i = 0; i < *numNodes; i++)
+        {
+            FLUSH(nodes[i], FLUSH_SITE_LINK_FREE_REBUILD);
+            FLUSH(nodes[i]->values, FLUSH_SITE_LINK_FREE_REBUILD);
+        }
+        if (*numNodes > 0)
+            SFENCE();
+        return *numNodes > 0 ? nodes[0] : succ;
+    }
+
+    // Replaces x, a frozen node, by the nodes of its keys: none if it has none, one, or two
+    // if one would be too full. A node frozen to merge takes the keys of the node after it,
+    // its victim, too, and the victim is marked with the replacement first, so the helpers
+    // agree on it. The first CAS on the next pointer of x commits the replacement, and x is
+    // then unlinked from pred unless it is nullptr
+    static void rebuild(Node *pred, Node *x)
+    {
+        Node *next = freezeNext(x);
+        if (!isMarked(next))
+        {
+            Node *victim = (flagsOf(x->states.load()) & MERGE) ? absorb(x, ref(next)) : nullptr;
+            Node *nodes[2];
+            int numNodes = 0;
+            Node *replacement;
+            if (victim != nullptr)
+            {
+                Node *victimNext = victim->next.load();
+                if (!isMarked(victimNext))
+                {
+                    replacement = build(x, victim, ref(victimNext), nodes, &numNodes);
+                    victim->next.compare_exchange_strong(victimNext, withBits(replacement, MARK_BIT));
+                }
+                // the victim is persistent before x, so that it is never alive next to the
+                // replacement after a crash
+                BARRIER(victim, FLUSH_SITE_LINK_FREE_REBUILD);
+                replacement = ref(victim->next.load());
+            }
+            else
+            {
+                replacement = build(x, nullptr, ref(next), nodes, &numNodes);
+            }
+            bool won = x->next.compare_exchange_strong(next, withBits(replacement, MARK_BIT));
+            if (numNodes > 0 && (replacement != nodes[0] || (victim == nullptr && !won)))
+            {
+                for (int i = 0; i < numNodes; i++)
+                    retire(nodes[i]);
+            }
+        }
+        if (pred != nullptr)
+            trim(pred, x);
+        else
+            finish(x);
+    }
+
+    // helps the rebuild of target, a frozen node that follows pred. The victim of a merge is
+    // rebuilt with the node that froze it
+    static void help(Node *pred, Node *target)
+    {
+        if (flagsOf(target->states.load()) & VICTIM)
+        {
+            if (pred != nullptr && ref(pred->next.load()) == target && (flagsOf(pred->states.load()) & FROZEN))
+                rebuild(nullptr, pred);
+            return;
+        }
+        rebuild(pred, target);
+    }
+
+    // a marked victim points to the node of the merge before the merge is committed, so the
+    // traversals help the commit instead of passing it. Returns whether curr was a victim,
+    // and then the traversal starts over
+    static bool passVictim(Node *prev, Node *curr)
+    {
+        if (!(flagsOf(curr->states.load()) & VICTIM))
+            return false;
+        help(prev, curr);
+        return true;
+    }
+
+    // marks slot, a slot that was claimed and not published, as never to be used
+    static void abandon(Node *n, int slot)
+    {
+        uint64_t states = n->states.load();
+        while (!(flagsOf(states) & FROZEN) &&
+               !n->states.compare_exchange_weak(states, withState(states, slot, DEAD)))
+            ;
+    }
+
+    // claims a free slot of n and writes key and value to it. Returns the slot, or -1 if n
+    // is frozen or full, and then it is rebuilt
+    static int claim(Node *pred, Node *n, K key, T value)
+    {
+        uint64_t states = n->states.load();
+        while (true)
+        {
+            unsigned free = slotsIn(states, FREE);
+            if ((flagsOf(states) & FROZEN) || free == 0)
+            {
+                freeze(n, 0);
+                help(pred, n);
+                return -1;
+            }
+            int slot = __builtin_ctz(free);
+            if (n->states.compare_exchange_weak(states, withState(states, slot, CLAIMED)))
+            {
+                n->keys[slot] = key;
+                n->values[slot] = value;
+                n->tags[slot].store(tagOf(n), std::memory_order_release);
+                return slot;
+            }
+        }
+    }
+
+    // publishes slot of n, a claimed slot of key. The inserted slot of key is replaced by it
+    // if replace, and otherwise its insertion fails. Returns the previous state of the inserted
+    // slot of key, FREE if there was none, or DEAD if n is frozen
+    static uchar publish(Node *n, int slot, K key, bool replace)
+    {
+        uint64_t states = n->states.load();
+        bool persisted = false;
+        int old;
+        while (true)
+        {
+            if (flagsOf(states) & FROZEN)
+                return DEAD;
+            old = slotOf(n, states, key);
+            if (old >= 0 && !replace)
+            {
+                abandon(n, slot);
+                flushInsert(n, states, old);
+                return stateOf(states, old);
+            }
+            // the new value is persistent before it replaces the old one, which it deletes
+            // in the first line
+            if (old >= 0 && !persisted)
+            {
+                BARRIER(n->values, FLUSH_SITE_VALUE);
+                persisted = true;
+            }
+            uint64_t desired = withState(states, slot, INSERTED);
+            if (old >= 0)
+                desired = withState(desired, old, (stateOf(states, old) & ~STATUS) | DELETED);
+            if (n->states.compare_exchange_weak(states, desired))
+                break;
+        }
+        FLUSH(n, FLUSH_SITE_LINK_FREE_INSERT);
+        if (!persisted)
+            FLUSH(n->values, FLUSH_SITE_LINK_FREE_INSERT);
+        SFENCE();
+        n->states.fetch_or((uint64_t)INSERT_FLAG << (8 * slot) |
+                           (old >= 0 ? (uint64_t)DELETE_FLAG << (8 * old) : 0));
+        return old >= 0 ? stateOf(states, old) : FREE;
+    }
+
+    // links a node with key and value before first, the first node of the list, for a key
+    // that is below the keys of the nodes. Returns whether it inserted key
+    bool insertFirst(Node *first, K key, T value)
+    {
+        std::pair<K, T> item(key, value);
+        Node *n = allocNode(&item, 1, CLAIMED, first, nullptr);
+        Node *expected = first;
+        if (!head->next.compare_exchange_strong(expected, n))
+        {
+            n->next.store(withBits(nullptr, MARK_BIT), std::memory_order_relaxed);
+            retire(n);
+            return false;
+        }
+        return publish(n, 0, key, false) == FREE;
+    }
+
+    // the node whose range has key: the last node whose first key is not above it, or the
+    // head for the keys below the first node. Puts it in targetPtr and the node before it in
+    // predPtr, and returns the node after it. Trims the replaced nodes on the way
+    Node *find(K key, Node **predPtr, Node **targetPtr)
+    {
+        Node *pred = nullptr, *prev = head, *curr = ref(head->next.load());
+        while (true)
+        {
+            Node *next = curr->next.load();
+            if (next == nullptr)
+                break;
+            if (isMarked(next) && passVictim(prev, curr))
+            {
+                pred = nullptr;
+                prev = head;
+                curr = ref(head->next.load());
+                continue;
+            }
+            if (isMarked(next))
+            {
+                trim(prev, curr);
+                curr = ref(next);
+                continue;
+            }
+            if (Traits::less(key, curr->keys[0]))
+                break;
+            pred = prev;
+            prev = curr;
+            curr = ref(next);
+        }
+        *predPtr = pred;
+        *targetPtr = prev;
+        return curr;
+    }
+
+    // the node whose range has key, like find but without trimming: a replaced node is passed
+    // once its replacement is persistent
+    Node *locate(K key)
+    {
+        Node *prev = head, *curr = ref(head->next.load());
+        while (true)
+        {
+            Node *next = curr->next.load();
+            if (next == nullptr)
+                break;
+            if (isMarked(next) && passVictim(prev, curr))
+            {
+                prev = head;
+                curr = ref(head->next.load());
+                continue;
+            }
+            if (isMarked(next))
+            {
+                persistCommit(curr);
+                curr = ref(next);
+                continue;
+            }
+            if (Traits::less(key, curr->keys[0]))
+                break;
+            prev = curr;
+            curr = ref(next);
+        }
+        return prev;
+    }
+
+    // inserts key, or replaces its value if replace. Returns whether it inserted key
+    bool put(K key, T value, bool replace)
+    {
+        while (true)
+        {
+            Node *pred, *target;
+            Node *first = find(key, &pred, &target);
+            if (target == head)
+            {
+                if (insertFirst(first, key, value))
+                    return true;
+                continue;
+            }
+            uint64_t states = target->states.load();
+            int slot = slotOf(target, states, key);
+            if (slot >= 0 && !replace)
+            {
+                flushInsert(target, states, slot);
+                return false;
+            }
+            slot = claim(pred, target, key, value);
+            if (slot < 0)
+                continue;
+            uchar old = publish(target, slot, key, replace);
+            if (old != DEAD)
+                return old == FREE;
+        }
+    }
+
+    // a node left with at most one key after a removal is rebuilt: it goes away if it has none,
+    // and otherwise it merges with the next node if their keys fit in one node
+    static void shrink(Node *pred, Node *n, uint64_t states)
+    {
+        int live = __builtin_popcount(slotsIn(states, INSERTED));
+        Node *next = n->next.load();
+        if (live > 1 || isMarked(next) || isFrozen(next))
+            return;
+        if (live == 1)
+        {
+            Node *succ = ref(next);
+            if (succ->next.load() == nullptr ||
+                live + __builtin_popcount(slotsIn(succ->states.load(), INSERTED)) > SLOTS - 2)
+                return;
+        }
+        freeze(n, live == 0 ? 0 : MERGE);
+        help(pred, n);
+    }
+
+    // The recovery. A node is alive if it is valid, the rebuild that allocated it was committed
+    // and it was not replaced, and its keys are the inserted slots whose value has its tag
+
+    typedef std::vector<std::pair<uintptr_t, uintptr_t>> Ranges;
+
+    // whether p is a node of the chunks, and not a sentinel of the run that crashed
+    static bool inPool(const Ranges &chunks, Node *p)
+    {
+        auto it = std::upper_bound(chunks.begin(), chunks.end(), std::make_pair((uintptr_t)p, UINTPTR_MAX));
+        if (it == chunks.begin())
+            return false;
+        --it;
+        return (uintptr_t)p < it->second && ((uintptr_t)p - it->first) % sizeof(Node) == 0;
+    }
+
+    static bool isValidNode(Node *n)
+    {
+        return n->next.load() != nullptr && linkFreeUtils::isValid(n->metaData.load()) &&
+               stateOf(n->states.load(), TAG_BYTE) == tagOf(n);
+    }
+
+    static Node *creatorOf(Node *n)
+    {
+        return (flagsOf(n->states.load()) & MERGE) ? nullptr : n->source.load();
+    }
+
+    // the second node of a split is committed with the first one, which keeps its source
+    // until the second one forgot it
+    static bool isCommitted(const Ranges &chunks, Node *n)
+    {
+        Node *creator = creatorOf(n);
+        if (creator == nullptr)
+            return true;
+        if (!inPool(chunks, creator) || !isValidNode(creator) || !isMarked(creator->next.load()))
+            return false;
+        Node *first = ref(creator->next.load());
+        if (first == n)
+            return true;
+        return inPool(chunks, first) && isValidNode(first) && creatorOf(first) == creator &&
+               ref(first->next.load()) == n;
+    }
+
+    static bool isAlive(const Ranges &chunks, Node *n)
+    {
+        if (!isValidNode(n) || !isCommitted(chunks, n))
+            return false;
+        Node *next = n->next.load();
+        if (!isMarked(next))
+            return true;
+        if (!(flagsOf(n->states.load()) & VICTIM))
+            return false;
+        // a victim dies with the commit of the merge
+        Node *replacement = ref(next);
+        return inPool(chunks, replacement) && !(isValidNode(replacement) && isCommitted(chunks, replacement));
+    }
+
+    static unsigned keysOf(Node *n)
+    {
+        uint64_t states = n->states.load();
+        unsigned slots = 0;
+        for (int i = 0; i < SLOTS; i++)
+        {
+            if ((stateOf(states, i) & STATUS) == INSERTED && n->tags[i].load() == tagOf(n))
+                slots |= 1u << i;
+        }
+        return slots;
+    }
+
+    // rewrites the first line of n, an alive node, with only its keys. The source goes first
+    // and the next pointer before the flags, so that n stays alive if the recovery crashes
+    static void normalize(Node *n, unsigned slots)
+    {
+        uint64_t states = (uint64_t)tagOf(n) << (8 * TAG_BYTE);
+        for (int i = 0; i < SLOTS; i++)
+            states = withState(states, i, (slots & (1u << i)) ? INSERTED | INSERT_FLAG : DEAD);
+        if (n->source.load() != nullptr)
+        {
+            n->source.store(nullptr);
+            BARRIER(&n->source);
+        }
+        n->next.store(ref(n->next.load()));
+        n->states.store(states);
+        FLUSH(n);
+    }
+
+public:
+    LinkFreeUnrolledList()
+    {
+        tail = new Node();
+        tail->keys[0] = Traits::max();
+        head = new Node();
+        head->keys[0] = Traits::min();
+        uint64_t states = 0;
+        for (int i = 0; i < SLOTS; i++)
+            states = withState(states, i, DEAD);
+        head->states.store(states);
+        head->next.store(tail);
+    }
+
+    bool insert(K key, T value, int tid)
+    {
+        bool result = put(key, value, false);
+        releaseRetired();
+        return result;
+    }
+
+    bool remove(K key, int tid)
+    {
+        bool result = false;
+        while (true)
+        {
+            Node *pred, *target;
+            find(key, &pred, &target);
+            if (target == head)
+                break;
+            uint64_t states = target->states.load();
+            int slot = slotOf(target, states, key);
+            if (slot < 0)
+            {
+                flushDelete(target, states, key);
+                break;
+            }
+            if (flagsOf(states) & FROZEN)
+            {
+                help(pred, target);
+                continue;
+            }
+            uint64_t desired = withState(states, slot, (stateOf(states, slot) & ~STATUS) | DELETED);
+            if (!target->states.compare_exchange_strong(states, desired))
+                continue;
+            BARRIER(target, FLUSH_SITE_LINK_FREE_DELETE);
+            target->states.fetch_or((uint64_t)DELETE_FLAG << (8 * slot));
+            shrink(pred, target, desired);
+            result = true;
+            break;
+        }
+        releaseRetired();
+        return result;
+    }
+
+    bool contains(K key, int tid)
+    {
+        Node *n = locate(key);
+        if (n == head)
+            return false;
+        uint64_t states = n->states.load();
+        int slot = slotOf(n, states, key);
+        if (slot < 0)
+        {
+            flushDelete(n, states, key);
+            return false;
+        }
+        flushInsert(n, states, slot);
+        return true;
+    }
+
+    // reads the value of key into value, returns false if the key is not in the list
+    bool get(K key, T &value, int tid)
+    {
+        Node *n = locate(key);
+        if (n == head)
+            return false;
+        uint64_t states = n->states.load();
+        int slot = slotOf(n, states, key);
+        if (slot < 0)
+        {
+            flushDelete(n, states, key);
+            return false;
+        }
+        flushInsert(n, states, slot);
+        value = n->values[slot];
+        return true;
+    }
+
+    // sets the value of key, inserting it if it is not in the list. Returns whether it
+    // inserted the key. The new value takes a slot of its own (see publish)
+    bool upsert(K key, T value, int tid)
+    {
+        bool result = put(key, value, true);
+        releaseRetired();
+        return result;
+    }
+
+    // sets the value of key to desired if it is expected
+    bool compareAndSwapValue(K key, T expected, T desired, int tid)
+    {
+        bool result = false;
+        while (true)
+        {
+            Node *pred, *target;
+            find(key, &pred, &target);
+            if (target == head)
+                break;
+            uint64_t states = target->states.load();
+            int old = slotOf(target, states, key);
+            if (old < 0)
+            {
+                flushDelete(target, states, key);
+                break;
+            }
+            if (target->values[old] != expected)
+            {
+                flushInsert(target, states, old);
+                break;
+            }
+            int slot = claim(pred, target, key, desired);
+            if (slot < 0)
+                continue;
+            BARRIER(target->values, FLUSH_SITE_VALUE);
+            // the values of a slot never change, so the swap holds while the old slot is inserted
+            states = target->states.load();
+            while (!(flagsOf(states) & FROZEN) && (stateOf(states, old) & STATUS) == INSERTED)
+            {
+                uint64_t swapped = withState(withState(states, slot, INSERTED), old,
+                                             (stateOf(states, old) & ~STATUS) | DELETED);
+                if (target->states.compare_exchange_weak(states, swapped))
+                {
+                    result = true;
+                    break;
+                }
+            }
+            if (!result)
+            {
+                abandon(target, slot);
+                continue;
+            }
+            BARRIER(target, FLUSH_SITE_VALUE);
+            target->states.fetch_or((uint64_t)INSERT_FLAG << (8 * slot) | (uint64_t)DELETE_FLAG << (8 * old));
+            break;
+        }
+        releaseRetired();
+        return result;
+    }
+
+    typedef recoveryUtils::SortEntry<Node, K, Traits> Entry;
+
+    // rebuilds the list from the nodes in the chunks of alloc, using numThreads threads. The
+    // nodes are classified before any of them is rewritten, since the class of a node depends
+    // on the nodes of its rebuild. The stats count the recovered keys
+    RecoveryStats recover(int numThreads = 1)
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto chunks = recoveryUtils::getChunks(alloc);
+        Ranges ranges;
+        for (auto chunk : chunks)
+            ranges.push_back({(uintptr_t)chunk->obj, (uintptr_t)chunk->obj + chunk->size});
+        std::sort(ranges.begin(), ranges.end());
+
+        std::vector<std::vector<Entry>> alive(numThreads);
+        std::vector<std::vector<Node *>> garbage(numThreads);
+        recoveryUtils::parallelRun(numThreads, [&](int tid) {
+            recoveryUtils::forEachSlot<Node>(chunks, tid, numThreads, [&](Node *n) {
+                // the node was never initialized, no need to free it or add it
+                if (n->next.load() == nullptr && linkFreeUtils::isValid(n->metaData.load()))
+                    return;
+                if (isAlive(ranges, n) && keysOf(n) != 0)
+                    alive[tid].push_back({n->keys[0], n});
+                else
+                    garbage[tid].push_back(n);
+            });
+        });
+
+        std::vector<uint64_t> keys(numThreads, 0);
+        recoveryUtils::parallelRun(numThreads, [&](int tid) {
+            for (Entry &e : alive[tid])
+            {
+                unsigned slots = keysOf(e.node);
+                keys[tid] += __builtin_popcount(slots);
+                normalize(e.node, slots);
+            }
+            for (Node *n : garbage[tid])
+            {
+                n->next.store(withBits(nullptr, MARK_BIT));
+                n->states.store(n->states.load() & ~flagBits(VICTIM));
+                FLUSH(n);
+            }
+            SFENCE();
+        });
+
+        // alloc is thread-local, so only this thread can free into it
+        RecoveryStats stats = {0, 0, 0};
+        for (int tid = 0; tid < numThreads; tid++)
+        {
+            for (Node *n : garbage[tid])
+                ssmem_free(alloc, n);
+            stats.reclaimed += garbage[tid].size();
+            stats.recovered += keys[tid];
+        }
+
+        auto nodes = recoveryUtils::gather(alive, numThreads);
+        recoveryUtils::parallelSort(nodes, numThreads);
+        recoveryUtils::parallelRun(numThreads, [&](int tid) {
+            uint64_t begin, end;
+            recoveryUtils::split(nodes.size(), tid, numThreads, &begin, &end);
+            for (uint64_t i = begin; i < end; i++)
+            {
+                assert(i + 1 == nodes.size() || Traits::less(nodes[i].key, nodes[i + 1].key));
+                nodes[i].node->next.store(i + 1 < nodes.size() ? nodes[i + 1].node : tail, std::memory_order_relaxed);
+            }
+        });
+        head->next.store(nodes.empty() ? tail : nodes[0].node);
+
+        stats.seconds = recoveryUtils::secondsSince(start);
+        return stats;
+    }
+
+private:
+    Node *head, *tail;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef LINK_FREE_UTILS_H_
 #define LINK_FREE_UTILS_H_
 
+#include <vector>
 #include "common.h"
 
 #define HIGH_CHAR_MASK 0x80
@@ -56,6 +57,61 @@ static inline Node *mark(Node *ptr)
     return (Node *)(ptrLong);
 }
 
+// the flushes of a batch of operations, which it waits for once at its end. The flags of
+// the nodes are set only then, and the nodes that the batch unlinked or failed to link are
+// freed last: ssmem reuses a node once every thread freed something since it was freed, so
+// none of the nodes the batch holds is reused in between
+template <class Node>
+struct FlushBatch
+{
+    std::vector<Node *> inserted, deleted, retired;
+
+    void flushInsert(Node *n)
+    {
+        if (LIKELY(n->insertFlag.load()))
+        {
+            flush_elided(FLUSH_SITE_LINK_FREE_INSERT);
+            return;
+        }
+        FLUSH(n, FLUSH_SITE_LINK_FREE_INSERT);
+        inserted.push_back(n);
+    }
+
+    void flushDelete(Node *n)
+    {
+        if (LIKELY(n->deleteFlag.load()))
+        {
+            flush_elided(FLUSH_SITE_LINK_FREE_DELETE);
+            return;
+        }
+        FLUSH(n, FLUSH_SITE_LINK_FREE_DELETE);
+        deleted.push_back(n);
+    }
+
+    // waits for the flushes so far and sets the flags of their nodes
+    void wait()
+    {
+        if (inserted.empty() && deleted.empty())
+            return;
+        SFENCE();
+        for (Node *n : inserted)
+            n->insertFlag.store(true, std::memory_order_release);
+        for (Node *n : deleted)
+            n->deleteFlag.store(true, std::memory_order_release);
+        inserted.clear();
+        deleted.clear();
+    }
+
+    // frees the retired nodes with free, once the batch is done with its nodes
+    template <class Free>
+    void release(Free free)
+    {
+        for (Node *n : retired)
+            free(n);
+        retired.clear();
+    }
+};
+
 } // namespace linkFreeUtils
 
 #endif
\ No newline at end of file
@@ -4,17 +4,24 @@ __thread ssmem_allocator_t *volatileAlloc;
 
 #include "LinkFreeList.h"
 #include "SOFTList.h"
+#include "LinkFreeUnrolledList.h"
 
-template<>
-void specificInit<SOFTList<intptr_t>>(int id){
+// the SOFT lists keep their volatile nodes in volatileAlloc, whatever their keys and values
+template <class T, class K, class Traits>
+static void initVolatileAlloc(SOFTList<T, K, Traits> *, int id)
+{
     volatileAlloc = (ssmem_allocator_t *)malloc(sizeof(ssmem_allocator_t));
     ssmem_alloc_init(volatileAlloc, SSMEM_DEFAULT_MEM_SIZE, id);
 }
 
+static void initVolatileAlloc(void *, int id)
+{
+}
+
 template<class SET>
 void specificInit(int id)
 {
-    return;
+    initVolatileAlloc((SET *)nullptr, id);
 }
 
 int main(int argc, char **argv)
@@ -39,15 +46,29 @@ int main(int argc, char **argv)
                 if(ITERATION == 1)
                     file << "Reads: " << RO_RATIO << endl;
                 break;
+            case 4:
+                file.open(ALG_NAME + "-RECOVERY-KEY_RANGE-" + to_string(KEY_RANGE) + "-THREADS-" + to_string(NUM_THREADS) + ".txt", ofstream::app);
+                break;
+            case 5:
+                file.open(ALG_NAME + "-GROWTH-KEY_RANGE-" + to_string(KEY_RANGE) + "-THREADS-" + to_string(NUM_THREADS) + ".txt", ofstream::app);
+                break;
         }
 
     if (!ALG_NAME.compare("LinkFreeList"))
     {
-            runBench<LinkFreeList<intptr_t>>();
+            runBenchWithKeys<LinkFreeList>();
     }
     else if (!ALG_NAME.compare("SOFTList"))
     {
-            runBench<SOFTList<intptr_t>>();
+            runBenchWithKeys<SOFTList>();
+    }
+    else if (!ALG_NAME.compare("LinkFreeUnrolledList"))
+    {
+        // the nodes compare integer keys and keep the values in line
+        if (STRING_KEY_BYTES > 0 || VALUE_BYTES > 0)
+            cout << ALG_NAME << " does not take string keys or blob values." << endl;
+        else
+            runBench<LinkFreeUnrolledList<intptr_t, intptr_t>>();
     }
     else
     {
@@ -1,6 +1,8 @@
 #include "BenchUtils.h"
 
 __thread unsigned int randSeed;
+// the SOFT skip list takes its towers from TowerUtils.h, but SOFTList.h refers to it
+__thread ssmem_allocator_t *volatileAlloc;
 static uchar get_random_level()
 {
     int i;
@@ -8,7 +10,7 @@ static uchar get_random_level()
 
     for (i = 0; i < MAX_LEVEL - 1; i++)
     {
-        if ((rand_r_32(&randSeed) & 0xFF) < 128)
+        if ((rand_r_32(&randSeed) & 0xFF) < LEVEL_THRESHOLD)
             level++;
         else
             break;
@@ -48,15 +50,21 @@ int main(int argc, char **argv)
                 if(ITERATION == 1)
                     file << "Reads: " << RO_RATIO << endl;
                 break;
+            case 4:
+                file.open(ALG_NAME + "-RECOVERY-KEY_RANGE-" + to_string(KEY_RANGE) + "-THREADS-" + to_string(NUM_THREADS) + ".txt", ofstream::app);
+                break;
+            case 5:
+                file.open(ALG_NAME + "-GROWTH-KEY_RANGE-" + to_string(KEY_RANGE) + "-THREADS-" + to_string(NUM_THREADS) + ".txt", ofstream::app);
+                break;
     }
 
     if (!ALG_NAME.compare("LinkFreeSkipList"))
     {
-            runBench<LinkFreeSkipList<intptr_t>>();
+            runBenchWithKeys<LinkFreeSkipList>();
     }
     else if (!ALG_NAME.compare("SOFTSkipList"))
     {
-            runBench<SOFTSkipList<intptr_t>>();
+            runBenchWithKeys<SOFTSkipList>();
     }
     else
     {
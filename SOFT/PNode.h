@@ -3,36 +3,49 @@
 
 #include <atomic>
 #include "utilities.h"
+#include "EpochUtils.h"
 
-template <class T>
+template <class T, class K = intptr_t>
 class PNode
 {
   public:
 	std::atomic<bool> validStart, validEnd, deleted;
-	atomic<intptr_t> key;
+	// the epochs of the insertion and the deletion in buffered durability, 0 otherwise
+	std::atomic<epochUtils::stamp_t> insertStamp, deleteStamp;
+	// written once, before the PNode is published, so it needs no atomic
+	K key;
 	atomic<T> value;
 
-	PNode() : key(0), validStart(false), validEnd(false), deleted(false) {}
+	PNode() : key(), validStart(false), validEnd(false), deleted(false), insertStamp(0), deleteStamp(0) {}
 
 	bool alloc()
 	{
 		return !this->validStart.load();
 	}
 
-	void create(intptr_t key, T value, bool validity)
+	// the key and the value are set while the PNode is still deleted, by the thread that
+	// allocated it, so that the helpers of the insertion never write over a value update
+	void init(K key, T value)
+	{
+		this->key = key;
+		this->value.store(value, std::memory_order_relaxed);
+	}
+
+	// a PNode that is not durable is flushed at the end of its epoch
+	void create(bool validity, bool durable = true)
 	{
 		this->validStart.store(validity, std::memory_order_relaxed);
 		std::atomic_thread_fence(std::memory_order_release);
-		this->key.store(key, std::memory_order_relaxed);
-		this->value.store(value, std::memory_order_relaxed);
 		this->validEnd.store(validity, std::memory_order_release);
-		BARRIER(this);
+		if (durable)
+			BARRIER(this, FLUSH_SITE_SOFT_CREATE);
 	}
 
-	void destroy(bool validity)
+	void destroy(bool validity, bool durable = true)
 	{
 		this->deleted.store(validity, std::memory_order_release);
-		BARRIER(this);
+		if (durable)
+			BARRIER(this, FLUSH_SITE_SOFT_DESTROY);
 	}
 
 	bool isValid()
@@ -3,37 +3,110 @@
 
 #include "SOFTList.h"
 #include "utilities.h"
-#include <cmath>
 
-template <class T>
+// A fixed number of buckets, each a SOFT list. The heads of the buckets are in one
+// array and all the buckets end at the same tail, so a lookup misses once in the array
+// and then only on the nodes of its bucket
+template <class T, class K = intptr_t, class Traits = KeyTraits<K>>
 class SOFTHashTable
 {
 public:
-    bool insert(int k, T item, int tid)
+    typedef SOFTList<T, K, Traits> List;
+
+    // numBuckets is rounded up to a power of two, of at least 2
+    SOFTHashTable(uint64_t numBuckets = BUCKET_NUM) : size(roundUpPow2(std::max(numBuckets, (uint64_t)2))), shift(64 - __builtin_ctzll(size))
+    {
+        tail = new Node<T, K>(Traits::max(), T(), nullptr, false);
+        size_t bytes = (size * sizeof(Node<T, K>) + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+        heads = static_cast<Node<T, K> *>(aligned_alloc(CACHE_LINE_SIZE, bytes));
+        assert(heads != nullptr);
+        for (uint64_t b = 0; b < size; b++)
+        {
+            new (&heads[b]) Node<T, K>(Traits::min(), T(), nullptr, false);
+            heads[b].next.store(tail, std::memory_order_relaxed);
+        }
+    }
+
+    bool insert(K k, T item, int tid)
+    {
+        return List::insertFrom(getBucket(k), k, item);
+    }
+
+    bool remove(K k, int tid)
+    {
+        return List::removeFrom(getBucket(k), k);
+    }
+
+    bool contains(K k, int tid)
+    {
+        return List::containsFrom(getBucket(k), k);
+    }
+
+    bool get(K k, T &value, int tid)
+    {
+        return List::getFrom(getBucket(k), k, value);
+    }
+
+    bool upsert(K k, T item, int tid)
+    {
+        return List::upsertFrom(getBucket(k), k, item);
+    }
+
+    bool compareAndSwapValue(K k, T expected, T desired, int tid)
     {
-        SOFTList<T> &bucket = getBucket(k);
-        return bucket.insert(k, item, tid);
+        return List::compareAndSwapValueFrom(getBucket(k), k, expected, desired);
     }
 
-    bool remove(int k, int tid)
+    uint64_t buckets()
     {
-        SOFTList<T> &bucket = getBucket(k);
-        return bucket.remove(k, tid);
+        return size;
     }
 
-    bool contains(int k, int tid)
+    // rebuilds the buckets from the PNodes in the chunks of alloc, which all the buckets
+    // share: the chunks are scanned once, the surviving PNodes are grouped by bucket and
+    // the buckets are sorted and linked in parallel
+    RecoveryStats recover(int numThreads = 1)
     {
-        SOFTList<T> &bucket = getBucket(k);
-        return bucket.contains(k, tid);
+        typedef typename List::Entry Entry;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::vector<Entry>> valid(numThreads);
+        RecoveryStats stats = {0, List::collect(numThreads, valid), 0};
+
+        std::vector<uint64_t> offsets;
+        auto pnodes = recoveryUtils::partition(valid, size, offsets, numThreads,
+                                               [&](const Entry &e) { return bucketOf(e.key); });
+        Node<T, K> *nodes = List::allocRecoveredNodes(pnodes.size());
+        recoveryUtils::parallelRun(numThreads, [&](int tid) {
+            uint64_t begin, end;
+            recoveryUtils::split(size, tid, numThreads, &begin, &end);
+            for (uint64_t b = begin; b < end; b++)
+            {
+                std::sort(pnodes.begin() + offsets[b], pnodes.begin() + offsets[b + 1]);
+                List::linkSorted(&heads[b], pnodes.data() + offsets[b], offsets[b + 1] - offsets[b], 1,
+                                        nodes + offsets[b]);
+            }
+        });
+
+        stats.recovered = pnodes.size();
+        stats.seconds = recoveryUtils::secondsSince(start);
+        return stats;
     }
 
   private:
-    SOFTList<T> &getBucket(int k)
+    uint64_t bucketOf(K k)
+    {
+        return Traits::hash(k) >> shift;
+    }
+
+    Node<T, K> *getBucket(K k)
     {
-        return table[std::abs(k % BUCKET_NUM)];
+        return &heads[bucketOf(k)];
     }
 
-    SOFTList<T> table[BUCKET_NUM];
+    const uint64_t size;
+    const int shift;
+    Node<T, K> *heads;
+    Node<T, K> *tail;
 };
 
-#endif
\ No newline at end of file
+#endif
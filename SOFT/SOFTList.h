@@ -4,25 +4,58 @@
 #include "utilities.h"
 #include "VolatileNode.h"
 #include <atomic>
+#include <new>
+#include <vector>
+#include <algorithm>
 #include <ssmem.h>
+#include "RecoveryUtils.h"
+#include "KeyTraits.h"
+#include "ValueTraits.h"
 
 typedef softUtils::state state;
 
-template <class T>
+template <class T, class K = intptr_t, class Traits = KeyTraits<K>>
 class SOFTList
 {
   private:
-    PNode<T> *allocNewPNode()
+    static PNode<T, K> *allocNewPNode()
     {
-        return static_cast<PNode<T> *>(ssmem_alloc(alloc, sizeof(PNode<T>)));
+        return static_cast<PNode<T, K> *>(ssmem_alloc(alloc, sizeof(PNode<T, K>)));
     }
 
-	Node<T>* allocNewVolatileNode(intptr_t key, T value, PNode<T>* pptr, bool pValidity){
-		Node<T>* n =  static_cast<Node<T>*>(ssmem_alloc(volatileAlloc, sizeof(Node<T>)));
+    // frees what the key and the value of a PNode refer to. The value is taken out of the
+    // PNode, since an update that raced with the removal may still replace it (see writeValue)
+    static void releasePNode(void *p)
+    {
+        Traits::release(static_cast<PNode<T, K> *>(p)->key);
+        if (ValueTraits<T>::outOfLine)
+            ValueTraits<T>::release(static_cast<PNode<T, K> *>(p)->value.exchange(T()));
+    }
+
+    // frees a PNode that was in the list, or failed to get in
+    static void freePNode(PNode<T, K> *p)
+    {
+        releasePNode(p);
+        ssmem_free(alloc, p);
+    }
+
+	static Node<T, K>* allocNewVolatileNode(K key, T value, PNode<T, K>* pptr, bool pValidity, epochUtils::stamp_t insertStamp = 0){
+		Node<T, K>* n =  static_cast<Node<T, K>*>(ssmem_alloc(volatileAlloc, sizeof(Node<T, K>)));
+		// the key and the value are kept by the PNode, and the volatile node shares them
+		key = Traits::store(key, pptr);
+		value = ValueTraits<T>::store(value, pptr);
 		n->key = key;
 		n->value = value;
 		n->pptr = pptr;
 		n->pValidity = pValidity;
+		n->insertStamp = insertStamp;
+		n->deleteStamp.store(0, std::memory_order_relaxed);
+		n->valueUpdated.store(false, std::memory_order_relaxed);
+		n->valueWriters.store(0, std::memory_order_relaxed);
+		// the PNode is still deleted, so its stamps and contents are set before it is published
+		pptr->insertStamp.store(insertStamp, std::memory_order_relaxed);
+		pptr->deleteStamp.store(0, std::memory_order_relaxed);
+		pptr->init(key, value);
 		return n;
 	}
 
@@ -30,37 +63,91 @@ class SOFTList
     SOFTList()
     {
         //there is no need to save the sentinel nodes in the special areas
-        head = new Node<T>(INT_MIN, 0, nullptr, false);
-        head->next.store(new Node<T>(INT_MAX, 0, nullptr, false), std::memory_order_release);
+        head = new Node<T, K>(Traits::min(), T(), nullptr, false);
+        head->next.store(new Node<T, K>(Traits::max(), T(), nullptr, false), std::memory_order_release);
     }
 
   private:
-    bool trim(Node<T> *prev, Node<T> *curr)
+    static bool trim(Node<T, K> *prev, Node<T, K> *curr)
     {
         state prevState = softUtils::getState(curr);
-        Node<T> *currRef = softUtils::getRef<Node<T>>(curr);
-        Node<T> *succ = softUtils::getRef<Node<T>>(currRef->next.load());
-        succ = softUtils::createRef<Node<T>>(succ, prevState);
+        Node<T, K> *currRef = softUtils::getRef<Node<T, K>>(curr);
+        Node<T, K> *succ = softUtils::getRef<Node<T, K>>(currRef->next.load());
+        succ = softUtils::createRef<Node<T, K>>(succ, prevState);
         bool result = prev->next.compare_exchange_strong(curr, succ);
         if (result)
-            ssmem_free(alloc, currRef->pptr);
+            freePNode(currRef->pptr);
         return result;
     }
 
+    // a value update is persistent before it returns, and a thread that reads the value
+    // while an update is in flight flushes it before it returns it. The value is read from
+    // the volatile node until the first update, which moves it to the PNode for good.
+    // update(v, stored, old) replaces v with stored, the value as the PNode keeps it, puts
+    // the value it replaced in old and returns whether it did. The value that is left out
+    // is released
+    template <class Update>
+    static bool writeValue(Node<T, K> *n, T value, Update update)
+    {
+        T stored = ValueTraits<T>::store(value, n->pptr), old = stored;
+        n->valueUpdated.store(true);
+        n->valueWriters.fetch_add(1);
+        bool changed = update(n->pptr->value, stored, old);
+        // a failed update returns the value of another update, which may not be persistent yet
+        if (changed || n->valueWriters.load() > 1)
+            BARRIER(n->pptr, FLUSH_SITE_VALUE);
+        n->valueWriters.fetch_sub(1);
+        // the removal of the node may have released its value before this update replaced it.
+        // The node is done with before the values are released, since a release lets the other
+        // threads reclaim it
+        T expected = stored;
+        bool orphaned = ValueTraits<T>::outOfLine && changed &&
+                        softUtils::getState(n->next.load()) == state::DELETED &&
+                        n->pptr->value.compare_exchange_strong(expected, T());
+        ValueTraits<T>::release(changed ? old : stored);
+        if (orphaned)
+            ValueTraits<T>::release(stored);
+        return changed;
+    }
+
+    static T readValue(Node<T, K> *n)
+    {
+        if (LIKELY(!n->valueUpdated.load()))
+            return n->value;
+        T value = n->pptr->value.load();
+        if (UNLIKELY(n->valueWriters.load() != 0))
+            BARRIER(n->pptr, FLUSH_SITE_VALUE);
+        return value;
+    }
+
+    static bool isPresent(Node<T, K> *n)
+    {
+        state currState = softUtils::getState(n->next.load());
+        return (currState == state::INSERTED || currState == state::INTEND_TO_DELETE) && n->deleteStamp.load() == 0;
+    }
+
+    // whether n, the first node of a search that is not smaller than key, has key. The tail
+    // has the largest key too (see KeyTraits.h), and it is the only node without a successor
+    static bool hasKey(Node<T, K> *n, K key)
+    {
+        return Traits::equal(n->key, key) &&
+               (LIKELY(!Traits::equal(key, Traits::max())) || softUtils::getRef<Node<T, K>>(n->next.load()) != nullptr);
+    }
+
     // returns clean reference in pred, ref+state of pred in return and the state of curr in the last arg
-    Node<T> *find(intptr_t key, Node<T> **predPtr, state *currStatePtr)
+    static Node<T, K> *find(Node<T, K> *head, K key, Node<T, K> **predPtr, state *currStatePtr)
     {
-        Node<T> *prev = head, *curr = prev->next.load(), *succ, *succRef;
-        Node<T> *currRef = softUtils::getRef<Node<T>>(curr);
+        Node<T, K> *prev = head, *curr = prev->next.load(), *succ, *succRef;
+        Node<T, K> *currRef = softUtils::getRef<Node<T, K>>(curr);
         state prevState = softUtils::getState(curr), cState;
         while (true)
         {
             succ = currRef->next.load();
-            succRef = softUtils::getRef<Node<T>>(succ);
+            succRef = softUtils::getRef<Node<T, K>>(succ);
             cState = softUtils::getState(succ);
             if (LIKELY(cState != state::DELETED))
             {
-                if (UNLIKELY(currRef->key >= key))
+                if (UNLIKELY(!Traits::less(currRef->key, key)))
                     break;
                 prev = currRef;
                 prevState = cState;
@@ -69,7 +156,81 @@ class SOFTList
             {
                 trim(prev, curr);
             }
-            curr = softUtils::createRef<Node<T>>(succRef, prevState);
+            curr = softUtils::createRef<Node<T, K>>(succRef, prevState);
+            currRef = succRef;
+        }
+        *predPtr = prev;
+        *currStatePtr = cState;
+        return curr;
+    }
+
+    // where a search of a batch starts: pred, the predecessor of the previous key of the
+    // batch, unless it was deleted since. A search from a node that is deleted by the time it
+    // starts returns it as the predecessor, in the DELETED state of the reference it returns
+    static Node<T, K> *resume(Node<T, K> *head, Node<T, K> *pred)
+    {
+        return softUtils::getState(pred->next.load()) == state::DELETED ? head : pred;
+    }
+
+    // the search of contains from start: the first node that is not smaller than key, and in
+    // predPtr the last node before it that was not deleted
+    static Node<T, K> *seek(Node<T, K> *start, K key, Node<T, K> **predPtr)
+    {
+        Node<T, K> *pred = start, *curr = softUtils::getRef<Node<T, K>>(start->next.load());
+        while (Traits::less(curr->key, key))
+        {
+            Node<T, K> *next = curr->next.load();
+            if (softUtils::getState(next) != state::DELETED)
+                pred = curr;
+            curr = softUtils::getRef<Node<T, K>>(next);
+        }
+        *predPtr = pred;
+        return curr;
+    }
+
+    // Buffered durability (see EpochUtils.h): the updates stamp the PNodes with their epoch
+    // instead of flushing them. A remover claims a node by stamping its deletion in the
+    // volatile node before it moves the state to INTEND_TO_DELETE, so a node is deleted
+    // once it has a delete stamp
+
+    static bool trimBuffered(Node<T, K> *prev, Node<T, K> *curr)
+    {
+        Node<T, K> *currRef = softUtils::getRef<Node<T, K>>(curr);
+        epochUtils::waitUnlinkable(currRef->deleteStamp.load());
+        state prevState = softUtils::getState(curr);
+        Node<T, K> *succ = softUtils::getRef<Node<T, K>>(currRef->next.load());
+        succ = softUtils::createRef<Node<T, K>>(succ, prevState);
+        bool result = prev->next.compare_exchange_strong(curr, succ);
+        if (result)
+            epochUtils::retire(currRef->pptr, releasePNode);
+        return result;
+    }
+
+    // find of an operation of epoch e, which moves to a later epoch if it passes one of its deletions
+    static Node<T, K> *findBuffered(Node<T, K> *head, K key, Node<T, K> **predPtr, state *currStatePtr, uint64_t &e)
+    {
+        Node<T, K> *prev = head, *curr = prev->next.load(), *succ, *succRef;
+        Node<T, K> *currRef = softUtils::getRef<Node<T, K>>(curr);
+        state prevState = softUtils::getState(curr), cState;
+        while (true)
+        {
+            succ = currRef->next.load();
+            succRef = softUtils::getRef<Node<T, K>>(succ);
+            cState = softUtils::getState(succ);
+            if (LIKELY(cState != state::DELETED))
+            {
+                if (UNLIKELY(!Traits::less(currRef->key, key)))
+                    break;
+                prev = currRef;
+                prevState = cState;
+            }
+            else
+            {
+                if (epochUtils::newer(currRef->deleteStamp.load(), e))
+                    e = epochUtils::restart();
+                trimBuffered(prev, curr);
+            }
+            curr = softUtils::createRef<Node<T, K>>(succRef, prevState);
             currRef = succRef;
         }
         *predPtr = prev;
@@ -77,22 +238,326 @@ class SOFTList
         return curr;
     }
 
+    // completes the removal of a claimed node
+    static void helpRemove(Node<T, K> *n)
+    {
+        epochUtils::stamp_t expected = 0;
+        n->pptr->deleteStamp.compare_exchange_strong(expected, n->deleteStamp.load());
+        while (softUtils::getState(n->next.load()) == state::INSERTED)
+            softUtils::stateCAS<Node<T, K>>(n->next, state::INSERTED, state::INTEND_TO_DELETE);
+        n->pptr->destroy(n->pValidity, false);
+        while (softUtils::getState(n->next.load()) == state::INTEND_TO_DELETE)
+            softUtils::stateCAS<Node<T, K>>(n->next, state::INTEND_TO_DELETE, state::DELETED);
+    }
+
+    static bool insertBuffered(Node<T, K> *head, K key, T value)
+    {
+        uint64_t e = epochUtils::enter();
+        Node<T, K> *pred, *currRef, *resultNode;
+        state currState, predState;
+        bool result;
+        while (true)
+        {
+            Node<T, K> *curr = findBuffered(head, key, &pred, &currState, e);
+            currRef = softUtils::getRef<Node<T, K>>(curr);
+            predState = softUtils::getState(curr);
+
+            if (hasKey(currRef, key))
+            {
+                if (epochUtils::newer(currRef->insertStamp, e) || epochUtils::newer(currRef->deleteStamp.load(), e))
+                {
+                    e = epochUtils::restart();
+                    continue;
+                }
+                if (currRef->deleteStamp.load() != 0)
+                {
+                    helpRemove(currRef);
+                    continue;
+                }
+                resultNode = currRef;
+                result = false;
+                if (currState != state::INTEND_TO_INSERT)
+                    break;
+            }
+            else
+            {
+                PNode<T, K> *newPNode = allocNewPNode();
+                bool pValid = newPNode->alloc();
+                Node<T, K> *newNode = allocNewVolatileNode(key, value, newPNode, pValid, epochUtils::stampOf(e));
+                newNode->next.store(static_cast<Node<T, K> *>(softUtils::createRef(currRef, state::INTEND_TO_INSERT)), std::memory_order_relaxed);
+                if (!pred->next.compare_exchange_strong(curr, static_cast<Node<T, K> *>(softUtils::createRef(newNode, predState))))
+                {
+                    ssmem_free(volatileAlloc, newNode);
+                    freePNode(newPNode);
+                    continue;
+                }
+                epochUtils::dirty(e, newPNode, &newPNode->insertStamp, 0);
+                resultNode = newNode;
+                result = true;
+            }
+
+            resultNode->pptr->create(resultNode->pValidity, false);
+
+            while (softUtils::getState(resultNode->next.load()) == state::INTEND_TO_INSERT)
+                softUtils::stateCAS<Node<T, K>>(resultNode->next, state::INTEND_TO_INSERT, state::INSERTED);
+            break;
+        }
+        epochUtils::exit();
+        return result;
+    }
+
+    static bool removeBuffered(Node<T, K> *head, K key)
+    {
+        uint64_t e = epochUtils::enter();
+        Node<T, K> *pred, *currRef;
+        state currState;
+        bool result = false;
+        while (true)
+        {
+            Node<T, K> *curr = findBuffered(head, key, &pred, &currState, e);
+            currRef = softUtils::getRef<Node<T, K>>(curr);
+            if (!hasKey(currRef, key) || currState == state::INTEND_TO_INSERT || currState == state::DELETED)
+                break;
+            if (epochUtils::newer(currRef->insertStamp, e))
+            {
+                e = epochUtils::restart();
+                continue;
+            }
+
+            epochUtils::stamp_t claimed = 0;
+            if (!currRef->deleteStamp.compare_exchange_strong(claimed, epochUtils::stampOf(e)))
+            {
+                // removed by another thread, which is helped before looking again
+                if (epochUtils::newer(claimed, e))
+                    e = epochUtils::restart();
+                helpRemove(currRef);
+                continue;
+            }
+            helpRemove(currRef);
+            epochUtils::dirty(e, currRef->pptr, &currRef->pptr->deleteStamp, epochUtils::DELETED);
+            trimBuffered(pred, curr);
+            result = true;
+            break;
+        }
+        epochUtils::exit();
+        return result;
+    }
+
+    // the value updates stay strictly durable, so that the recovered value of a key is never older
+    // than its last acknowledged update
+    template <class Update>
+    static bool updateBuffered(Node<T, K> *head, K key, T value, Update update)
+    {
+        uint64_t e = epochUtils::enter();
+        Node<T, K> *pred, *currRef;
+        state currState;
+        bool result;
+        while (true)
+        {
+            Node<T, K> *curr = findBuffered(head, key, &pred, &currState, e);
+            currRef = softUtils::getRef<Node<T, K>>(curr);
+            if (hasKey(currRef, key) &&
+                (epochUtils::newer(currRef->insertStamp, e) || epochUtils::newer(currRef->deleteStamp.load(), e)))
+            {
+                e = epochUtils::restart();
+                continue;
+            }
+            result = hasKey(currRef, key) && currRef->deleteStamp.load() == 0;
+            if (result)
+            {
+                if (currState == state::INTEND_TO_INSERT)
+                {
+                    currRef->pptr->create(currRef->pValidity, false);
+                    while (softUtils::getState(currRef->next.load()) == state::INTEND_TO_INSERT)
+                        softUtils::stateCAS<Node<T, K>>(currRef->next, state::INTEND_TO_INSERT, state::INSERTED);
+                }
+                writeValue(currRef, value, update);
+            }
+            break;
+        }
+        epochUtils::exit();
+        return result;
+    }
+
   public:
-    bool insert(intptr_t key, T value, int tid)
+    bool insert(K key, T value, int tid)
     {
-        Node<T> *pred, *currRef;
+        return insertFrom(head, key, value);
+    }
+
+    bool remove(K key, int tid)
+    {
+        return removeFrom(head, key);
+    }
+
+    bool contains(K key, int tid)
+    {
+        return containsFrom(head, key);
+    }
+
+    bool get(K key, T &value, int tid)
+    {
+        return getFrom(head, key, value);
+    }
+
+    bool upsert(K key, T value, int tid)
+    {
+        return upsertFrom(head, key, value);
+    }
+
+    bool compareAndSwapValue(K key, T expected, T desired, int tid)
+    {
+        return compareAndSwapValueFrom(head, key, expected, desired);
+    }
+
+    // The batches run the operation of every key in key order, each search from the
+    // predecessor of the previous key, and flush the PNodes they create or destroy with a
+    // single fence at the end. The nodes stay intended to be inserted or deleted until then,
+    // so that no other thread relies on them before they are persistent. Every operation is
+    // linearizable on its own, the batch is not atomic. They return how many of the
+    // operations succeeded, and with buffered durability they run the operations one by one
+
+    size_t insertBatch(std::vector<std::pair<K, T>> batch, int tid)
+    {
+        std::sort(batch.begin(), batch.end(),
+                  [](const std::pair<K, T> &a, const std::pair<K, T> &b) { return Traits::less(a.first, b.first); });
+        size_t inserted = 0;
+        if (epochUtils::enabled)
+        {
+            for (auto &item : batch)
+                inserted += insertBuffered(head, item.first, item.second);
+            return inserted;
+        }
+        std::vector<Node<T, K> *> created;
+        Node<T, K> *pred = head, *currRef;
+        state currState, predState;
+        for (auto &item : batch)
+        {
+            while (true)
+            {
+                Node<T, K> *curr = find(resume(head, pred), item.first, &pred, &currState);
+                currRef = softUtils::getRef<Node<T, K>>(curr);
+                predState = softUtils::getState(curr);
+                if (predState == state::DELETED)
+                {
+                    pred = head;
+                    continue;
+                }
+                Node<T, K> *resultNode;
+                if (hasKey(currRef, item.first))
+                {
+                    if (currState != state::INTEND_TO_INSERT)
+                        break;
+                    resultNode = currRef;
+                }
+                else
+                {
+                    PNode<T, K> *newPNode = allocNewPNode();
+                    bool pValid = newPNode->alloc();
+                    Node<T, K> *newNode = allocNewVolatileNode(item.first, item.second, newPNode, pValid);
+                    newNode->next.store(static_cast<Node<T, K> *>(softUtils::createRef(currRef, state::INTEND_TO_INSERT)), std::memory_order_relaxed);
+                    if (!pred->next.compare_exchange_strong(curr, static_cast<Node<T, K> *>(softUtils::createRef(newNode, predState))))
+                    {
+                        ssmem_free(volatileAlloc, newNode);
+                        freePNode(newPNode);
+                        continue;
+                    }
+                    resultNode = newNode;
+                    inserted++;
+                }
+                resultNode->pptr->create(resultNode->pValidity, false);
+                FLUSH(resultNode->pptr, FLUSH_SITE_SOFT_CREATE);
+                created.push_back(resultNode);
+                break;
+            }
+        }
+        if (!created.empty())
+            SFENCE();
+        for (Node<T, K> *n : created)
+        {
+            while (softUtils::getState(n->next.load()) == state::INTEND_TO_INSERT)
+                softUtils::stateCAS<Node<T, K>>(n->next, state::INTEND_TO_INSERT, state::INSERTED);
+        }
+        return inserted;
+    }
+
+    // moves the nodes of the keys to INTEND_TO_DELETE first, and to DELETED once the
+    // destruction of their PNodes is persistent
+    size_t removeBatch(std::vector<K> keys, int tid)
+    {
+        std::sort(keys.begin(), keys.end(), [](const K &a, const K &b) { return Traits::less(a, b); });
+        size_t removed = 0;
+        if (epochUtils::enabled)
+        {
+            for (K &key : keys)
+                removed += removeBuffered(head, key);
+            return removed;
+        }
+        std::vector<Node<T, K> *> destroyed;
+        Node<T, K> *pred = head;
+        state currState;
+        for (K &key : keys)
+        {
+            Node<T, K> *currRef = softUtils::getRef<Node<T, K>>(find(resume(head, pred), key, &pred, &currState));
+            if (!hasKey(currRef, key) || currState == state::INTEND_TO_INSERT || currState == state::DELETED)
+                continue;
+            bool casResult = false;
+            while (!casResult && softUtils::getState(currRef->next.load()) == state::INSERTED)
+                casResult = softUtils::stateCAS<Node<T, K>>(currRef->next, state::INSERTED, state::INTEND_TO_DELETE);
+            currRef->pptr->destroy(currRef->pValidity, false);
+            FLUSH(currRef->pptr, FLUSH_SITE_SOFT_DESTROY);
+            destroyed.push_back(currRef);
+            removed += casResult;
+        }
+        if (destroyed.empty())
+            return removed;
+        SFENCE();
+        for (Node<T, K> *n : destroyed)
+        {
+            while (softUtils::getState(n->next.load()) == state::INTEND_TO_DELETE)
+                softUtils::stateCAS<Node<T, K>>(n->next, state::INTEND_TO_DELETE, state::DELETED);
+        }
+        // the searches trim the deleted nodes on their way
+        pred = head;
+        for (K &key : keys)
+            find(resume(head, pred), key, &pred, &currState);
+        return removed;
+    }
+
+    size_t containsBatch(std::vector<K> keys, int tid)
+    {
+        std::sort(keys.begin(), keys.end(), [](const K &a, const K &b) { return Traits::less(a, b); });
+        size_t found = 0;
+        Node<T, K> *pred = head;
+        for (K &key : keys)
+        {
+            Node<T, K> *curr = seek(resume(head, pred), key, &pred);
+            found += hasKey(curr, key) && isPresent(curr);
+        }
+        return found;
+    }
+
+    // The operations on the list that starts at head (a node that is never removed) and
+    // ends with a node of a larger key than all the others, for the structures that
+    // build on the list
+
+    static bool insertFrom(Node<T, K> *head, K key, T value)
+    {
+        if (epochUtils::enabled)
+            return insertBuffered(head, key, value);
+        Node<T, K> *pred, *currRef;
         state currState, predState;
     retry:
         while (true)
         {
-            Node<T> *curr = find(key, &pred, &currState);
-            currRef = softUtils::getRef<Node<T>>(curr);
+            Node<T, K> *curr = find(head, key, &pred, &currState);
+            currRef = softUtils::getRef<Node<T, K>>(curr);
             predState = softUtils::getState(curr);
 
-            Node<T> *resultNode;
+            Node<T, K> *resultNode;
             bool result = false;
 
-            if (currRef->key == key)
+            if (hasKey(currRef, key))
             {
                 resultNode = currRef;
                 if (currState != state::INTEND_TO_INSERT)
@@ -100,38 +565,39 @@ class SOFTList
             }
             else
             {
-                PNode<T> *newPNode = allocNewPNode();
+                PNode<T, K> *newPNode = allocNewPNode();
                 bool pValid = newPNode->alloc();
-                Node<T> *newNode = allocNewVolatileNode(key, value, newPNode, pValid);
-                newNode->next.store(static_cast<Node<T> *>(softUtils::createRef(currRef, state::INTEND_TO_INSERT)), std::memory_order_relaxed);
-                if (!pred->next.compare_exchange_strong(curr, static_cast<Node<T> *>(softUtils::createRef(newNode, predState)))){
+                Node<T, K> *newNode = allocNewVolatileNode(key, value, newPNode, pValid);
+                newNode->next.store(static_cast<Node<T, K> *>(softUtils::createRef(currRef, state::INTEND_TO_INSERT)), std::memory_order_relaxed);
+                if (!pred->next.compare_exchange_strong(curr, static_cast<Node<T, K> *>(softUtils::createRef(newNode, predState)))){
                     ssmem_free(volatileAlloc, newNode);
-                    ssmem_free(alloc, newPNode);
+                    freePNode(newPNode);
                     goto retry;
                 }
                 resultNode = newNode;
                 result = true;
             }
 
-            resultNode->pptr->create(resultNode->key, resultNode->value, resultNode->pValidity);
+            resultNode->pptr->create(resultNode->pValidity);
 
             while (softUtils::getState(resultNode->next.load()) == state::INTEND_TO_INSERT)
-                softUtils::stateCAS<Node<T>>(resultNode->next, state::INTEND_TO_INSERT, state::INSERTED);
+                softUtils::stateCAS<Node<T, K>>(resultNode->next, state::INTEND_TO_INSERT, state::INSERTED);
 
             return result;
         }
     }
 
-    bool remove(intptr_t key, int tid)
+    static bool removeFrom(Node<T, K> *head, K key)
     {
+        if (epochUtils::enabled)
+            return removeBuffered(head, key);
         bool casResult = false;
-        Node<T> *pred, *curr, *currRef, *succ, *succRef;
-        state predState, currState;
-        curr = find(key, &pred, &currState);
-        currRef = softUtils::getRef<Node<T>>(curr);
-        predState = softUtils::getState(curr);
+        Node<T, K> *pred, *curr, *currRef;
+        state currState;
+        curr = find(head, key, &pred, &currState);
+        currRef = softUtils::getRef<Node<T, K>>(curr);
 
-        if (currRef->key != key)
+        if (!hasKey(currRef, key))
         {
             return false;
         }
@@ -142,101 +608,259 @@ class SOFTList
         }
 
         while (!casResult && softUtils::getState(currRef->next.load()) == state::INSERTED)
-            casResult = softUtils::stateCAS<Node<T>>(currRef->next, state::INSERTED, state::INTEND_TO_DELETE);
+            casResult = softUtils::stateCAS<Node<T, K>>(currRef->next, state::INSERTED, state::INTEND_TO_DELETE);
 
         currRef->pptr->destroy(currRef->pValidity);
 
         while (softUtils::getState(currRef->next.load()) == state::INTEND_TO_DELETE)
-            softUtils::stateCAS<Node<T>>(currRef->next, state::INTEND_TO_DELETE, state::DELETED);
+            softUtils::stateCAS<Node<T, K>>(currRef->next, state::INTEND_TO_DELETE, state::DELETED);
 
         if(casResult)
             trim(pred, curr);
         return casResult;
     }
 
-    bool contains(intptr_t key, int tid)
+    static bool containsFrom(Node<T, K> *head, K key)
     {
-        Node<T> *curr = head->next.load();
-        while(curr->key < key)
+        Node<T, K> *curr = head->next.load();
+        while (Traits::less(curr->key, key))
         {
-            curr = softUtils::getRef<Node<T>>(curr->next.load());
+            curr = softUtils::getRef<Node<T, K>>(curr->next.load());
         }
         state currState = softUtils::getState(curr->next.load());
-	      return (curr->key == key) && ((currState == state::INSERTED) || (currState == state::INTEND_TO_DELETE));
+        // a node with a delete stamp is claimed by a buffered remove
+	      return hasKey(curr, key) && ((currState == state::INSERTED) || (currState == state::INTEND_TO_DELETE)) &&
+	             curr->deleteStamp.load() == 0;
     }
 
-    std::string myName()
+    // reads the value of key into value, returns false if the key is not in the list
+    static bool getFrom(Node<T, K> *head, K key, T &value)
     {
-        return "SOFT List";
+        Node<T, K> *curr = head->next.load();
+        while (Traits::less(curr->key, key))
+        {
+            curr = softUtils::getRef<Node<T, K>>(curr->next.load());
+        }
+        if (!hasKey(curr, key) || !isPresent(curr))
+            return false;
+        T currValue = readValue(curr);
+        // the node is checked again after the value is read, so it was in the list when it was read
+        if (!isPresent(curr))
+            return false;
+        value = currValue;
+        return true;
     }
 
-    void quickInsert(PNode<T> *newPNode)
+    // applies update with value to the value of the node of key (see writeValue) and returns
+    // false if there is no such node. An update that races with the removal of the node takes
+    // effect right before it
+    template <class Update>
+    static bool updateFrom(Node<T, K> *head, K key, T value, Update update)
     {
-        bool pValid = newPNode->recoveryValidity();
-        intptr_t key = newPNode->key;
-        Node<T> *newNode = new Node<T>(key, newPNode->value, newPNode, pValid);
+        if (epochUtils::enabled)
+            return updateBuffered(head, key, value, update);
+        Node<T, K> *pred;
+        state currState;
+        Node<T, K> *currRef = softUtils::getRef<Node<T, K>>(find(head, key, &pred, &currState));
+        if (!hasKey(currRef, key))
+            return false;
+        if (currState == state::INTEND_TO_INSERT)
+        {
+            currRef->pptr->create(currRef->pValidity);
+            while (softUtils::getState(currRef->next.load()) == state::INTEND_TO_INSERT)
+                softUtils::stateCAS<Node<T, K>>(currRef->next, state::INTEND_TO_INSERT, state::INSERTED);
+        }
+        writeValue(currRef, value, update);
+        return true;
+    }
 
-        Node<T> *pred = nullptr, *curr = nullptr, *succ = nullptr;
-        Node<T> *currRef = nullptr, *succRef = nullptr;
-        state predState, currState;
-    retry:
-        pred = head;
-        curr = pred->next.load();
-        currRef = (softUtils::getRef<Node<T>>(curr));
+    // sets the value of key, inserting it if it is not in the list. Returns whether it
+    // inserted the key
+    static bool upsertFrom(Node<T, K> *head, K key, T value)
+    {
+        // a removal or an insertion of the key may come in between, until one of the two finds
+        // the key in the state it needs
         while (true)
         {
-            succ = currRef->next.load();
-            currState = softUtils::getState(succ);
-            succRef = (softUtils::getRef<Node<T>>(succ));
-            //trimming
-            while (currState == state::DELETED)
-            {
-                assert(false);
-            }
-            //continue searching
-            if (currRef->key < key)
-            {
-                pred = currRef;
-                curr = succ;
-                currRef = (softUtils::getRef<Node<T>>(curr));
-            }
-            //found the same
-            else if (currRef->key == key)
-            {
-                assert(false);
-            }
-            else
-            {
-                newNode->next.store((softUtils::createRef<Node<T>>(currRef, state::INSERTED)), std::memory_order_relaxed);
-                if (!pred->next.compare_exchange_strong(curr, (softUtils::createRef<Node<T>>(newNode, state::INSERTED))))
-                    goto retry;
-                return;
-            }
+            if (updateFrom(head, key, value, [](std::atomic<T> &v, T stored, T &old) {
+                    old = v.exchange(stored);
+                    return true;
+                }))
+                return false;
+            if (insertFrom(head, key, value))
+                return true;
         }
     }
 
-    void recovery()
+    // sets the value of key to desired if it is expected
+    static bool compareAndSwapValueFrom(Node<T, K> *head, K key, T expected, T desired)
+    {
+        bool swapped = false;
+        updateFrom(head, key, desired, [&](std::atomic<T> &v, T stored, T &old) {
+            old = expected;
+            return swapped = v.compare_exchange_strong(old, stored);
+        });
+        return swapped;
+    }
+
+    // links node, a volatile node that is never removed, into the list that starts at head
+    // unless the list has a node with its key. Returns the node of the list with the key
+    static Node<T, K> *linkFrom(Node<T, K> *head, Node<T, K> *node)
     {
-        auto curr = alloc->mem_chunks;
-        for (; curr != nullptr; curr = curr->next)
+        bool buffered = epochUtils::enabled;
+        uint64_t e = buffered ? epochUtils::enter() : 0;
+        Node<T, K> *pred, *currRef;
+        state currState;
+        while (true)
         {
-            PNode<T> *currChunk = static_cast<PNode<T> *>(curr->obj);
-            uint64_t numOfNodes = SSMEM_DEFAULT_MEM_SIZE / sizeof(PNode<T>);
-            for (uint64_t i = 0; i < numOfNodes; i++)
+            Node<T, K> *curr = buffered ? findBuffered(head, node->key, &pred, &currState, e)
+                                        : find(head, node->key, &pred, &currState);
+            currRef = softUtils::getRef<Node<T, K>>(curr);
+            if (hasKey(currRef, node->key))
+                break;
+            node->next.store(softUtils::createRef(currRef, state::INSERTED), std::memory_order_relaxed);
+            if (pred->next.compare_exchange_strong(curr, softUtils::createRef(node, softUtils::getState(curr))))
             {
-                PNode<T> *currNode = currChunk[i];
-                if (!currNode->isValid() || currNode->isDeleted()){
+                currRef = node;
+                break;
+            }
+        }
+        if (buffered)
+            epochUtils::exit();
+        return currRef;
+    }
+
+    std::string myName()
+    {
+        return "SOFT List";
+    }
+
+    typedef recoveryUtils::SortEntry<PNode<T, K>, K, Traits> Entry;
+
+    // rebuilds the list from the PNodes in the chunks of alloc, using numThreads threads
+    RecoveryStats recover(int numThreads = 1)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::vector<Entry>> valid(numThreads);
+        RecoveryStats stats = {0, collect(numThreads, valid), 0};
+
+        auto pnodes = recoveryUtils::gather(valid, numThreads);
+        recoveryUtils::parallelSort(pnodes, numThreads);
+        linkSorted(head, pnodes.data(), pnodes.size(), numThreads, allocRecoveredNodes(pnodes.size()));
+
+        stats.recovered = pnodes.size();
+        stats.seconds = recoveryUtils::secondsSince(start);
+        return stats;
+    }
+
+    // scans the chunks of alloc with numThreads threads: every thread adds the PNodes
+    // that are in the set to its vector in valid, and the rest are reclaimed with their
+    // keys. Returns the number of reclaimed PNodes
+    static uint64_t collect(int numThreads, std::vector<std::vector<Entry>> &valid)
+    {
+        auto chunks = recoveryUtils::getChunks(alloc);
+        std::vector<std::vector<PNode<T, K> *>> garbage(numThreads);
+        uint64_t persisted = epochUtils::persistedEpoch();
+
+        recoveryUtils::parallelRun(numThreads, [&](int tid) {
+            recoveryUtils::forEachSlot<PNode<T, K>>(chunks, tid, numThreads, [&](PNode<T, K> *currNode) {
+                // the node was never initialized, no need to free it or add it
+                if (!currNode->validStart.load() && !currNode->validEnd.load() && !currNode->deleted.load() &&
+                    Traits::equal(currNode->key, K()))
+                    return;
+                epochUtils::stamp_t insertStamp = currNode->insertStamp.load();
+                epochUtils::stamp_t deleteStamp = currNode->deleteStamp.load();
+                // a deletion of an epoch that was not persisted is undone
+                if (epochUtils::lost(deleteStamp, persisted))
+                {
+                    currNode->deleted = !currNode->validEnd.load();
+                    deleteStamp = 0;
+                }
+                if (!currNode->isValid() || currNode->isDeleted() || epochUtils::lost(insertStamp, persisted) ||
+                    deleteStamp != 0)
+                {
                     currNode->validStart = currNode->validEnd.load();
-                    ssmem_free(alloc, currNode);
+                    currNode->deleted = currNode->validEnd.load();
+                    garbage[tid].push_back(currNode);
                 }
                 else
-                    quickInsert(currNode);
-            }
+                    valid[tid].push_back({currNode->key, currNode});
+                // the stamps are cleared for the epochs that start after the recovery
+                if (insertStamp != 0 || currNode->deleteStamp.load() != 0)
+                {
+                    currNode->insertStamp.store(0, std::memory_order_relaxed);
+                    currNode->deleteStamp.store(0, std::memory_order_relaxed);
+                    FLUSH(currNode);
+                }
+            });
+            SFENCE();
+        });
+
+        // alloc is thread-local, so only this thread can free into it
+        uint64_t reclaimed = 0;
+        for (int tid = 0; tid < numThreads; tid++)
+        {
+            for (PNode<T, K> *n : garbage[tid])
+                ssmem_free(alloc, n);
+            reclaimed += garbage[tid].size();
         }
+        recoverRefs(numThreads);
+        return reclaimed;
+    }
+
+    // frees what the keys and the values of the PNodes that are not in the list refer to,
+    // once the recovery classified the PNodes
+    static void recoverRefs(int numThreads)
+    {
+        // the recovery left its garbage PNodes valid and deleted
+        auto inList = [](PNode<T, K> *n) { return n->isValid() && !n->isDeleted(); };
+        Traits::recover(numThreads, [&](void *owner, K &key) {
+            key = static_cast<PNode<T, K> *>(owner)->key;
+            return inList(static_cast<PNode<T, K> *>(owner));
+        });
+        ValueTraits<T>::recover(numThreads, [&](void *owner, T &value) {
+            value = static_cast<PNode<T, K> *>(owner)->value.load();
+            return inList(static_cast<PNode<T, K> *>(owner));
+        });
+    }
+
+    // room for the volatile nodes of n recovered keys, in one array so that they are
+    // laid out in key order
+    static Node<T, K> *allocRecoveredNodes(uint64_t n)
+    {
+        if (n == 0)
+            return nullptr;
+        size_t bytes = (n * sizeof(Node<T, K>) + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+        Node<T, K> *nodes = static_cast<Node<T, K> *>(aligned_alloc(CACHE_LINE_SIZE, bytes));
+        assert(nodes != nullptr);
+        return nodes;
+    }
+
+    // creates the volatile nodes of n PNodes, sorted by key, in nodes (room for n nodes)
+    // and links them into the empty list that starts at head in one pass
+    static void linkSorted(Node<T, K> *head, Entry *pnodes, uint64_t n, int numThreads, Node<T, K> *nodes)
+    {
+        Node<T, K> *max = head->next.load();
+        if (n == 0)
+            return;
+
+        recoveryUtils::parallelRun(numThreads, [&](int tid) {
+            uint64_t begin, end;
+            recoveryUtils::split(n, tid, numThreads, &begin, &end);
+            for (uint64_t i = begin; i < end; i++)
+            {
+                assert(i + 1 == n || Traits::less(pnodes[i].key, pnodes[i + 1].key));
+                PNode<T, K> *pnode = pnodes[i].node;
+                Node<T, K> *newNode = new (&nodes[i]) Node<T, K>(pnodes[i].key, pnode->value, pnode, pnode->recoveryValidity());
+                Node<T, K> *succ = i + 1 < n ? &nodes[i + 1] : max;
+                newNode->next.store(softUtils::createRef<Node<T, K>>(succ, state::INSERTED), std::memory_order_relaxed);
+            }
+        });
+        head->next.store(softUtils::createRef<Node<T, K>>(nodes, state::INSERTED));
     }
 
   private:
-    Node<T> *head;
+    Node<T, K> *head;
 };
 
 #endif
@@ -2,100 +2,231 @@
 #define SOFT_SKIP_LIST_H_
 
 #include <atomic>
+#include <new>
+#include <vector>
+#include <algorithm>
 #include <cstdlib>
 #include <cstdio>
 #include "rand_r_32.h"
 #include "utilities.h"
 #include "ssmem.h"
+#include "RecoveryUtils.h"
+#include "KeyTraits.h"
+#include "ValueTraits.h"
+#include "ScanUtils.h"
+#include "TowerUtils.h"
+#include "SOFTList.h"
 
 typedef softUtils::state state;
 
-template <class T>
+// A SOFT skip list: every key has a PNode in the pool (PNode.h), and the towers that link
+// the keys are volatile nodes, sized to their height (see TowerUtils.h) and rebuilt by the recovery. The state of a key
+// is in the bottom link of its tower, as in the SOFT list, so all the CAS are on DRAM
+template <class T, class K = intptr_t, class Traits = KeyTraits<K>>
 class SOFTSkipList
 {
 public:
 	class Node
 	{
 	public:
-		intptr_t key;
+		K key;
 		T value;
+		PNode<T, K> *pptr;
 		bool pValidity;
-		std::atomic<bool> validStart, validEnd, deleted;
+		// the value is in the PNode once it was updated, and the updates in flight flush it
+		std::atomic<bool> valueUpdated;
+		std::atomic<uchar> valueWriters;
 		uchar topLevel;
-		std::atomic<Node *> next[MAX_LEVEL];
+		// topLevel links, as many as the size class of the node holds
+		std::atomic<Node *> next[];
 
-		Node(intptr_t key = 0,
-			 uchar topLevel = 0) : key(key), pValidity(false), validStart(false),
-								   validEnd(false), deleted(false), topLevel(topLevel) {}
+		Node(K key = K(), uchar topLevel = 0, T value = T(), PNode<T, K> *pptr = nullptr,
+			 bool pValidity = false) : key(key), value(value), pptr(pptr), pValidity(pValidity), valueUpdated(false),
+									   valueWriters(0), topLevel(topLevel) {}
 
-		bool alloc()
+		// the PNode can be created by multiple threads. A batch waits for the flush later
+		void help(bool wait = true)
 		{
-			return !validStart.load();
+			pptr->create(pValidity, wait);
+			if (!wait)
+				FLUSH(pptr, FLUSH_SITE_SOFT_CREATE);
 		}
 
-		// a thread calls "create" privately
-		void create(intptr_t key, T value, uchar topLevel, bool validity)
+		void destroy(bool wait = true)
 		{
-			this->validStart.store(validity, std::memory_order_relaxed);
-			std::atomic_thread_fence(std::memory_order_release);
-			this->key = key;
-			this->value = value;
-			this->topLevel = topLevel;
-			this->pValidity = validity;
+			pptr->destroy(pValidity, wait);
+			if (!wait)
+				FLUSH(pptr, FLUSH_SITE_SOFT_DESTROY);
 		}
 
-		// help can be called by multiple threads
-		void help()
+		bool stateCAS(state expected, state newState)
 		{
-			this->validEnd.store(pValidity, std::memory_order_release);
-			BARRIER(this);
+			bool result = false;
+			while (!result && softUtils::getState(this->next[0].load()) == expected)
+				result = softUtils::stateCAS<Node>(this->next[0], expected, newState);
+			return result;
 		}
+	};
 
-		void destroy()
-		{
-			this->deleted.store(pValidity, std::memory_order_release);
-			BARRIER(this);
-		}
+private:
+	typedef SOFTList<T, K, Traits> List;
 
-		bool isValid()
-		{
-			return validStart.load() == validEnd.load() &&
-				   validEnd.load() != deleted.load();
-		}
+	static_assert(sizeof(Node) + MAX_LEVEL * sizeof(std::atomic<Node *>) <= towerUtils::MAX_TOWER, "the towers fit a class");
+
+	static size_t nodeSize(int topLevel)
+	{
+		return sizeof(Node) + topLevel * sizeof(std::atomic<Node *>);
+	}
+
+	// the sentinels are as high as a tower can be
+	static Node *newSentinel(K key)
+	{
+		void *mem = aligned_alloc(CACHE_LINE_SIZE, towerUtils::MAX_TOWER);
+		assert(mem != nullptr);
+		return new (mem) Node(key, MAX_LEVEL);
+	}
+
+	// the levels the searches start from: no node was linked above the highest tower so far
+	int height()
+	{
+		return maxLevel.load(std::memory_order_acquire);
+	}
+
+	void raiseHeight(int topLevel)
+	{
+		int h = maxLevel.load();
+		while (h < topLevel && !maxLevel.compare_exchange_weak(h, topLevel))
+			;
+	}
 
-		bool isDeleted()
+	// the levels of a search from head that are above h: only the links of the head
+	// can be there, so they are its predecessors and successors
+	void fillAbove(int h, Node **preds, Node **succs)
+	{
+		for (int i = h; i < MAX_LEVEL; i++)
 		{
-			return validStart.load() == validEnd.load() &&
-				   validEnd.load() == deleted.load();
+			preds[i] = head;
+			succs[i] = head->next[i].load();
 		}
+	}
 
-		bool stateCAS(state expected, state newState)
+	// the PNode is still deleted, so its contents are set before it is published
+	Node *allocNode(K key, T value, uchar topLevel)
+	{
+		PNode<T, K> *pnode = static_cast<PNode<T, K> *>(ssmem_alloc(alloc, sizeof(PNode<T, K>)));
+		Node *node = static_cast<Node *>(towerUtils::allocTower(false, nodeSize(topLevel)));
+		// the key and the value are kept by the PNode, and the volatile node shares them
+		key = Traits::store(key, pnode);
+		value = ValueTraits<T>::store(value, pnode);
+		new (node) Node(key, topLevel, value, pnode, pnode->alloc());
+		pnode->insertStamp.store(0, std::memory_order_relaxed);
+		pnode->deleteStamp.store(0, std::memory_order_relaxed);
+		pnode->init(key, value);
+		return node;
+	}
+
+	// frees a node that was in the list, or failed to get in, with its PNode and what its
+	// key and its value refer to. The value is taken out of the PNode, since an update that
+	// raced with the removal may still replace it (see writeValue)
+	static void freeNode(Node *n)
+	{
+		Traits::release(n->pptr->key);
+		if (ValueTraits<T>::outOfLine)
+			ValueTraits<T>::release(n->pptr->value.exchange(T()));
+		ssmem_free(alloc, n->pptr);
+		towerUtils::freeTower(false, n, nodeSize(n->topLevel));
+	}
+
+	// a value update is persistent before it returns, and a thread that reads the value
+	// while an update is in flight flushes it before it returns it. The value is read from
+	// the volatile node until the first update, which moves it to the PNode for good.
+	// update(v, stored, old) replaces v with stored, the value as the PNode keeps it, puts
+	// the value it replaced in old and returns whether it did. The value that is left out
+	// is released
+	template <class Update>
+	bool writeValue(Node *n, T value, Update update)
+	{
+		T stored = ValueTraits<T>::store(value, n->pptr), old = stored;
+		n->valueUpdated.store(true);
+		n->valueWriters.fetch_add(1);
+		bool changed = update(n->pptr->value, stored, old);
+		// a failed update returns the value of another update, which may not be persistent yet
+		if (changed || n->valueWriters.load() > 1)
+			BARRIER(n->pptr, FLUSH_SITE_VALUE);
+		n->valueWriters.fetch_sub(1);
+		// the removal of the node may have released its value before this update replaced it.
+		// The node is done with before the values are released, since a release lets the other
+		// threads reclaim it
+		T expected = stored;
+		bool orphaned = ValueTraits<T>::outOfLine && changed &&
+						softUtils::getState(n->next[0].load()) == state::DELETED &&
+						n->pptr->value.compare_exchange_strong(expected, T());
+		ValueTraits<T>::release(changed ? old : stored);
+		if (orphaned)
+			ValueTraits<T>::release(stored);
+		return changed;
+	}
+
+	static T readValue(Node *n)
+	{
+		if (LIKELY(!n->valueUpdated.load()))
+			return n->value;
+		T value = n->pptr->value.load();
+		if (UNLIKELY(n->valueWriters.load() != 0))
+			BARRIER(n->pptr, FLUSH_SITE_VALUE);
+		return value;
+	}
+
+	// applies update with value to the value of the node of key (see writeValue) and returns
+	// false if there is no such node. An update that races with the removal of the node
+	// takes effect right before it
+	template <class Update>
+	bool update(K key, T value, Update update)
+	{
+		Node *succs[MAX_LEVEL];
+		state succStates[MAX_LEVEL];
+		if (!findSuccsNoCleanup(key, succs, succStates))
+			return false;
+		Node *node = succs[0];
+		if (succStates[0] == state::INTEND_TO_INSERT)
 		{
-			bool result = false;
-			while (!result && softUtils::getState(this->next[0].load()) == expected)
-				result = softUtils::stateCAS<Node>(this->next[0], expected, newState);
-			return result;
+			node->help();
+			scans.write(key, [&]() { return node->stateCAS(state::INTEND_TO_INSERT, state::INSERTED); });
 		}
+		scans.write(key, [&]() { return writeValue(node, value, update); });
+		return true;
+	}
 
-	} __attribute__((aligned((64))));
+	// whether n, the first node of a search that is not smaller than key, has key. The tail
+	// has the largest key too (see KeyTraits.h), and it is the only node without a successor
+	static bool hasKey(Node *n, K key)
+	{
+		return Traits::equal(n->key, key) &&
+			   (LIKELY(!Traits::equal(key, Traits::max())) || softUtils::getRef<Node>(n->next[0].load()) != nullptr);
+	}
 
-private:
-	Node *allocNode(intptr_t key, T value, uchar toplevel)
+	// where a search of a batch goes on at level i from pred: finger, the predecessor of the
+	// previous key of the batch at that level, if it is further and was not deleted since
+	static Node *resume(Node *pred, Node *finger, int i)
 	{
-		Node *node = static_cast<Node *>(ssmem_alloc(alloc, sizeof(Node)));
-		node->create(key, value, toplevel, node->alloc());
-		return node;
+		return Traits::less(pred->key, finger->key) && softUtils::getState(finger->next[i].load()) != state::DELETED ? finger : pred;
 	}
 
-	bool find(intptr_t key, Node **preds, Node **succs, state *succStates)
+	// the searches start from fingers (see resume) if they have them, fingers may be preds
+	bool find(K key, Node **preds, Node **succs, state *succStates, Node **fingers = nullptr)
 	{
-		Node *pred, *predNext, *succ, *succNext;
+		Node *pred, *predNext, *succ = nullptr, *succNext;
 		state predState, succState;
 
 	retry:
 		pred = this->head;
-		for (int i = MAX_LEVEL - 1; i >= 0; i--)
+		int h = height();
+		if (preds != nullptr)
+			fillAbove(h, preds, succs);
+		for (int i = h - 1; i >= 0; i--)
 		{
+			if (fingers != nullptr)
+				pred = resume(pred, fingers[i], i);
 			predNext = pred->next[i].load();
 			predState = softUtils::getState(predNext);
 			predNext = softUtils::getRef<Node>(predNext);
@@ -114,7 +245,7 @@ private:
 					succState = softUtils::getState(succNext);
 					succNext = softUtils::getRef<Node>(succNext);
 				}
-				if (succ->key >= key)
+				if (!Traits::less(succ->key, key))
 					break;
 				pred = succ;
 				predState = succState;
@@ -134,17 +265,21 @@ private:
 			}
 		}
 
-		return succ->key == key;
+		return hasKey(succ, key);
 	}
 
-	bool findNoCleanup(intptr_t key, Node **preds, Node **succs, state *succStates)
+	bool findNoCleanup(K key, Node **preds, Node **succs, state *succStates, Node **fingers = nullptr)
 	{
-		Node *pred, *succ;
+		Node *pred, *succ = nullptr;
 		state predState, succState;
 
 		pred = this->head;
-		for (int i = MAX_LEVEL - 1; i >= 0; i--)
+		int h = height();
+		fillAbove(h, preds, succs);
+		for (int i = h - 1; i >= 0; i--)
 		{
+			if (fingers != nullptr)
+				pred = resume(pred, fingers[i], i);
 			succ = softUtils::getRef<Node>(pred->next[i].load());
 			predState = softUtils::getState(succ);
 			succ = softUtils::getRef<Node>(succ);
@@ -153,7 +288,7 @@ private:
 				succState = softUtils::getState(succ->next[i].load());
 				if (succState != state::DELETED)
 				{
-					if (succ->key >= key)
+					if (!Traits::less(succ->key, key))
 						break;
 					pred = succ;
 					predState = succState;
@@ -165,29 +300,26 @@ private:
 			succStates[i] = succState;
 		}
 
-		return succ->key == key;
+		return hasKey(succ, key);
 	}
 
-	bool findSuccsNoCleanup(intptr_t key, Node **succs, state *succStates)
+	bool findSuccsNoCleanup(K key, Node **succs, state *succStates)
 	{
-		Node *pred, *succ;
-		state predState, succState;
+		Node *pred, *succ = nullptr;
+		state succState;
 
 		pred = this->head;
-		for (int i = MAX_LEVEL - 1; i >= 0; i--)
+		for (int i = height() - 1; i >= 0; i--)
 		{
 			succ = softUtils::getRef<Node>(pred->next[i].load());
-			predState = softUtils::getState(succ);
-			succ = softUtils::getRef<Node>(succ);
 			while (true)
 			{
 				succState = softUtils::getState(succ->next[i].load());
 				if (succState != state::DELETED)
 				{
-					if (succ->key >= key)
+					if (!Traits::less(succ->key, key))
 						break;
 					pred = succ;
-					predState = succState;
 				}
 				succ = softUtils::getRef<Node>(succ->next[i].load());
 			}
@@ -195,7 +327,7 @@ private:
 			succStates[i] = succState;
 		}
 
-		return succ->key == key;
+		return hasKey(succ, key);
 	}
 
 	inline bool markNodes(Node *n)
@@ -216,43 +348,99 @@ private:
 		return n->stateCAS(state::INSERTED, state::INTEND_TO_DELETE); /* if I was the one that marked lvl 0 */
 	}
 
-public:
-	SOFTSkipList()
+	// a new node of key, intended to be inserted before succs, the successors of its search
+	Node *allocNodeBefore(K key, T value, Node **succs)
 	{
+		Node *newNode = allocNode(key, value, get_random_level());
+		raiseHeight(newNode->topLevel);
+		Node *succRef = softUtils::getRef<Node>(succs[0]);
+		newNode->next[0].store(softUtils::createRef<Node>(succRef, state::INTEND_TO_INSERT),
+							   std::memory_order_release);
+		for (int i = 1; i < newNode->topLevel; i++)
+		{
+			Node *currRef = softUtils::getRef<Node>(succs[i]);
+			newNode->next[i].store(softUtils::createRef<Node>(currRef, state::INSERTED),
+								   std::memory_order_release);
+		}
+		return newNode;
+	}
 
-		Node *min, *max;
-		max = new Node(INTPTR_MAX, MAX_LEVEL);
-		min = new Node(INTPTR_MIN, MAX_LEVEL);
-		for (int i = 0; i < MAX_LEVEL; i++)
+	// links the levels above 0 of newNode, an inserted node of key, between preds and succs
+	void linkLevels(Node *newNode, K key, Node **preds, Node **succs, state *succStates, Node **fingers)
+	{
+		Node *pred, *succ, *next;
+
+		for (int i = 1; i < newNode->topLevel; i++)
 		{
-			min->next[i].store(max, std::memory_order_release);
-			max->next[i].store(nullptr, std::memory_order_release);
+			while (true)
+			{
+				pred = preds[i];
+				succ = succs[i];
+				next = newNode->next[i].load();
+				if (softUtils::isOut(next))
+					return;
+
+				if (succ != next &&
+					!newNode->next[i].compare_exchange_strong(next, succ))
+				{
+					return;
+				}
+
+				if (pred->next[i].compare_exchange_strong(succ, newNode))
+					break;
+
+				find(key, preds, succs, succStates, fingers);
+			}
 		}
-		this->head = min;
 	}
 
-	bool contains(intptr_t key, int tid)
+	// contains with its search from fingers, which it moves to the predecessors of key
+	bool containsFrom(K key, Node **fingers)
 	{
 		Node *pred = this->head, *curr;
 
-		for (int i = MAX_LEVEL - 1; i >= 0; i--)
+		for (int i = height() - 1; i >= 0; i--)
 		{
+			if (fingers != nullptr)
+				pred = resume(pred, fingers[i], i);
 			curr = softUtils::getRef<Node>(pred->next[i].load());
-			while (curr->key < key || softUtils::isOut(curr->next[i].load()))
+			while (Traits::less(curr->key, key) || softUtils::isOut(curr->next[i].load()))
 			{
 				if (!softUtils::isOut(curr->next[i].load()))
 					pred = curr;
 				curr = softUtils::getRef<Node>(curr->next[i].load());
 			}
+			if (fingers != nullptr)
+				fingers[i] = pred;
 
 			// we found the right node
-			if (curr->key == key)
+			if (hasKey(curr, key))
 				return true;
 		}
 		return false;
 	}
 
-	bool remove(intptr_t key, int tid)
+public:
+	SOFTSkipList()
+	{
+
+		Node *min, *max;
+		max = newSentinel(Traits::max());
+		min = newSentinel(Traits::min());
+		for (int i = 0; i < MAX_LEVEL; i++)
+		{
+			min->next[i].store(max, std::memory_order_release);
+			max->next[i].store(nullptr, std::memory_order_release);
+		}
+		this->head = min;
+	}
+
+	bool contains(K key, int tid)
+	{
+		return containsFrom(key, nullptr);
+	}
+
+	bool remove(K key, int tid)
 	{
 		Node *succs[MAX_LEVEL];
 		state succStates[MAX_LEVEL];
@@ -268,24 +456,23 @@ public:
 		bool result = markNodes(node);
 
 		node->destroy();
-		node->stateCAS(state::INTEND_TO_DELETE, state::DELETED);
+		scans.write(key, [&]() { return node->stateCAS(state::INTEND_TO_DELETE, state::DELETED); });
 
 		if (result)
 		{
 			find(key, nullptr, nullptr, nullptr);
-			ssmem_free(alloc, node);
+			freeNode(node);
 			return true;
 		}
 
 		return false;
 	}
 
-	bool insert(intptr_t key, T value, int tid)
+	bool insert(K key, T value, int tid)
 	{
-		Node *newNode, *pred, *succ, *next;
+		Node *newNode;
 		Node *preds[MAX_LEVEL], *succs[MAX_LEVEL];
 		state succStates[MAX_LEVEL];
-		bool result;
 
 	retry:
 
@@ -296,58 +483,342 @@ public:
 				return false;
 			newNode = softUtils::getRef<Node>(succs[0]);
 			newNode->help();
-			newNode->stateCAS(state::INTEND_TO_INSERT, state::INSERTED);
+			scans.write(key, [&]() { return newNode->stateCAS(state::INTEND_TO_INSERT, state::INSERTED); });
 			return false;
 		}
-		newNode = allocNode(key, value, get_random_level());
-		Node *succRef = softUtils::getRef<Node>(succs[0]);
-		newNode->next[0].store(softUtils::createRef<Node>(succRef, state::INTEND_TO_INSERT),
-							   std::memory_order_release);
-		for (int i = 1; i < newNode->topLevel; i++)
-		{
-			Node *currRef = softUtils::getRef<Node>(succs[i]);
-			newNode->next[i].store(softUtils::createRef<Node>(currRef, state::INSERTED),
-								   std::memory_order_release);
-		}
+		newNode = allocNodeBefore(key, value, succs);
 
 		Node *after = softUtils::createRef<Node>(newNode, softUtils::getState(succs[0]));
 		if (!preds[0]->next[0].compare_exchange_strong(succs[0], after))
 		{
-			newNode->validStart.store(!newNode->pValidity);
-			ssmem_free(alloc, newNode);
+			freeNode(newNode);
 			goto retry;
 		}
 
 		newNode->help();
-		newNode->stateCAS(state::INTEND_TO_INSERT, state::INSERTED);
+		scans.write(key, [&]() { return newNode->stateCAS(state::INTEND_TO_INSERT, state::INSERTED); });
 
-		for (int i = 1; i < newNode->topLevel; i++)
+		linkLevels(newNode, key, preds, succs, succStates, nullptr);
+		return true;
+	}
+
+	// The batches run the operation of every key in key order, each search from the
+	// predecessors of the previous key, and flush the nodes they create or destroy with a
+	// single fence at the end. The nodes stay intended to be inserted or deleted until then,
+	// so that no other thread relies on them before they are persistent, and the nodes that
+	// the batch unlinked or failed to link are freed last, so that none of the nodes it holds
+	// is reused in between (see FlushBatch in LinkFree/utilities.h). Every operation is
+	// linearizable on its own, the batch is not atomic. They return how many of the
+	// operations succeeded
+
+	size_t insertBatch(std::vector<std::pair<K, T>> batch, int tid)
+	{
+		std::sort(batch.begin(), batch.end(),
+				  [](const std::pair<K, T> &a, const std::pair<K, T> &b) { return Traits::less(a.first, b.first); });
+		Node *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+		state succStates[MAX_LEVEL];
+		std::vector<std::pair<Node *, K>> created, helped;
+		std::vector<Node *> retired;
+		std::fill(preds, preds + MAX_LEVEL, head);
+		for (auto &item : batch)
 		{
 			while (true)
 			{
-				pred = preds[i];
-				succ = succs[i];
-				next = newNode->next[i].load();
-				if (softUtils::isOut(next))
+				bool found = findNoCleanup(item.first, preds, succs, succStates, preds);
+				if (found)
+				{
+					if (succStates[0] == state::INTEND_TO_INSERT)
+					{
+						softUtils::getRef<Node>(succs[0])->help(false);
+						helped.push_back({softUtils::getRef<Node>(succs[0]), item.first});
+					}
+					break;
+				}
+				// a search from a finger that was deleted meanwhile returns it as the predecessor
+				if (softUtils::getState(succs[0]) == state::DELETED)
+					continue;
+				Node *newNode = allocNodeBefore(item.first, item.second, succs);
+				Node *after = softUtils::createRef<Node>(newNode, softUtils::getState(succs[0]));
+				if (!preds[0]->next[0].compare_exchange_strong(succs[0], after))
+				{
+					retired.push_back(newNode);
+					continue;
+				}
+				newNode->help(false);
+				created.push_back({newNode, item.first});
+				break;
+			}
+		}
+		if (!created.empty() || !helped.empty())
+			SFENCE();
+		for (auto &h : helped)
+			scans.write(h.second, [&]() { return h.first->stateCAS(state::INTEND_TO_INSERT, state::INSERTED); });
+		std::fill(preds, preds + MAX_LEVEL, head);
+		for (auto &c : created)
+		{
+			scans.write(c.second, [&]() { return c.first->stateCAS(state::INTEND_TO_INSERT, state::INSERTED); });
+			findNoCleanup(c.second, preds, succs, succStates, preds);
+			linkLevels(c.first, c.second, preds, succs, succStates, preds);
+		}
+		for (Node *n : retired)
+			freeNode(n);
+		return created.size();
+	}
+
+	// moves the nodes of the keys to INTEND_TO_DELETE first, and to DELETED once their
+	// destruction is persistent
+	size_t removeBatch(std::vector<K> keys, int tid)
+	{
+		std::sort(keys.begin(), keys.end(), [](const K &a, const K &b) { return Traits::less(a, b); });
+		Node *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+		state succStates[MAX_LEVEL];
+		std::vector<std::pair<Node *, K>> destroyed;
+		std::vector<Node *> removed;
+		std::fill(preds, preds + MAX_LEVEL, head);
+		for (K &key : keys)
+		{
+			if (!findNoCleanup(key, preds, succs, succStates, preds) || softUtils::isOut(succStates[0]))
+				continue;
+			Node *node = softUtils::getRef<Node>(succs[0]);
+			if (markNodes(node))
+				removed.push_back(node);
+			node->destroy(false);
+			destroyed.push_back({node, key});
+		}
+		if (destroyed.empty())
+			return 0;
+		SFENCE();
+		for (auto &d : destroyed)
+			scans.write(d.second, [&]() { return d.first->stateCAS(state::INTEND_TO_DELETE, state::DELETED); });
+		std::fill(preds, preds + MAX_LEVEL, head);
+		for (Node *node : removed)
+			find(node->key, preds, succs, succStates, preds);
+		for (Node *node : removed)
+			freeNode(node);
+		return removed.size();
+	}
+
+	size_t containsBatch(std::vector<K> keys, int tid)
+	{
+		std::sort(keys.begin(), keys.end(), [](const K &a, const K &b) { return Traits::less(a, b); });
+		Node *preds[MAX_LEVEL];
+		std::fill(preds, preds + MAX_LEVEL, head);
+		size_t found = 0;
+		for (K &key : keys)
+			found += containsFrom(key, preds);
+		return found;
+	}
+
+	bool get(K key, T &value, int tid)
+	{
+		Node *pred = this->head, *curr;
+
+		for (int i = height() - 1; i >= 0; i--)
+		{
+			curr = softUtils::getRef<Node>(pred->next[i].load());
+			while (Traits::less(curr->key, key) || softUtils::isOut(curr->next[i].load()))
+			{
+				if (!softUtils::isOut(curr->next[i].load()))
+					pred = curr;
+				curr = softUtils::getRef<Node>(curr->next[i].load());
+			}
+
+			if (hasKey(curr, key))
+			{
+				// the node is checked after the value is read, so it was in the list when it was read
+				T currValue = readValue(curr);
+				if (softUtils::isOut(curr->next[0].load()))
+					return false;
+				value = currValue;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// sets the value of key, inserting it if it is not in the list. Returns whether it inserted key
+	bool upsert(K key, T value, int tid)
+	{
+		// a removal or an insertion of key may come in between, until one of the two finds
+		// key in the state it needs
+		while (true)
+		{
+			if (update(key, value, [](std::atomic<T> &v, T stored, T &old) {
+					old = v.exchange(stored);
 					return true;
+				}))
+				return false;
+			if (insert(key, value, tid))
+				return true;
+		}
+	}
 
-				if (succ != next &&
-					!newNode->next[i].compare_exchange_strong(next, succ))
+	// sets the value of key to desired if it is expected
+	bool compareAndSwapValue(K key, T expected, T desired, int tid)
+	{
+		bool swapped = false;
+		update(key, desired, [&](std::atomic<T> &v, T stored, T &old) {
+			old = expected;
+			return swapped = v.compare_exchange_strong(old, stored);
+		});
+		return swapped;
+	}
+
+	// walks the keys of level 0 in order. Like a contains, every key it stops at was in the
+	// list at some point since the iterator was made: the nodes that are still intended to be
+	// inserted are not in it yet, and the ones intended to be deleted still are. It never
+	// holds up the updates, and it is no snapshot: see scan for that
+	class Iterator
+	{
+	  public:
+		bool valid() const
+		{
+			return curr != nullptr;
+		}
+
+		const K &key() const
+		{
+			return curr->key;
+		}
+
+		T value() const
+		{
+			return currValue;
+		}
+
+		void next()
+		{
+			settle(softUtils::getRef<Node>(curr->next[0].load()));
+		}
+
+	  private:
+		friend class SOFTSkipList;
+
+		Node *curr;
+		T currValue;
+
+		Iterator(Node *start)
+		{
+			settle(start);
+		}
+
+		// moves to the first node from n on that is in the list, or past the end at the tail
+		void settle(Node *n)
+		{
+			for (;; n = softUtils::getRef<Node>(n->next[0].load()))
+			{
+				if (softUtils::getRef<Node>(n->next[0].load()) == nullptr)
 				{
-					return true;
+					curr = nullptr;
+					return;
 				}
+				// the node is checked after the value is read, as in get
+				T value = readValue(n);
+				if (softUtils::isOut(n->next[0].load()))
+					continue;
+				curr = n;
+				currValue = value;
+				return;
+			}
+		}
+	};
 
-				if (pred->next[i].compare_exchange_strong(succ, newNode))
-					break;
+	// an iterator at the first key that is not smaller than from
+	Iterator iterate(K from, int tid)
+	{
+		Node *succs[MAX_LEVEL];
+		state succStates[MAX_LEVEL];
+		findSuccsNoCleanup(from, succs, succStates);
+		return Iterator(succs[0]);
+	}
 
-				find(key, preds, succs, succStates);
-			}
+	// calls callback(key, value) for the keys from lo to hi in order, as they all were at one
+	// point during the scan, and returns how many there were. The scan collects the range
+	// again when an update of a key in it runs into it, and never holds up an update (see
+	// ScanUtils.h). The keys and the values are the ones of the nodes, as in get
+	template <class Callback>
+	size_t scan(K lo, K hi, Callback callback, int tid)
+	{
+		std::vector<std::pair<K, T>> entries;
+		scans.scan(lo, hi, [&]() {
+			entries.clear();
+			for (Iterator it = iterate(lo, tid); it.valid() && !Traits::less(hi, it.key()); it.next())
+				entries.emplace_back(it.key(), it.value());
+		});
+		for (auto &e : entries)
+			callback(e.first, e.second);
+		return entries.size();
+	}
+
+	typedef recoveryUtils::SortEntry<Node, K, Traits> Entry;
+
+	// rebuilds the skip list from the PNodes in the chunks of alloc, using numThreads
+	// threads. The towers are new: the heights follow the position of the key, so every
+	// level has every other key of the level below, and each takes the room of its class
+	RecoveryStats recover(int numThreads = 1)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::vector<typename List::Entry>> valid(numThreads);
+		RecoveryStats stats = {0, List::collect(numThreads, valid), 0};
+
+		auto pnodes = recoveryUtils::gather(valid, numThreads);
+		recoveryUtils::parallelSort(pnodes, numThreads);
+		uint64_t n = pnodes.size();
+		std::vector<Entry> towers(n);
+		std::vector<size_t> offsets(n + 1, 0);
+		int h = 1;
+		for (uint64_t i = 0; i < n; i++)
+		{
+			h = std::max(h, recoveredLevel(i));
+			offsets[i + 1] = offsets[i] + ssmem_class_size(nodeSize(recoveredLevel(i)));
 		}
-		return true;
+		char *nodes = allocRecoveredNodes(offsets[n]);
+		recoveryUtils::parallelRun(numThreads, [&](int tid) {
+			uint64_t begin, end;
+			recoveryUtils::split(n, tid, numThreads, &begin, &end);
+			for (uint64_t i = begin; i < end; i++)
+			{
+				PNode<T, K> *pnode = pnodes[i].node;
+				towers[i] = {pnodes[i].key, new (nodes + offsets[i]) Node(pnodes[i].key, recoveredLevel(i), pnode->value.load(),
+																		   pnode, pnode->recoveryValidity())};
+			}
+		});
+		Node *last = softUtils::getRef<Node>(head->next[0].load());
+		recoveryUtils::linkLevels(towers.data(), n, head, last, numThreads,
+								  [](Node *pred, int level, Node *succ) {
+									  pred->next[level].store(softUtils::createRef<Node>(succ, state::INSERTED),
+															  std::memory_order_relaxed);
+								  });
+
+		maxLevel.store(h);
+		stats.recovered = n;
+		stats.seconds = recoveryUtils::secondsSince(start);
+		return stats;
+	}
+
+	// the height of the tower of the i-th recovered key
+	static int recoveredLevel(uint64_t i)
+	{
+		return std::min(1 + __builtin_ctzll(i + 1), MAX_LEVEL);
+	}
+
+	// room for the towers of the recovered keys, of bytes in all, in one array so that they
+	// are laid out in key order
+	static char *allocRecoveredNodes(size_t bytes)
+	{
+		if (bytes == 0)
+			return nullptr;
+		bytes = (bytes + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+		char *nodes = static_cast<char *>(aligned_alloc(CACHE_LINE_SIZE, bytes));
+		assert(nodes != nullptr);
+		return nodes;
 	}
 
 private:
 	Node *head;
+	// the height of the highest tower so far, 1 at least, which never goes down
+	std::atomic<int> maxLevel{1};
+	scanUtils::RangeScans<K, Traits> scans;
 
 } __attribute__((aligned((64))));
 
@@ -0,0 +1,155 @@
+#ifndef _SOFT_SPLIT_HASH_TABLE_H_
+#define _SOFT_SPLIT_HASH_TABLE_H_
+
+#include "SOFTList.h"
+#include "utilities.h"
+#include "SplitOrderUtils.h"
+
+// A hash table that grows and shrinks with its keys: the SOFT list in split order
+// (see SplitOrderUtils.h). The dummies of the buckets are volatile nodes without a
+// PNode, so resizing never writes to the NVRAM
+template <class T, class K = intptr_t, class Traits = KeyTraits<K>>
+class SOFTSplitHashTable
+{
+    static_assert(Traits::uniqueHash, "split ordering tells the keys apart by their hash");
+    typedef splitOrderUtils::OrderKey OrderKey;
+
+  public:
+    typedef SOFTList<T, OrderKey> List;
+
+    SOFTSplitHashTable(uint64_t initialBuckets = 2) : directory(initialBuckets)
+    {
+        tail = new Node<T, OrderKey>(splitOrderUtils::OrderTraits::max(), T(), nullptr, false);
+        directory.set(0, newDummy(0, tail));
+    }
+
+    bool insert(K k, T item, int tid)
+    {
+        bool result = List::insertFrom(getBucket(k), orderKey(k), item);
+        if (result)
+            directory.count(tid, 1);
+        return result;
+    }
+
+    bool remove(K k, int tid)
+    {
+        bool result = List::removeFrom(getBucket(k), orderKey(k));
+        if (result)
+            directory.count(tid, -1);
+        return result;
+    }
+
+    bool contains(K k, int tid)
+    {
+        return List::containsFrom(getBucket(k), orderKey(k));
+    }
+
+    bool get(K k, T &value, int tid)
+    {
+        return List::getFrom(getBucket(k), orderKey(k), value);
+    }
+
+    bool upsert(K k, T item, int tid)
+    {
+        bool result = List::upsertFrom(getBucket(k), orderKey(k), item);
+        if (result)
+            directory.count(tid, 1);
+        return result;
+    }
+
+    bool compareAndSwapValue(K k, T expected, T desired, int tid)
+    {
+        return List::compareAndSwapValueFrom(getBucket(k), orderKey(k), expected, desired);
+    }
+
+    std::string myName()
+    {
+        return "SOFT Split Hash Table";
+    }
+
+    uint64_t buckets()
+    {
+        return directory.buckets();
+    }
+
+    // rebuilds the list from the PNodes in the chunks of alloc, with as many buckets as
+    // the recovered keys need: the PNodes are sorted in split order and their volatile
+    // nodes are linked together with a new dummy for every bucket, in parallel
+    RecoveryStats recover(int numThreads = 1)
+    {
+        typedef typename List::Entry Entry;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::vector<Entry>> valid(numThreads);
+        RecoveryStats stats = {0, List::collect(numThreads, valid), 0};
+
+        auto pnodes = recoveryUtils::gather(valid, numThreads);
+        recoveryUtils::parallelSort(pnodes, numThreads);
+        uint64_t size = splitOrderUtils::recoveredSize(pnodes.size(), directory.buckets());
+
+        // the volatile nodes of the PNodes, and the dummies of all the buckets but 0,
+        // which the constructor made
+        Node<T, OrderKey> *nodes = List::allocRecoveredNodes(pnodes.size() + size);
+        Node<T, OrderKey> *dummies = nodes + pnodes.size();
+        recoveryUtils::parallelRun(numThreads, [&](int tid) {
+            uint64_t begin, end;
+            recoveryUtils::split(pnodes.size(), tid, numThreads, &begin, &end);
+            for (uint64_t i = begin; i < end; i++)
+            {
+                PNode<T, OrderKey> *pnode = pnodes[i].node;
+                new (&nodes[i]) Node<T, OrderKey>(pnodes[i].key, pnode->value, pnode, pnode->recoveryValidity());
+            }
+            recoveryUtils::split(size, tid, numThreads, &begin, &end);
+            for (uint64_t b = std::max(begin, (uint64_t)1); b < end; b++)
+                directory.set(b, new (&dummies[b]) Node<T, OrderKey>(splitOrderUtils::dummyKey(b), T(), nullptr, false));
+        });
+        splitOrderUtils::linkSplitOrdered(
+            pnodes.data(), pnodes.size(), size, tail, numThreads, [&](uint64_t i) { return &nodes[i]; },
+            [&](uint64_t b) { return directory.get(b); },
+            [](Node<T, OrderKey> *pred, Node<T, OrderKey> *succ) {
+                pred->next.store(softUtils::createRef<Node<T, OrderKey>>(succ, state::INSERTED), std::memory_order_relaxed);
+            });
+        directory.reset(pnodes.size(), size);
+
+        stats.recovered = pnodes.size();
+        stats.seconds = recoveryUtils::secondsSince(start);
+        return stats;
+    }
+
+  private:
+    static Node<T, OrderKey> *newDummy(uint64_t bucket, Node<T, OrderKey> *next)
+    {
+        Node<T, OrderKey> *dummy = new Node<T, OrderKey>(splitOrderUtils::dummyKey(bucket), T(), nullptr, false);
+        dummy->next.store(softUtils::createRef<Node<T, OrderKey>>(next, state::INSERTED), std::memory_order_relaxed);
+        return dummy;
+    }
+
+    // the dummy of the bucket of k, which is linked after the dummy of its parent
+    // bucket if this is the first time the bucket is used
+    Node<T, OrderKey> *getBucket(K k)
+    {
+        return getDummy(directory.bucketOf(Traits::hash(k)));
+    }
+
+    static OrderKey orderKey(K k)
+    {
+        return splitOrderUtils::regularKey(Traits::hash(k));
+    }
+
+    Node<T, OrderKey> *getDummy(uint64_t bucket)
+    {
+        Node<T, OrderKey> *dummy = directory.get(bucket);
+        if (LIKELY(dummy != nullptr))
+            return dummy;
+        Node<T, OrderKey> *parent = getDummy(splitOrderUtils::parentOf(bucket));
+        Node<T, OrderKey> *newNode = new Node<T, OrderKey>(splitOrderUtils::dummyKey(bucket), T(), nullptr, false);
+        dummy = List::linkFrom(parent, newNode);
+        if (dummy != newNode)
+            delete newNode;
+        return directory.set(bucket, dummy);
+    }
+
+    splitOrderUtils::Buckets<Node<T, OrderKey>> directory;
+    Node<T, OrderKey> *tail;
+};
+
+#endif
@@ -4,17 +4,24 @@
 #include "PNode.h"
 #include <atomic>
 
-template <class T>
+template <class T, class K = intptr_t>
 class Node
 {
   public:
-	intptr_t key;
+	K key;
 	T value;
-	PNode<T> *pptr;
+	PNode<T, K> *pptr;
 	bool pValidity;
+	// the value is in the PNode once it was updated, and the updates in flight flush it
+	std::atomic<bool> valueUpdated;
+	std::atomic<uchar> valueWriters;
+	// copies of the stamps of pptr, the delete stamp is where removers claim the node
+	epochUtils::stamp_t insertStamp;
+	std::atomic<epochUtils::stamp_t> deleteStamp;
 	std::atomic<Node *> next;
 
-	Node(intptr_t key, T value, PNode<T> *pptr, bool pValidity) : key(key), value(value), pptr(pptr), pValidity(pValidity), next(nullptr) {}
+	Node(K key, T value, PNode<T, K> *pptr, bool pValidity) : key(key), value(value), pptr(pptr), pValidity(pValidity),
+																	valueUpdated(false), valueWriters(0), insertStamp(0), deleteStamp(0), next(nullptr) {}
 
 }; 
 
@@ -0,0 +1,31 @@
+#!/bin/bash
+
+	make -C ../ crash BUCKET_NUM=1024
+for algo in "LinkFreeList" "SOFTList" "LinkFreeUnrolledList" "LinkFreeHashTable" "SOFTHashTable" "LinkFreeSplitHashTable" "SOFTSplitHashTable" "LinkFreeSkipList" "SOFTSkipList"
+do
+	../crash -a $algo -p 8 -R 50 -M 1024 -C 5000 -K 20 || exit 1
+done
+
+# every cycle recovers and then starts more threads than ssmem has seen so far: run it under
+# AddressSanitizer, with blob values too (their slabs fill the size classes), and fail on any report.
+# A worker can be killed in the middle of its report, so the reports go to files rather than exit codes
+	make -C ../ clean
+	make -C ../ crash BUCKET_NUM=1024 VERSION=ASAN
+asanLogs=$(mktemp -d)
+for algo in "LinkFreeList" "SOFTList" "LinkFreeUnrolledList" "LinkFreeHashTable" "SOFTHashTable" "LinkFreeSplitHashTable" "SOFTSplitHashTable" "LinkFreeSkipList" "SOFTSkipList"
+do
+	for values in 0 64
+	do
+		# the unrolled list has no blob values
+		[ $algo = "LinkFreeUnrolledList" ] && [ $values -gt 0 ] && continue
+		ASAN_OPTIONS=log_path=$asanLogs/$algo:detect_leaks=0 ../crash -a $algo -p 4 -R 50 -M 1024 -C 200 -K 20 -v $values || exit 1
+		if ls $asanLogs/$algo.* > /dev/null 2>&1
+		then
+			echo "AddressSanitizer reports for $algo in $asanLogs"
+			exit 1
+		fi
+	done
+done
+rm -rf $asanLogs
+	make -C ../ clean
+	make -C ../ crash BUCKET_NUM=1024
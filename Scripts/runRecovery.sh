@@ -0,0 +1,21 @@
+#!/bin/bash
+
+	make -C ../ clean
+	make -C ../ list sl
+	make -C ../ hash BUCKET_NUM=1024
+for algo in "LinkFreeList" "SOFTList" "LinkFreeUnrolledList"
+do
+	../list -a $algo -p 32 -R 50 -M 4096 -d 5 -t 4 -r 1,2,4,8,16,32
+done
+for algo in "LinkFreeHashTable" "SOFTHashTable"
+do
+	../hash -a $algo -p 32 -R 50 -M 1048576 -d 5 -t 4 -r 1,2,4,8,16,32
+done
+for algo in "LinkFreeSkipList" "SOFTSkipList"
+do
+	../sl -a $algo -p 32 -R 50 -M 1048576 -d 5 -t 4 -r 1,2,4,8,16,32
+done
+
+rm -rf recovery
+mkdir -p recovery
+mv *.txt recovery/
@@ -6,7 +6,7 @@ for numberOfThreads in 64
 do
   	for lookup in 90
 	do
-   	for algo in "LinkFreeList" "SOFTList"
+   	for algo in "LinkFreeList" "SOFTList" "LinkFreeUnrolledList"
 		do
 		rm -f $algo-READS-$lookup-THREADS-$numberOfThreads.txt
       for keyRange in 16 64 256 1024 4096 16384
@@ -14,11 +14,20 @@
 #include <fstream>
 #include <pthread.h>
 #include <assert.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
 
 #include "rand_r_32.h"
 #include "ssmem.h"
 #include "barrier.h"
 #include "common.h"
+#include "RecoveryUtils.h"
+#include "EpochUtils.h"
+#include "StringKey.h"
+#include "Blob.h"
+#include "TopologyUtils.h"
 using namespace std;
 
 std::ofstream file;
@@ -27,11 +36,27 @@ __thread ssmem_allocator_t *alloc;
 static int NUM_THREADS = 1;
 static uint32_t DURATION = 5;
 static uint32_t RO_RATIO = 90;
-static uint32_t KEY_RANGE = 1024;
+static uint64_t KEY_RANGE = 1024;
+static bool SPREAD_KEYS = false;
+static uint32_t STRING_KEY_BYTES = 0; // 0 for integer keys
+static uint32_t VALUE_BYTES = 0;      // 0 for integer values
+static uint32_t SCAN_LENGTH = 0;      // 0 for point reads
+static uint32_t BATCH_SIZE = 1;       // keys per operation
+static double LEVEL_PROBABILITY = 0.5; // of every level of a skip-list tower above the first
+// LEVEL_PROBABILITY out of 256, for get_random_level
+static uint32_t LEVEL_THRESHOLD = 128;
+static uint64_t INITIAL_SIZE = 0; // 0 for half of the key range
 static uint32_t ITERATION = 1;
 static string ALG_NAME = "BucketList";
-static bool SanityMode = false;
 static int TEST_NUM = 1;
+static string POOL_PATH = "";
+static bool RECOVERED = false;
+static vector<int> RECOVERY_THREADS = {1, 2, 4, 8};
+static uint32_t CRASH_CYCLES = 1000;
+static uint32_t CRASH_DELAY = 50;
+static int BUFFERED_PERIOD = -1;
+static topologyUtils::placement_t PLACEMENT = topologyUtils::PLACE_LINEAR;
+static int NUMA_NODES = 1;
 barrier_t barrier_global;
 barrier_t init_barrier;
 
@@ -61,15 +86,31 @@ static void printHelp()
     cout << "  -p     thread num" << endl;
     cout << "  -d     duration" << endl;
     cout << "  -R     lookup ratio (0~100)" << endl;
-    cout << "  -M     key range" << endl;
+    cout << "  -M     key range (up to 2^64 - 1)" << endl;
+    cout << "  -i     keys inserted before the measurement (half of the key range by default)" << endl;
+    cout << "  -S     spread the keys of the range over the whole 64-bit key domain, like hashed IDs" << endl;
+    cout << "  -s     string keys of this many bytes (the bytes of the integer key repeated, its last ones if shorter than 8)" << endl;
+    cout << "  -v     blob values of this many bytes (the bytes of the integer value repeated)" << endl;
+    cout << "  -L     the reads scan the keys from a random key to this many above it (skip lists)" << endl;
+    cout << "  -b     the operations run on batches of this many random keys, and the throughput counts keys" << endl;
+    cout << "  -l     skip lists: the probability that a tower goes one level higher (0.5 by default)" << endl;
+    cout << "  -P     thread placement: linear (thread i on CPU i, by default), compact, scatter or nosmt" << endl;
+    cout << "  -H     pages of the memory chunks: small (by default), thp, 2mb or 1gb" << endl;
     cout << "  -I     iteration number" << endl;
-    cout << "  -t     test number" << endl;
+    cout << "  -t     test number (4 measures recovery, 5 growth)" << endl;
+    cout << "  -r     recovery thread counts for test 4 (e.g. 1,2,4,8)" << endl;
+    cout << "  -f     pool file (persistent nodes are kept in it and recovered on restart)" << endl;
+    cout << "  -F     flush policy: clflush, clflushopt, clwb, eadr or volatile (the best one the CPU has by default)" << endl;
+    cout << "  -E     NVM emulation: optane, none or flush,fence,write latencies in ns (none by default)" << endl;
+    cout << "  -B     buffered durability: milliseconds between the persisted epochs (strict durability by default)" << endl;
+    cout << "  -C     crash test: number of kill cycles" << endl;
+    cout << "  -K     crash test: max milliseconds before a kill" << endl;
 }
 
 static bool parseArgs(int argc, char **argv)
 {
     int c;
-    while ((c = getopt(argc, argv, "a:p:d:R:M:I:t:hc")) != -1)
+    while ((c = getopt(argc, argv, "a:p:d:R:M:I:t:f:r:C:K:F:E:B:Si:s:v:L:b:l:P:H:hc")) != -1)
     {
         switch (c)
         {
@@ -86,14 +127,105 @@ static bool parseArgs(int argc, char **argv)
             RO_RATIO = atoi(optarg);
             break;
         case 'M':
-            KEY_RANGE = atoi(optarg);
+            KEY_RANGE = strtoull(optarg, nullptr, 10);
             break;
+        case 'S':
+            SPREAD_KEYS = true;
+            break;
+        case 'i':
+            INITIAL_SIZE = strtoull(optarg, nullptr, 10);
+            break;
+        case 's':
+            STRING_KEY_BYTES = atoi(optarg);
+            if (STRING_KEY_BYTES > StringKey::MAX_LENGTH)
+            {
+                cout << "String keys have at most " << StringKey::MAX_LENGTH << " bytes" << endl;
+                return false;
+            }
+            break;
+        case 'v':
+            VALUE_BYTES = atoi(optarg);
+            if (VALUE_BYTES > Blob::MAX_LENGTH)
+            {
+                cout << "Blob values have at most " << Blob::MAX_LENGTH << " bytes" << endl;
+                return false;
+            }
+            break;
+        case 'L':
+            SCAN_LENGTH = atoi(optarg);
+            break;
+        case 'b':
+            BATCH_SIZE = std::max(atoi(optarg), 1);
+            break;
+        case 'l':
+            LEVEL_PROBABILITY = atof(optarg);
+            if (LEVEL_PROBABILITY <= 0 || LEVEL_PROBABILITY >= 1)
+            {
+                cout << "The level probability is between 0 and 1" << endl;
+                return false;
+            }
+            LEVEL_THRESHOLD = std::min(255, std::max(1, (int)(LEVEL_PROBABILITY * 256 + 0.5)));
+            break;
+        case 'P':
+            if (!topologyUtils::placementFromName(optarg, &PLACEMENT))
+            {
+                cout << "Unknown thread placement " << optarg << endl;
+                return false;
+            }
+            break;
+        case 'H':
+        {
+            int pages = SSMEM_PAGES_SMALL;
+            while (pages < SSMEM_PAGES_NUM && strcmp(optarg, ssmem_pages_name((ssmem_pages_t)pages)) != 0)
+                pages++;
+            if (pages == SSMEM_PAGES_NUM || ssmem_pages_set((ssmem_pages_t)pages) != 0)
+            {
+                cout << "Pages " << optarg << " are not supported" << endl;
+                return false;
+            }
+            break;
+        }
         case 'I':
             ITERATION = atoi(optarg);
             break;
         case 't':
             TEST_NUM = atoi(optarg);
             break;
+        case 'f':
+            POOL_PATH = string(optarg);
+            break;
+        case 'r':
+        {
+            RECOVERY_THREADS.clear();
+            char *save, *token = strtok_r(optarg, ",", &save);
+            for (; token != nullptr; token = strtok_r(nullptr, ",", &save))
+                RECOVERY_THREADS.push_back(atoi(token));
+            break;
+        }
+        case 'F':
+            flush_policy = flush_policy_from_name(optarg);
+            if (!flush_policy_supported(flush_policy))
+            {
+                cout << "Flush policy " << optarg << " is not supported" << endl;
+                return false;
+            }
+            break;
+        case 'E':
+            if (!flush_set_emulation(optarg))
+            {
+                cout << "Unknown NVM emulation " << optarg << endl;
+                return false;
+            }
+            break;
+        case 'B':
+            BUFFERED_PERIOD = atoi(optarg);
+            break;
+        case 'C':
+            CRASH_CYCLES = atoi(optarg);
+            break;
+        case 'K':
+            CRASH_DELAY = atoi(optarg);
+            break;
         case 'h':
             printHelp();
             return false;
@@ -101,6 +233,8 @@ static bool parseArgs(int argc, char **argv)
             return false;
         }
     }
+    // the chunks of the threads go to their nodes, before any allocator is made
+    NUMA_NODES = ssmem_numa_init(0);
     return true;
 }
 
@@ -108,6 +242,129 @@ static bool parseArgs(int argc, char **argv)
 template<class SET>
 void specificInit(int id);
 
+// the i-th key of the range: i, or with -S i times an odd constant, which maps the range
+// one to one onto keys all over the domain, up to the smallest and the largest key
+static inline intptr_t keyOf(uint64_t i)
+{
+    return SPREAD_KEYS ? (intptr_t)(i * 0xD6E8FEB86659FD93ULL) : (intptr_t)i;
+}
+
+// a random key of the range. rand_r_32 draws 31 bits, so a larger range takes more draws
+static inline intptr_t randomKey(uint32_t *seed)
+{
+    uint64_t r = rand_r_32(seed);
+    for (int bits = 31; bits < 64 && (KEY_RANGE - 1) >> bits != 0; bits += 31)
+        r = r << 31 | rand_r_32(seed);
+    return keyOf(r % KEY_RANGE);
+}
+
+// the key and the value types of a set
+template <class SET>
+struct setKey;
+
+template <class SET>
+struct setValue;
+
+template <template <class, class, class> class S, class T, class K, class Traits>
+struct setKey<S<T, K, Traits>>
+{
+    typedef K type;
+};
+
+template <template <class, class, class> class S, class T, class K, class Traits>
+struct setValue<S<T, K, Traits>>
+{
+    typedef T type;
+};
+
+// the key of a set with keys of type K for the integer key k
+template <class K>
+static inline K toKey(intptr_t k, int slot = 0)
+{
+    return k;
+}
+
+// the string of STRING_KEY_BYTES bytes that repeats the bytes of k, the most significant
+// first, so that the strings are in the order of the integers. It is kept in a buffer of
+// the thread until the next call with the same slot (a scan takes two, a batch one per key)
+template <>
+inline StringKey toKey<StringKey>(intptr_t k, int slot)
+{
+    static thread_local std::vector<char *> buffers;
+    while (UNLIKELY(buffers.size() <= (size_t)slot))
+        buffers.push_back(static_cast<char *>(malloc(std::max(STRING_KEY_BYTES, 1u))));
+    char *buffer = buffers[slot];
+    uint64_t word = __builtin_bswap64((uint64_t)k);
+    const char *bytes = reinterpret_cast<const char *>(&word);
+    size_t skip = STRING_KEY_BYTES < sizeof(word) ? sizeof(word) - STRING_KEY_BYTES : 0;
+    for (size_t i = 0; i < STRING_KEY_BYTES; i++)
+        buffer[i] = bytes[(skip + i) % sizeof(word)];
+    return StringKey(buffer, STRING_KEY_BYTES);
+}
+
+// the value of a set with values of type T for the integer value v
+template <class T>
+static inline T toValue(intptr_t v)
+{
+    return v;
+}
+
+// the integer value of a value of a set, the inverse of toValue
+template <class T>
+static inline intptr_t fromValue(const T &value)
+{
+    return value;
+}
+
+// the blob of VALUE_BYTES bytes that repeats the bytes of v. It is kept in a buffer of the
+// thread until a call with another value
+template <>
+inline Blob toValue<Blob>(intptr_t v)
+{
+    static __thread char *buffer = nullptr;
+    static __thread intptr_t bufferValue;
+    if (UNLIKELY(buffer == nullptr) || bufferValue != v)
+    {
+        if (buffer == nullptr)
+            buffer = static_cast<char *>(malloc(Blob::MAX_LENGTH));
+        for (size_t i = 0; i < VALUE_BYTES; i++)
+            buffer[i] = reinterpret_cast<const char *>(&v)[i % sizeof(v)];
+        bufferValue = v;
+    }
+    return Blob(buffer, VALUE_BYTES);
+}
+
+// 0, which is never a value, if the bytes of value do not repeat one value
+template <>
+inline intptr_t fromValue<Blob>(const Blob &value)
+{
+    intptr_t v = 0;
+    if (value.length() < sizeof(v))
+        return 0;
+    memcpy(&v, value.bytes(), sizeof(v));
+    for (size_t i = sizeof(v); i < value.length(); i++)
+    {
+        if (value.bytes()[i] != reinterpret_cast<const char *>(&v)[i % sizeof(v)])
+            return 0;
+    }
+    return v;
+}
+
+static inline void printRecovery(const RecoveryStats &stats)
+{
+    cout << "Recovered " << stats.recovered << " nodes (" << stats.reclaimed << " reclaimed) in ";
+    cout << stats.seconds << " s with " << NUM_THREADS << " threads" << endl;
+}
+
+static void initPersistentAlloc(int id, size_t size = SSMEM_DEFAULT_MEM_SIZE)
+{
+    alloc = (ssmem_allocator_t *)malloc(sizeof(ssmem_allocator_t));
+    if (ssmem_pool_is_open())
+        ssmem_alloc_init_pool(alloc, size, id);
+    else
+        ssmem_alloc_init(alloc, size, id);
+}
+
 //Throughput Measurements
 
 struct bench_ops_thread_arg_t
@@ -115,56 +372,204 @@ struct bench_ops_thread_arg_t
     uintptr_t tid;
     void *set;
     uint64_t ops;
+    flush_stats_t flushStats;
+    int64_t tlbMisses;
 };
 
+struct IgnoreScanned
+{
+    template <class K, class T>
+    void operator()(const K &key, const T &value) const
+    {
+    }
+};
+
+// scans the keys from k to SCAN_LENGTH - 1 above it, on the sets that scan
+template <class SET>
+static auto scanFrom(SET *set, intptr_t k, int id) -> decltype(set->scan(toKey<typename setKey<SET>::type>(k), toKey<typename setKey<SET>::type>(k), IgnoreScanned(), id))
+{
+    typedef typename setKey<SET>::type K;
+    intptr_t last = k > INTPTR_MAX - (intptr_t)(SCAN_LENGTH - 1) ? INTPTR_MAX : k + (intptr_t)(SCAN_LENGTH - 1);
+    return set->scan(toKey<K>(k, 0), toKey<K>(last, 1), IgnoreScanned(), id);
+}
+
+static inline size_t scanFrom(void *set, intptr_t k, int id)
+{
+    return 0;
+}
+
+// the batches of the sets that have them, and the operations one by one on the others
+template <class SET, class Batch>
+static auto insertBatchOf(SET *set, Batch &batch, int id, int) -> decltype(set->insertBatch(batch, id))
+{
+    return set->insertBatch(batch, id);
+}
+
+template <class SET, class Batch>
+static size_t insertBatchOf(SET *set, Batch &batch, int id, long)
+{
+    size_t inserted = 0;
+    for (auto &item : batch)
+        inserted += set->insert(item.first, item.second, id);
+    return inserted;
+}
+
+template <class SET, class Keys>
+static auto removeBatchOf(SET *set, Keys &keys, int id, int) -> decltype(set->removeBatch(keys, id))
+{
+    return set->removeBatch(keys, id);
+}
+
+template <class SET, class Keys>
+static size_t removeBatchOf(SET *set, Keys &keys, int id, long)
+{
+    size_t removed = 0;
+    for (auto &key : keys)
+        removed += set->remove(key, id);
+    return removed;
+}
+
+template <class SET, class Keys>
+static auto containsBatchOf(SET *set, Keys &keys, int id, int) -> decltype(set->containsBatch(keys, id))
+{
+    return set->containsBatch(keys, id);
+}
+
+template <class SET, class Keys>
+static size_t containsBatchOf(SET *set, Keys &keys, int id, long)
+{
+    size_t found = 0;
+    for (auto &key : keys)
+        found += set->contains(key, id);
+    return found;
+}
+
+// an operation of the workload on BATCH_SIZE random keys: a read if op is below cRatio, an
+// insertion if it is below iRatio and a removal otherwise
+template <class SET>
+static void benchBatch(SET *set, int op, int cRatio, int iRatio, uint32_t *seed, int id)
+{
+    typedef typename setKey<SET>::type K;
+    typedef typename setValue<SET>::type T;
+    static thread_local std::vector<K> keys;
+    static thread_local std::vector<std::pair<K, T>> items;
+    keys.clear();
+    items.clear();
+    if (op < cRatio && SCAN_LENGTH > 0)
+    {
+        for (uint32_t i = 0; i < BATCH_SIZE; i++)
+            scanFrom(set, randomKey(seed), id);
+    }
+    else if (op < cRatio || op >= iRatio)
+    {
+        for (uint32_t i = 0; i < BATCH_SIZE; i++)
+            keys.push_back(toKey<K>(randomKey(seed), i));
+        if (op < cRatio)
+            containsBatchOf(set, keys, id, 0);
+        else
+            removeBatchOf(set, keys, id, 0);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < BATCH_SIZE; i++)
+            items.push_back({toKey<K>(randomKey(seed), i), toValue<T>(id)});
+        insertBatchOf(set, items, id, 0);
+    }
+}
+
+// a counter of the data TLB misses of the loads of the calling thread in user mode, -1 if
+// the kernel does not count them (no PMU, as in most VMs, or perf_event_paranoid)
+static int openTlbCounter()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// the count of the counter, which is closed, -1 if there is none
+static int64_t readCounter(int fd)
+{
+    int64_t count = -1;
+    if (fd < 0)
+        return count;
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+        count = -1;
+    close(fd);
+    return count;
+}
+
 template <class SET>
 void benchOpsThread(bench_ops_thread_arg_t *arg)
 {
     int cRatio = RO_RATIO * 10;
     int iRatio = cRatio + (1000 - cRatio) / 2;
     int id = arg->tid;
-    set_cpu(id - 1);
+    int cpu = topologyUtils::cpuFor(PLACEMENT, id - 1);
+    set_cpu(cpu);
+    ssmem_numa_set_node(topologyUtils::nodeOf(cpu));
     uint32_t seed1 = id;
     uint32_t seed2 = seed1 + 1;
     specificInit<SET>(id);
 
-    alloc = (ssmem_allocator_t *)malloc(sizeof(ssmem_allocator_t));
-    ssmem_alloc_init(alloc, SSMEM_DEFAULT_MEM_SIZE, id);
+    initPersistentAlloc(id);
 
     barrier_cross(&init_barrier);
 
-    uint32_t num_elems_thread = (uint32_t)((KEY_RANGE / 2) / NUM_THREADS);
-    uint32_t missing = (uint32_t)(KEY_RANGE / 2) - (num_elems_thread * NUM_THREADS);
-    if (id <= missing)
+    uint64_t initialSize = INITIAL_SIZE != 0 ? std::min(INITIAL_SIZE, KEY_RANGE) : KEY_RANGE / 2;
+    uint64_t num_elems_thread = initialSize / NUM_THREADS;
+    uint64_t missing = initialSize - num_elems_thread * NUM_THREADS;
+    if ((uint64_t)id <= missing)
     {
         num_elems_thread++;
     }
 
     uint64_t ops = 0;
     SET *set = (SET *)arg->set;
+    typedef typename setKey<SET>::type K;
+    typedef typename setValue<SET>::type T;
 
-    for (int i = 0; i < (int64_t)num_elems_thread; i++)
+    // a recovered set is already populated
+    for (int64_t i = 0; i < (int64_t)num_elems_thread && !RECOVERED; i++)
     {
-        int key = rand_r_32(&seed2) % KEY_RANGE;
-        if (!set->insert(key, id, id))
+        K key = toKey<K>(randomKey(&seed2));
+        if (!set->insert(key, toValue<T>(id), id))
         {
             i--;
         }
     }
 
     barrier_cross(&barrier_global);
+    // only the flushes and the TLB misses of the measured operations
+    memset(&flush_stats, 0, sizeof(flush_stats));
+    int tlbCounter = openTlbCounter();
 
     while (!bench_stop)
     {
         int op = rand_r_32(&seed1) % 1000;
-        int key = rand_r_32(&seed2) % KEY_RANGE;
+        if (BATCH_SIZE > 1)
+        {
+            benchBatch(set, op, cRatio, iRatio, &seed2, id);
+            ops += BATCH_SIZE;
+            continue;
+        }
+        intptr_t k = randomKey(&seed2);
+        K key = toKey<K>(k);
         if (op < cRatio)
         {
-            set->contains(key, id);
+            if (SCAN_LENGTH > 0)
+                scanFrom(set, k, id);
+            else
+                set->contains(key, id);
         }
         else if (op < iRatio)
         {
-            set->insert(key, id, id);
+            set->insert(key, toValue<T>(id), id);
         }
         else
         {
@@ -173,30 +578,55 @@ void benchOpsThread(bench_ops_thread_arg_t *arg)
         ops++;
     }
     arg->ops = ops;
+    arg->flushStats = flush_stats;
+    arg->tlbMisses = readCounter(tlbCounter);
 }
 
-template <class SET>
-static void runBench()
+static void printFlushStats(const flush_stats_t &stats, uint64_t totalOps)
 {
-    SET *set = new SET();
-    if (ITERATION == 1)
+#if FLUSH_STATS
+    uint64_t flushes = 0, elided = 0;
+    for (int i = 0; i < FLUSH_SITE_NUM; i++)
     {
-        cout << "Running " << ALG_NAME << ": Reads " << RO_RATIO << " Key Range " << KEY_RANGE;
-        cout << " Num Threads " << NUM_THREADS << endl;
+        flushes += stats.flushes[i];
+        elided += stats.elided[i];
+    }
+    double ops = totalOps > 0 ? totalOps : 1;
+    cout << "Flushes " << flushes << " (" << flushes / ops << " per op), elided " << elided << " (" << elided / ops;
+    cout << " per op), fences " << stats.fences << " (" << stats.fences / ops << " per op), ";
+    cout << stats.cycles / ops << " flush cycles per op" << endl;
+    for (int i = 0; i < FLUSH_SITE_NUM; i++)
+    {
+        if (stats.flushes[i] == 0 && stats.elided[i] == 0)
+            continue;
+        cout << "  " << flush_site_name((flush_site_t)i) << ": " << stats.flushes[i] << " flushes (";
+        cout << stats.flushes[i] / ops << " per op), " << stats.elided[i] << " elided (" << stats.elided[i] / ops;
+        cout << " per op)" << endl;
     }
+#endif
+}
+
+static void printTlbMisses(int64_t misses, uint64_t totalOps)
+{
+    if (misses >= 0)
+        cout << "dTLB load misses " << misses << " (" << misses / (double)std::max(totalOps, (uint64_t)1) << " per op)" << endl;
+}
 
+// runs the workload on set with NUM_THREADS threads for DURATION seconds and
+// returns the number of operations, the flushes of all the threads in flushStats and
+// their dTLB load misses in tlbMisses (-1 if they are not counted)
+template <class SET>
+static uint64_t runWorkload(SET *set, flush_stats_t *flushStats = nullptr, int64_t *tlbMisses = nullptr)
+{
     barrier_init(&barrier_global, NUM_THREADS + 1);
     barrier_init(&init_barrier, NUM_THREADS);
 
-    alloc = (ssmem_allocator_t *)malloc(sizeof(ssmem_allocator_t));
-    ssmem_alloc_init(alloc, SSMEM_DEFAULT_MEM_SIZE, 0);
-
     bench_stop = false;
 
     thread *thrs[NUM_THREADS];
     bench_ops_thread_arg_t args[NUM_THREADS];
 
-    for (uint32_t j = 1; j < NUM_THREADS + 1; j++)
+    for (int j = 1; j < NUM_THREADS + 1; j++)
     {
         bench_ops_thread_arg_t &arg = args[j - 1];
         arg.tid = j;
@@ -212,17 +642,282 @@ static void runBench()
 
     bench_stop = true;
 
-    for (uint32_t j = 0; j < NUM_THREADS; j++)
+    for (int j = 0; j < NUM_THREADS; j++)
         thrs[j]->join();
 
     uint64_t totalOps = 0;
-    for (uint32_t j = 0; j < NUM_THREADS; j++)
+    if (flushStats != nullptr)
+        memset(flushStats, 0, sizeof(*flushStats));
+    if (tlbMisses != nullptr)
+        *tlbMisses = 0;
+    for (int j = 0; j < NUM_THREADS; j++)
     {
         totalOps += args[j].ops;
+        if (tlbMisses != nullptr)
+            *tlbMisses = args[j].tlbMisses < 0 || *tlbMisses < 0 ? -1 : *tlbMisses + args[j].tlbMisses;
+        if (flushStats == nullptr)
+            continue;
+        for (int i = 0; i < FLUSH_SITE_NUM; i++)
+        {
+            flushStats->flushes[i] += args[j].flushStats.flushes[i];
+            flushStats->elided[i] += args[j].flushStats.elided[i];
+        }
+        flushStats->fences += args[j].flushStats.fences;
+        flushStats->cycles += args[j].flushStats.cycles;
+    }
+    return totalOps;
+}
+
+// the time the contains of random keys take until one succeeds, -1 if the set is empty
+template <class SET>
+static double timeToFirstContains(SET *set, uint64_t size)
+{
+    typedef typename setKey<SET>::type K;
+    uint32_t seed = 1;
+    auto start = std::chrono::steady_clock::now();
+    while (size > 0 && !set->contains(toKey<K>(randomKey(&seed)), 0))
+        ;
+    return size > 0 ? recoveryUtils::secondsSince(start) : -1;
+}
+
+// starts the peak resident memory of the process (VmHWM) over from the current one,
+// returns false if the kernel does not let it
+static bool resetPeakRss()
+{
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    clearRefs.close();
+    return !clearRefs.fail();
+}
+
+// the peak resident memory of the process in KB, since the last resetPeakRss
+static long peakRssKb()
+{
+    std::ifstream status("/proc/self/status");
+    string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return strtol(line.c_str() + 6, nullptr, 10);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// recovers the pool with the given number of threads in a child process, which starts
+// from the state the crash left and takes whatever the recovery makes with it
+template <class SET>
+static void runRecovery(int threads)
+{
+    cout.flush();
+    file.flush();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(1);
+    }
+    if (pid > 0)
+    {
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            cout << "The recovery with " << threads << " threads failed" << endl;
+            exit(1);
+        }
+        return;
+    }
+
+    initPersistentAlloc(0);
+    ssmem_pool_adopt(alloc);
+    SET *set = new SET();
+
+    // the peak of this recovery, or of the whole process if it cannot be reset
+    bool ownPeak = resetPeakRss();
+    RecoveryStats stats = set->recover(threads);
+    double firstContains = timeToFirstContains(set, stats.recovered);
+    long peakKb = peakRssKb();
+
+    double keysPerSec = stats.recovered / stats.seconds;
+    cout << "Recovery Threads " << threads << ": " << stats.recovered << " keys in " << stats.seconds << " s (";
+    cout << keysPerSec << " keys/s), first contains in " << firstContains * 1000 << " ms, ";
+    cout << (ownPeak ? "peak RSS " : "process peak RSS ") << peakKb / 1024 << " MB" << endl;
+    file << "Recovery Threads: " << threads << endl;
+    file << keysPerSec << endl;
+    file.flush();
+    _exit(0);
+}
+
+// prefills the set and runs the workload on a pool, then drops the volatile
+// structure as a crash would and recovers the pool with every thread count of
+// RECOVERY_THREADS
+template <class SET>
+static void runRecoveryBench()
+{
+    string path = POOL_PATH.empty() ? "/tmp/recovery-bench-" + to_string(getpid()) + ".pool" : POOL_PATH;
+    if (ssmem_pool_open(path.c_str()) != 0)
+    {
+        cout << "The recovery test needs a new pool file" << endl;
+        exit(1);
     }
+    cout << "Recovering " << ALG_NAME << ": Reads " << RO_RATIO << " Key Range " << KEY_RANGE;
+    cout << " Num Threads " << NUM_THREADS;
+    if (ssmem_pages_get() != SSMEM_PAGES_SMALL)
+        cout << " Pages " << ssmem_pages_name(ssmem_pages_get());
+    cout << endl;
+
+    SET *set = new SET();
+    initPersistentAlloc(0);
+    uint64_t totalOps = runWorkload(set);
+    cout << "Throughput before the crash: " << totalOps / (DURATION * 1000.) << endl;
+    // the crash: only the pool is left
+    set = nullptr;
+
+    for (int threads : RECOVERY_THREADS)
+        runRecovery<SET>(threads);
+
+    ssmem_pool_close();
+    if (POOL_PATH.empty())
+        unlink(path.c_str());
+}
+
+// the buckets of a hash table, 0 for the sets without buckets
+template <class SET>
+static auto bucketCount(SET *set, int) -> decltype(set->buckets())
+{
+    return set->buckets();
+}
+
+template <class SET>
+static uint64_t bucketCount(SET *set, long)
+{
+    return 0;
+}
+
+// runs the workload on the same set with a key range that grows tenfold at every
+// step, up to 1000 times KEY_RANGE, to show how the set copes with growing
+template <class SET>
+static void runGrowthBench()
+{
+    cout << "Growing " << ALG_NAME << ": Reads " << RO_RATIO << " Key Range " << KEY_RANGE;
+    cout << " Num Threads " << NUM_THREADS << endl;
+
+    SET *set = new SET();
+    initPersistentAlloc(0);
+    uint64_t range = KEY_RANGE;
+    for (uint64_t factor = 1; factor <= 1000; factor *= 10)
+    {
+        KEY_RANGE = range * factor;
+        int64_t tlbMisses;
+        uint64_t totalOps = runWorkload(set, nullptr, &tlbMisses);
+        cout << "Key Range " << KEY_RANGE << ": " << totalOps / (DURATION * 1000.) << " ops/ms, ";
+        cout << bucketCount(set, 0) << " buckets";
+        if (tlbMisses >= 0)
+            cout << ", " << tlbMisses / (double)std::max(totalOps, (uint64_t)1) << " dTLB load misses per op";
+        cout << endl;
+        file << "Key Range: " << KEY_RANGE << endl;
+        file << totalOps / (DURATION * 1000.) << endl;
+    }
+    KEY_RANGE = range;
+}
+
+template <class SET>
+static void runBench()
+{
+    if (TEST_NUM == 4)
+    {
+        runRecoveryBench<SET>();
+        return;
+    }
+    if (TEST_NUM == 5)
+    {
+        runGrowthBench<SET>();
+        return;
+    }
+
+    SET *set = new SET();
+    if (ITERATION == 1)
+    {
+        cout << "Running " << ALG_NAME << ": Reads " << RO_RATIO << " Key Range " << KEY_RANGE;
+        cout << " Num Threads " << NUM_THREADS << " Flush " << flush_policy_name(flush_policy);
+        if (flush_emulation.flush_ns > 0 || flush_emulation.fence_ns > 0 || flush_emulation.write_ns > 0)
+        {
+            cout << " Emulating " << flush_emulation.flush_ns << "/" << flush_emulation.fence_ns << "/";
+            cout << flush_emulation.write_ns << " ns";
+        }
+        if (BUFFERED_PERIOD >= 0)
+            cout << " Buffered " << BUFFERED_PERIOD << " ms";
+        if (STRING_KEY_BYTES > 0)
+            cout << " Key Bytes " << STRING_KEY_BYTES;
+        if (VALUE_BYTES > 0)
+            cout << " Value Bytes " << VALUE_BYTES;
+        if (SCAN_LENGTH > 0)
+            cout << " Scan Length " << SCAN_LENGTH;
+        if (BATCH_SIZE > 1)
+            cout << " Batch " << BATCH_SIZE << " (per key)";
+        if (LEVEL_THRESHOLD != 128)
+            cout << " Level Probability " << LEVEL_PROBABILITY;
+        if (PLACEMENT != topologyUtils::PLACE_LINEAR)
+            cout << " Placement " << topologyUtils::PLACEMENT_NAMES[PLACEMENT];
+        if (NUMA_NODES > 1)
+            cout << " NUMA Nodes " << NUMA_NODES;
+        if (ssmem_pages_get() != SSMEM_PAGES_SMALL)
+            cout << " Pages " << ssmem_pages_name(ssmem_pages_get());
+        cout << endl;
+    }
+
+    int poolState = 0;
+    if (!POOL_PATH.empty())
+    {
+        poolState = ssmem_pool_open(POOL_PATH.c_str());
+        if (poolState < 0)
+            exit(1);
+    }
+    initPersistentAlloc(0);
+    if (poolState == 1)
+    {
+        // restart: walk the chunks of the previous run and rebuild the set
+        ssmem_pool_adopt(alloc);
+        printRecovery(set->recover(NUM_THREADS));
+        ssmem_pool_recovered();
+        RECOVERED = true;
+    }
+
+    if (BUFFERED_PERIOD >= 0)
+        epochUtils::start(BUFFERED_PERIOD);
+
+    flush_stats_t flushStats;
+    int64_t tlbMisses;
+    uint64_t totalOps = runWorkload(set, &flushStats, &tlbMisses);
+    epochUtils::stop();
 
     file << totalOps / (DURATION * 1000.) << endl;
     cout << totalOps / (DURATION * 1000.) << endl;
+    printTlbMisses(tlbMisses, totalOps);
+    printFlushStats(flushStats, totalOps);
+}
+
+// runs the benchmark on the set S with keys of type K and the values of the run: integers,
+// or blobs with -v
+template <template <class, class, class> class S, class K>
+static void runBenchWithValues()
+{
+    if (VALUE_BYTES > 0)
+        runBench<S<Blob, K, KeyTraits<K>>>();
+    else
+        runBench<S<intptr_t, K, KeyTraits<K>>>();
+}
+
+// and with the keys of the run: integers, or strings with -s
+template <template <class, class, class> class S>
+static void runBenchWithKeys()
+{
+    if (STRING_KEY_BYTES > 0)
+        runBenchWithValues<S, StringKey>();
+    else
+        runBenchWithValues<S, intptr_t>();
 }
 
 #endif
\ No newline at end of file
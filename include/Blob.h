@@ -0,0 +1,78 @@
+#ifndef _BLOB_
+#define _BLOB_
+
+#include <cassert>
+#include <stdint.h>
+#include "common.h"
+#include "ValueTraits.h"
+#include "SlabUtils.h"
+
+// Values of up to 64KB (documents, serialized records) kept out of the node. The node
+// holds a word: the address of the bytes with their length in the top 16 bits, so a value
+// update is still an exchange or a CAS of one word and the node stays on one line. A set
+// copies the bytes of a value to a durable slab of the node (see SlabUtils.h) before it
+// publishes the node or the update, and frees them once the value is replaced or removed,
+// so an insertion or an update flushes the slab and the line of the node.
+// A blob that a set returned refers to the slab of the set; compareAndSwapValue expects
+// such a blob, since it compares the words
+struct Blob
+{
+    static const size_t MAX_LENGTH = slabUtils::MAX_BYTES;
+
+    uintptr_t ref;
+
+    Blob() : ref(0) {}
+
+    // the value of the length bytes at bytes, which must stay there until a set stored it
+    Blob(const void *bytes, size_t length) : ref((uintptr_t)bytes | (uintptr_t)length << 48)
+    {
+        assert(length <= MAX_LENGTH);
+    }
+
+    const char *bytes() const
+    {
+        return reinterpret_cast<const char *>(ref & ((1ULL << 48) - 1));
+    }
+
+    size_t length() const
+    {
+        return ref >> 48;
+    }
+
+    bool operator==(const Blob &other) const
+    {
+        return ref == other.ref;
+    }
+};
+
+template <>
+struct ValueTraits<Blob>
+{
+    static const bool outOfLine = true;
+
+    static Blob store(const Blob &value, void *owner)
+    {
+        if (value.length() == 0)
+            return Blob();
+        char *bytes = slabUtils::store(POOL_KIND_VALUE_BLOBS, value.bytes(), value.length(), owner,
+                                       FLUSH_SITE_VALUE_BLOB);
+        return Blob(bytes, value.length());
+    }
+
+    static void release(const Blob &value)
+    {
+        if (value.length() > 0)
+            slabUtils::release(POOL_KIND_VALUE_BLOBS, value.bytes(), value.length());
+    }
+
+    template <class ValueOf>
+    static void recover(int numThreads, ValueOf valueOf)
+    {
+        slabUtils::recover(POOL_KIND_VALUE_BLOBS, numThreads, [&](void *owner, const char *bytes) {
+            Blob value;
+            return valueOf(owner, value) && value.length() > 0 && value.bytes() == bytes;
+        });
+    }
+};
+
+#endif
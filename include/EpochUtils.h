@@ -0,0 +1,273 @@
+#ifndef _EPOCH_UTILS_
+#define _EPOCH_UTILS_
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <stdint.h>
+#include "ssmem.h"
+#include "common.h"
+
+// the persistent allocator of the calling thread (defined by the benchmark)
+extern __thread ssmem_allocator_t *alloc;
+
+// Buffered durability: when it is on, the updates do not flush before they return.
+// Time is split into persistence epochs. An operation runs in the epoch it announced
+// when it started (enter), stamps the nodes it inserts or deletes with that epoch and
+// adds them to the dirty list of its thread. sync() closes the current epoch: it waits
+// for the operations of the epoch, flushes their nodes and persists the epoch number,
+// so a recovery keeps exactly the updates of the epochs up to the last persisted one.
+//
+// The stamps are 16 bits. sync() clears the stamps of an epoch once it is persisted
+// (insert stamps to 0, delete stamps to DELETED), so the only stamps in the nodes are
+// those of the last persisted epoch P and the two after it, and a stamp is of a lost
+// epoch exactly when it is the stamp of P + 1 or P + 2.
+//
+// An operation that sees a node stamped with a later epoch than its own restarts in
+// that epoch, so the updates of an epoch never depend on those of a later one. For the
+// same reason a deleted node stays linked until the operations of the epoch before its
+// deletion are done (see unlinkable), and it is freed only once its epoch is persisted.
+namespace epochUtils
+{
+
+typedef uint16_t stamp_t;
+
+// the delete stamp of a node whose deletion was persisted in an earlier epoch
+static const stamp_t DELETED = 0xFFFF;
+// the pool root that keeps the last persisted epoch
+static const int EPOCH_ROOT = 0;
+
+static inline stamp_t stampOf(uint64_t epoch)
+{
+    return epoch % (DELETED - 1) + 1;
+}
+
+struct DirtyEntry
+{
+    void *line;
+    std::atomic<stamp_t> *stamp; // cleared to clearTo once the epoch is persisted, if not null
+    stamp_t clearTo;
+};
+
+// a removed node, the epoch it was removed in, and what frees what its key refers to
+struct LimboEntry
+{
+    uint64_t epoch;
+    void *node;
+    void (*release)(void *);
+};
+
+struct ThreadState
+{
+    std::atomic<uint64_t> active; // the epoch of the running operation, 0 if none
+    int depth;
+    std::vector<DirtyEntry> dirty[2]; // by the parity of the epoch
+    std::deque<LimboEntry> limbo;
+    ThreadState *next;
+};
+
+static bool enabled = false;
+static std::atomic<uint64_t> epoch(1);
+static uint64_t volatilePersisted = 0;
+static std::atomic<uint64_t> quiesced(0); // the last epoch whose operations are all done
+static std::atomic<ThreadState *> threads(nullptr);
+static __thread ThreadState *self = nullptr;
+static std::mutex syncLock;
+static std::vector<DirtyEntry> cleared; // the stamps cleared by the last sync, flushed by the next one
+static std::thread syncThread;
+static std::atomic<bool> syncStop(false);
+
+static inline uint64_t *persistedRoot()
+{
+    uint64_t *root = ssmem_pool_root(EPOCH_ROOT);
+    return root != nullptr ? root : &volatilePersisted;
+}
+
+// the last epoch whose updates are persistent
+static inline uint64_t persistedEpoch()
+{
+    return *persistedRoot();
+}
+
+// is stamp of an epoch that was not persisted before the crash
+static inline bool lost(stamp_t stamp, uint64_t persisted)
+{
+    return stamp != 0 && (stamp == stampOf(persisted + 1) || stamp == stampOf(persisted + 2));
+}
+
+// is stamp of a later epoch than e
+static inline bool newer(stamp_t stamp, uint64_t e)
+{
+    return UNLIKELY(stamp == stampOf(e + 1)) && epoch.load() > e;
+}
+
+// can a node deleted with stamp be unlinked: an operation of an earlier epoch must
+// still see it, to restart instead of missing the deletion
+static inline bool unlinkable(stamp_t stamp)
+{
+    return stamp != stampOf(quiesced.load() + 2);
+}
+
+// an operation of epoch e can wait for the deletions of epoch e and before
+static inline void waitUnlinkable(stamp_t stamp)
+{
+    while (UNLIKELY(!unlinkable(stamp)))
+        std::this_thread::yield();
+}
+
+static inline ThreadState *threadState()
+{
+    if (UNLIKELY(self == nullptr))
+    {
+        self = new ThreadState();
+        self->active = 0;
+        self->depth = 0;
+        ThreadState *head = threads.load();
+        do
+            self->next = head;
+        while (!threads.compare_exchange_weak(head, self));
+    }
+    return self;
+}
+
+static inline uint64_t announce(ThreadState *t)
+{
+    uint64_t e = epoch.load();
+    while (true)
+    {
+        t->active.store(e);
+        uint64_t now = epoch.load();
+        if (now == e)
+            return e;
+        e = now;
+    }
+}
+
+// frees the removed nodes whose epoch is persisted
+static inline void reclaim(ThreadState *t)
+{
+    uint64_t persisted = persistedEpoch();
+    while (!t->limbo.empty() && t->limbo.front().epoch <= persisted)
+    {
+        LimboEntry &entry = t->limbo.front();
+        if (entry.release != nullptr)
+            entry.release(entry.node);
+        ssmem_free(alloc, entry.node);
+        t->limbo.pop_front();
+    }
+}
+
+// starts an operation and returns its epoch. Operations can be nested, the inner
+// ones run in the epoch of the outer one
+static inline uint64_t enter()
+{
+    ThreadState *t = threadState();
+    if (t->depth++ > 0)
+        return t->active.load(std::memory_order_relaxed);
+    uint64_t e = announce(t);
+    reclaim(t);
+    return e;
+}
+
+// moves the running operation to the current epoch, after it saw a later stamp
+static inline uint64_t restart()
+{
+    return announce(threadState());
+}
+
+static inline void exit()
+{
+    ThreadState *t = threadState();
+    if (--t->depth == 0)
+        t->active.store(0, std::memory_order_release);
+}
+
+// line has to be persisted at the end of epoch e; *stamp is cleared to clearTo after that
+static inline void dirty(uint64_t e, void *line, std::atomic<stamp_t> *stamp, stamp_t clearTo)
+{
+    threadState()->dirty[e & 1].push_back({line, stamp, clearTo});
+}
+
+// node was unlinked, it is freed once the current epoch is persisted, after release(node)
+static inline void retire(void *node, void (*release)(void *) = nullptr)
+{
+    threadState()->limbo.push_back({epoch.load(), node, release});
+}
+
+// closes the current epoch and returns when all of its updates are persistent
+static inline void sync()
+{
+    if (!enabled)
+        return;
+    std::lock_guard<std::mutex> guard(syncLock);
+    uint64_t e = epoch.fetch_add(1);
+    std::vector<DirtyEntry> done;
+    for (ThreadState *t = threads.load(); t != nullptr; t = t->next)
+    {
+        uint64_t active;
+        while ((active = t->active.load()) != 0 && active <= e)
+            std::this_thread::yield();
+        std::vector<DirtyEntry> &d = t->dirty[e & 1];
+        for (auto &entry : d)
+            FLUSH(entry.line, FLUSH_SITE_EPOCH);
+        done.insert(done.end(), d.begin(), d.end());
+        d.clear();
+    }
+    quiesced.store(e);
+    for (auto &entry : cleared)
+        FLUSH(entry.line, FLUSH_SITE_EPOCH);
+    SFENCE();
+
+    uint64_t *persisted = persistedRoot();
+    *persisted = e;
+    BARRIER(persisted, FLUSH_SITE_EPOCH);
+
+    stamp_t stamp = stampOf(e);
+    for (auto &entry : done)
+    {
+        stamp_t expected = stamp;
+        if (entry.stamp != nullptr)
+            entry.stamp->compare_exchange_strong(expected, entry.clearTo);
+    }
+    cleared.swap(done);
+}
+
+// turns buffered durability on, starting after the persisted epoch of the pool.
+// With periodMs > 0 a thread calls sync() every periodMs milliseconds
+static inline void start(int periodMs)
+{
+    quiesced.store(persistedEpoch());
+    epoch.store(persistedEpoch() + 1);
+    enabled = true;
+    if (periodMs <= 0)
+        return;
+    syncStop = false;
+    syncThread = std::thread([periodMs]() {
+        while (!syncStop.load())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(periodMs));
+            sync();
+        }
+    });
+}
+
+// persists everything and turns buffered durability off
+static inline void stop()
+{
+    if (!enabled)
+        return;
+    if (syncThread.joinable())
+    {
+        syncStop = true;
+        syncThread.join();
+    }
+    sync();
+    enabled = false;
+}
+
+} // namespace epochUtils
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef _KEY_TRAITS_
+#define _KEY_TRAITS_
+
+#include <limits>
+#include <type_traits>
+#include <stdint.h>
+
+// The keys of the sets. KeyTraits<K> tells a set how to order and hash keys of type K:
+//   min(), max()  the keys of the head and the tail sentinels
+//   less, equal   the order of the keys
+//   hash          64 bits whose top bits are spread well, for the hash tables
+//   uniqueHash    whether no two keys have the same hash, which split ordering needs
+//   store, release, recover
+//                 for the keys whose bytes are not all in the node (see StringKey.h)
+// The sentinels share their keys with the smallest and the largest key, so every key of
+// K can be in a set: the head is never compared, and the tail is told apart from a node
+// of the largest key since it is the only node without a successor
+template <class K, class Enable = void>
+struct KeyTraits;
+
+// the keys that are all in the node, which have nothing to store, release or recover
+template <class K>
+struct InlineKeyTraits
+{
+    // the key as the node owner keeps it, persistent once store returns. Called before the
+    // node is published
+    static K store(const K &key, void *owner)
+    {
+        return key;
+    }
+
+    // frees what the key of a node refers to, when the node is freed
+    static void release(const K &key)
+    {
+    }
+
+    // frees what the keys of the nodes that did not survive a crash refer to, once the
+    // recovery found the nodes that did: keyOf(owner, key) returns whether the node owner
+    // is in the set, and its key in key
+    template <class KeyOf>
+    static void recover(int numThreads, KeyOf keyOf)
+    {
+    }
+};
+
+// the integral keys, signed or unsigned, in their natural order
+template <class K>
+struct KeyTraits<K, typename std::enable_if<std::is_integral<K>::value>::type> : InlineKeyTraits<K>
+{
+    static const bool uniqueHash = sizeof(K) <= sizeof(uint64_t);
+
+    static K min()
+    {
+        return std::numeric_limits<K>::min();
+    }
+
+    static K max()
+    {
+        return std::numeric_limits<K>::max();
+    }
+
+    static bool less(K a, K b)
+    {
+        return a < b;
+    }
+
+    static bool equal(K a, K b)
+    {
+        return a == b;
+    }
+
+    // Fibonacci hashing (Knuth): k times 2^64 divided by the golden ratio, whose top bits
+    // pick the bucket. The keys of a range spread over the buckets almost evenly, and so
+    // do keys that share their low bits, which a mask or a modulo would put together.
+    // The multiplier is odd, so no two 64-bit keys have the same hash
+    static uint64_t hash(K k)
+    {
+        return (uint64_t)k * 0x9E3779B97F4A7C15ULL;
+    }
+};
+
+#endif
@@ -0,0 +1,268 @@
+#ifndef _RECOVERY_UTILS_
+#define _RECOVERY_UTILS_
+
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+#include "ssmem.h"
+#include "common.h"
+#include "KeyTraits.h"
+
+struct RecoveryStats
+{
+    uint64_t recovered; // nodes linked back into the set
+    uint64_t reclaimed; // nodes handed back to the allocator
+    double seconds;
+};
+
+namespace recoveryUtils
+{
+
+// the memory chunks that a recovery has to scan
+static inline std::vector<ssmem_list_t *> getChunks(ssmem_allocator_t *a)
+{
+    std::vector<ssmem_list_t *> chunks;
+    for (ssmem_list_t *curr = a->mem_chunks; curr != nullptr; curr = curr->next)
+        chunks.push_back(curr);
+    return chunks;
+}
+
+// the part [*begin, *end) of n items that thread tid (out of numThreads) handles
+static inline void split(uint64_t n, int tid, int numThreads, uint64_t *begin, uint64_t *end)
+{
+    *begin = n * tid / numThreads;
+    *end = n * (tid + 1) / numThreads;
+}
+
+// runs fn(tid) for tid = 0..numThreads-1, tid 0 on the calling thread
+template <class Fn>
+static inline void parallelRun(int numThreads, Fn fn)
+{
+    std::vector<std::thread> workers;
+    for (int tid = 1; tid < numThreads; tid++)
+        workers.emplace_back(fn, tid);
+    fn(0);
+    for (auto &w : workers)
+        w.join();
+}
+
+// calls fn(slot) for the slots of slotSize bytes that thread tid (out of numThreads)
+// owns. The slots of all the chunks are split evenly, so a few large chunks still keep
+// all the threads busy
+template <class Fn>
+static inline void forEachSlotOfSize(const std::vector<ssmem_list_t *> &chunks, size_t slotSize, int tid,
+                                     int numThreads, Fn fn)
+{
+    uint64_t total = 0;
+    for (auto chunk : chunks)
+        total += chunk->size / slotSize;
+
+    uint64_t begin, end, base = 0;
+    split(total, tid, numThreads, &begin, &end);
+    for (auto chunk : chunks)
+    {
+        uint64_t numOfSlots = chunk->size / slotSize;
+        if (base + numOfSlots > begin && base < end)
+        {
+            char *currChunk = static_cast<char *>(chunk->obj);
+            uint64_t first = begin > base ? begin - base : 0;
+            uint64_t last = end < base + numOfSlots ? end - base : numOfSlots;
+            for (uint64_t i = first; i < last; i++)
+                fn(static_cast<void *>(currChunk + i * slotSize));
+        }
+        base += numOfSlots;
+    }
+}
+
+// calls fn(node) for the slots of type Node that thread tid owns
+template <class Node, class Fn>
+static inline void forEachSlot(const std::vector<ssmem_list_t *> &chunks, int tid, int numThreads, Fn fn)
+{
+    forEachSlotOfSize(chunks, sizeof(Node), tid, numThreads, [&](void *slot) { fn(static_cast<Node *>(slot)); });
+}
+
+// calls fn(slot, size) for the objects of a sized allocator (see ssmem_alloc_sized) in the
+// segments that thread tid owns: every segment holds objects of one size, after its header.
+// The room after the last used object of a segment is skipped, see resumeSegments
+template <class Fn>
+static inline void forEachSizedSlot(const std::vector<ssmem_list_t *> &chunks, int tid, int numThreads, Fn fn)
+{
+    forEachSlotOfSize(chunks, SSMEM_SEGMENT_SIZE, tid, numThreads, [&](void *seg) {
+        size_t size = ssmem_segment_obj_size(seg);
+        if (size == 0)
+            return;
+        size_t used = ssmem_segment_used(seg);
+        for (size_t off = SSMEM_SEGMENT_HEADER; off + size <= used; off += size)
+            fn(static_cast<void *>(static_cast<char *>(seg) + off), size);
+    });
+}
+
+// hands the room after the used objects of every segment of the chunks to the allocator
+// that adopted them, which cuts its objects from there rather than from new segments
+static inline void resumeSegments(ssmem_allocator_t *a, const std::vector<ssmem_list_t *> &chunks)
+{
+    for (auto chunk : chunks)
+    {
+        for (size_t off = 0; off + SSMEM_SEGMENT_SIZE <= chunk->size; off += SSMEM_SEGMENT_SIZE)
+            ssmem_segment_resume(a, static_cast<char *>(chunk->obj) + off);
+    }
+}
+
+// a node that survived the crash, with its key next to it so that sorting does
+// not touch the nodes themselves
+template <class Node, class K = intptr_t, class Traits = KeyTraits<K>>
+struct SortEntry
+{
+    K key;
+    Node *node;
+
+    bool operator<(const SortEntry &other) const
+    {
+        return Traits::less(key, other.key);
+    }
+};
+
+// concatenates the per-thread vectors, each thread copying its own part
+template <class Item>
+static inline std::vector<Item> gather(std::vector<std::vector<Item>> &parts, int numThreads)
+{
+    std::vector<uint64_t> offsets(parts.size() + 1, 0);
+    for (size_t i = 0; i < parts.size(); i++)
+        offsets[i + 1] = offsets[i] + parts[i].size();
+
+    std::vector<Item> items(offsets.back());
+    parallelRun(numThreads, [&](int tid) {
+        for (size_t i = tid; i < parts.size(); i += numThreads)
+        {
+            std::copy(parts[i].begin(), parts[i].end(), items.begin() + offsets[i]);
+            std::vector<Item>().swap(parts[i]);
+        }
+    });
+    return items;
+}
+
+// groups the entries of all the threads by bucket with a counting sort. Bucket b
+// ends up in [offsets[b], offsets[b + 1]) of the returned vector
+template <class Item, class BucketOf>
+static inline std::vector<Item> partition(std::vector<std::vector<Item>> &parts, uint64_t numBuckets,
+                                          std::vector<uint64_t> &offsets, int numThreads, BucketOf bucketOf)
+{
+    int numParts = parts.size();
+    std::vector<uint64_t> positions(numParts * numBuckets, 0);
+    parallelRun(numThreads, [&](int tid) {
+        for (int p = tid; p < numParts; p += numThreads)
+            for (auto &item : parts[p])
+                positions[p * numBuckets + bucketOf(item)]++;
+    });
+
+    offsets.assign(numBuckets + 1, 0);
+    uint64_t total = 0;
+    for (uint64_t b = 0; b < numBuckets; b++)
+    {
+        offsets[b] = total;
+        for (int p = 0; p < numParts; p++)
+        {
+            uint64_t count = positions[p * numBuckets + b];
+            positions[p * numBuckets + b] = total;
+            total += count;
+        }
+    }
+    offsets[numBuckets] = total;
+
+    std::vector<Item> items(total);
+    parallelRun(numThreads, [&](int tid) {
+        for (int p = tid; p < numParts; p += numThreads)
+        {
+            for (auto &item : parts[p])
+                items[positions[p * numBuckets + bucketOf(item)]++] = item;
+            std::vector<Item>().swap(parts[p]);
+        }
+    });
+    return items;
+}
+
+// sorts numThreads slices in parallel and merges them pairwise, the merges of
+// each round in parallel
+template <class Item>
+static inline void parallelSort(std::vector<Item> &items, int numThreads)
+{
+    uint64_t n = items.size();
+    std::vector<uint64_t> bounds(numThreads + 1);
+    for (int i = 0; i <= numThreads; i++)
+        bounds[i] = n * i / numThreads;
+
+    parallelRun(numThreads, [&](int tid) {
+        std::sort(items.begin() + bounds[tid], items.begin() + bounds[tid + 1]);
+    });
+    if (numThreads == 1)
+        return;
+
+    std::vector<Item> buffer(n);
+    Item *src = items.data(), *dst = buffer.data();
+    for (int width = 1; width < numThreads; width *= 2)
+    {
+        int merges = (numThreads + 2 * width - 1) / (2 * width);
+        parallelRun(merges, [&](int m) {
+            int lo = 2 * width * m;
+            int mid = std::min(lo + width, numThreads);
+            int hi = std::min(lo + 2 * width, numThreads);
+            std::merge(src + bounds[lo], src + bounds[mid], src + bounds[mid], src + bounds[hi], dst + bounds[lo]);
+        });
+        std::swap(src, dst);
+    }
+    if (src != items.data())
+        items.swap(buffer);
+}
+
+// links n nodes, sorted by key, into every level of an empty skip list:
+// each thread links its part of the nodes level by level and the parts are
+// then chained together. link(pred, level, succ) sets pred->next[level]
+template <class Entry, class Node, class Link>
+static inline void linkLevels(Entry *nodes, uint64_t n, Node *head, Node *tail, int numThreads, Link link)
+{
+    std::vector<Node *> first(numThreads * MAX_LEVEL, nullptr), last(numThreads * MAX_LEVEL, nullptr);
+    parallelRun(numThreads, [&](int tid) {
+        Node **myFirst = &first[tid * MAX_LEVEL], **myLast = &last[tid * MAX_LEVEL];
+        uint64_t begin, end;
+        split(n, tid, numThreads, &begin, &end);
+        for (uint64_t i = begin; i < end; i++)
+        {
+            Node *node = nodes[i].node;
+            for (int l = 0; l < node->topLevel; l++)
+            {
+                if (myLast[l] != nullptr)
+                    link(myLast[l], l, node);
+                else
+                    myFirst[l] = node;
+                myLast[l] = node;
+            }
+        }
+    });
+
+    Node *preds[MAX_LEVEL];
+    for (int l = 0; l < MAX_LEVEL; l++)
+        preds[l] = head;
+    for (int tid = 0; tid < numThreads; tid++)
+    {
+        for (int l = 0; l < MAX_LEVEL; l++)
+        {
+            if (first[tid * MAX_LEVEL + l] == nullptr)
+                continue;
+            link(preds[l], l, first[tid * MAX_LEVEL + l]);
+            preds[l] = last[tid * MAX_LEVEL + l];
+        }
+    }
+    for (int l = 0; l < MAX_LEVEL; l++)
+        link(preds[l], l, tail);
+}
+
+static inline double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace recoveryUtils
+
+#endif
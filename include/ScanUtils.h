@@ -0,0 +1,143 @@
+#ifndef _SCAN_UTILS_
+#define _SCAN_UTILS_
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+#include "common.h"
+
+// Range scans that see the keys of a range as they all were at one point, next to
+// updates that never wait for them.
+// Every thread that updates a set brackets the step that changes it (the link of an
+// insertion, the mark of a removal, the write of a value) with its write sequence,
+// odd while the step runs, and after the step flags the scans whose range has its key.
+// A scan announces its range on the set, collects the range, waits for the steps that
+// are still running and checks that it was not flagged. A step that the collection saw
+// and that came after the announcement was flagged by then, so an unflagged collection
+// saw only steps from before the announcement and missed the later ones, and it is the
+// set as it was right before the first step it missed. A flagged scan collects again.
+// A scan waits for the steps in flight once more before it returns, so that no update
+// still compares its key with the bounds of the scan, which may refer to the bytes of
+// the caller (see StringKey.h).
+namespace scanUtils
+{
+
+struct Writer
+{
+    std::atomic<uint64_t> seq; // odd while the thread runs a step
+    Writer *next;
+} __attribute__((aligned((64))));
+
+static std::atomic<Writer *> writers(nullptr);
+static __thread Writer *self = nullptr;
+
+static inline Writer *writer()
+{
+    if (UNLIKELY(self == nullptr))
+    {
+        self = new Writer();
+        self->seq = 0;
+        Writer *head = writers.load();
+        do
+            self->next = head;
+        while (!writers.compare_exchange_weak(head, self));
+    }
+    return self;
+}
+
+// waits until the steps that run when it is called are done
+static inline void waitForSteps()
+{
+    std::vector<std::pair<Writer *, uint64_t>> running;
+    for (Writer *w = writers.load(); w != nullptr; w = w->next)
+    {
+        uint64_t seq = w->seq.load();
+        if (seq & 1)
+            running.push_back({w, seq});
+    }
+    for (auto &r : running)
+    {
+        while (r.first->seq.load() == r.second)
+            std::this_thread::yield();
+    }
+}
+
+// the scans of a set
+template <class K, class Traits>
+class RangeScans
+{
+    // the range of the scan of one thread, kept for its next scans
+    struct Range
+    {
+        K lo, hi;
+        std::atomic<bool> active, conflict;
+        Writer *owner;
+        Range *next;
+    };
+
+    std::atomic<Range *> ranges;
+
+    Range *rangeOf(Writer *w)
+    {
+        for (Range *r = ranges.load(); r != nullptr; r = r->next)
+        {
+            if (r->owner == w)
+                return r;
+        }
+        Range *r = new Range();
+        r->active = false;
+        r->conflict = false;
+        r->owner = w;
+        Range *head = ranges.load();
+        do
+            r->next = head;
+        while (!ranges.compare_exchange_weak(head, r));
+        return r;
+    }
+
+public:
+    RangeScans() : ranges(nullptr) {}
+
+    // runs step, which changes the set at key with a read-modify-write, and returns what
+    // it returns. The read-modify-write orders the write sequence before the check
+    template <class Step>
+    bool write(const K &key, Step step)
+    {
+        Writer *w = writer();
+        uint64_t seq = w->seq.load(std::memory_order_relaxed);
+        w->seq.store(seq + 1, std::memory_order_relaxed);
+        bool result = step();
+        for (Range *r = ranges.load(); r != nullptr; r = r->next)
+        {
+            if (r->active.load() && !Traits::less(key, r->lo) && !Traits::less(r->hi, key))
+                r->conflict.store(true);
+        }
+        w->seq.store(seq + 2, std::memory_order_release);
+        return result;
+    }
+
+    // calls collect until it runs with no step on a key from lo to hi
+    template <class Collect>
+    void scan(const K &lo, const K &hi, Collect collect)
+    {
+        Range *r = rangeOf(writer());
+        r->lo = lo;
+        r->hi = hi;
+        bool conflict;
+        do
+        {
+            r->conflict.store(false);
+            r->active.store(true);
+            collect();
+            waitForSteps();
+            conflict = r->conflict.load();
+            r->active.store(false);
+            waitForSteps();
+        } while (conflict);
+    }
+};
+
+} // namespace scanUtils
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef _SLAB_UTILS_
+#define _SLAB_UTILS_
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ssmem.h"
+#include "common.h"
+#include "RecoveryUtils.h"
+
+// Durable slabs for the bytes that do not fit in a node: the string keys (StringKey.h)
+// and the blob values (Blob.h). A slab keeps the node that owns it, so that its bytes are
+// valid exactly when the node is: the set stores the bytes before it publishes the node
+// or the value, releases them with the node or the value, and the recovery frees the
+// slabs that no recovered node refers to.
+// The slabs take the size classes of ssmem, 16 bytes to 64KB (see ssmem_alloc_sized), and
+// every base kind has one sized allocator in every thread, with its own chunks in the pool
+namespace slabUtils
+{
+
+struct Slab
+{
+    void *owner;
+    char bytes[];
+};
+
+static const size_t SLAB_CHUNK_SIZE = SSMEM_POOL_ALIGN;
+// the most bytes a slab takes
+static const size_t MAX_BYTES = SSMEM_CLASS_MAX - sizeof(Slab);
+
+// the allocators of the thread for every base kind of pool_kind_t but the nodes, made
+// when the thread stores its first bytes of the kind
+static __thread ssmem_allocator_t *slabAllocs[2];
+
+static inline ssmem_allocator_t *&allocOf(int base)
+{
+    return slabAllocs[base / POOL_KIND_KEY_SLABS - 1];
+}
+
+static inline ssmem_allocator_t *newSlabAlloc(int base)
+{
+    ssmem_allocator_t *a = (ssmem_allocator_t *)malloc(sizeof(ssmem_allocator_t));
+    if (ssmem_pool_is_open())
+        ssmem_alloc_init_pool_kind(a, SLAB_CHUNK_SIZE, 0, base);
+    else
+        ssmem_alloc_init(a, SLAB_CHUNK_SIZE, 0);
+    return allocOf(base) = a;
+}
+
+static inline ssmem_allocator_t *slabAlloc(int base)
+{
+    ssmem_allocator_t *a = allocOf(base);
+    return LIKELY(a != nullptr) ? a : newSlabAlloc(base);
+}
+
+// copies the length bytes at bytes to a new slab of owner, persists it and returns its
+// bytes. The fence keeps the owner from being valid in the NVRAM before the slab is
+static inline char *store(int base, const void *bytes, size_t length, void *owner, flush_site_t site)
+{
+    Slab *slab = static_cast<Slab *>(ssmem_alloc_sized(slabAlloc(base), sizeof(Slab) + length));
+    slab->owner = owner;
+    memcpy(slab->bytes, bytes, length);
+    uintptr_t line = (uintptr_t)slab & ~(uintptr_t)(CACHE_LINE_SIZE - 1);
+    for (; line < (uintptr_t)(slab->bytes + length); line += CACHE_LINE_SIZE)
+        FLUSH((void *)line, site);
+    SFENCE();
+    return slab->bytes;
+}
+
+// frees the slab of the length bytes at bytes, which store returned
+static inline void release(int base, const char *bytes, size_t length)
+{
+    Slab *slab = reinterpret_cast<Slab *>(const_cast<char *>(bytes) - offsetof(Slab, bytes));
+    ssmem_free_sized(slabAlloc(base), slab, sizeof(Slab) + length);
+}
+
+// walks the slabs of the base kind with numThreads threads and frees the ones that their
+// owner does not keep: refersTo(owner, bytes) returns whether the node owner is in the set
+// and refers to the slab of bytes. Like the nodes, they are freed into a new allocator of
+// this thread, which goes on with the partly used segments
+template <class RefersTo>
+static inline void recover(int base, int numThreads, RefersTo refersTo)
+{
+    if (!ssmem_pool_is_open() || ssmem_pool_kind_chunk_num(base) == 0)
+        return;
+    ssmem_allocator_t *a = newSlabAlloc(base);
+    ssmem_pool_adopt(a);
+    auto chunks = recoveryUtils::getChunks(a);
+    recoveryUtils::resumeSegments(a, chunks);
+    std::vector<std::vector<std::pair<Slab *, size_t>>> garbage(numThreads);
+
+    recoveryUtils::parallelRun(numThreads, [&](int tid) {
+        recoveryUtils::forEachSizedSlot(chunks, tid, numThreads, [&](void *slot, size_t size) {
+            Slab *slab = static_cast<Slab *>(slot);
+            // the slab was never used
+            if (slab->owner == nullptr)
+                return;
+            if (!refersTo(slab->owner, slab->bytes))
+                garbage[tid].push_back({slab, size});
+        });
+    });
+
+    for (int tid = 0; tid < numThreads; tid++)
+    {
+        for (auto &g : garbage[tid])
+            ssmem_free_sized(a, g.first, g.second);
+    }
+}
+
+} // namespace slabUtils
+
+#endif
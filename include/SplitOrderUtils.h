@@ -0,0 +1,279 @@
+#ifndef _SPLIT_ORDER_UTILS_
+#define _SPLIT_ORDER_UTILS_
+
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+#include "common.h"
+#include "RecoveryUtils.h"
+#include "KeyTraits.h"
+
+// Split-ordered hash tables (Shalev and Shavit): all the keys are in one sorted list,
+// ordered by their bit-reversed hash, and bucket b points to a dummy node that comes
+// right before the keys whose hash ends with the bits of b. Doubling the buckets only
+// splits every bucket in two by linking the dummies of the new buckets on demand, so
+// no key moves. The dummies and the bucket directory are volatile: the list nodes are
+// the only persistent state, and the recovery rebuilds the buckets for its size.
+// The list is sorted by the hash of the keys (KeyTraits), whose top bits are the best
+// ones, so the bucket of a key is its hash reversed, and the hash must be unique to the
+// key since the list tells the keys apart by it.
+namespace splitOrderUtils
+{
+
+static inline uint64_t reverse(uint64_t x)
+{
+    x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+    x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return __builtin_bswap64(x);
+}
+
+// the sort keys of the list. The dummy of a bucket has the smallest order of its bucket,
+// which a key may have as well, so the dummy is told apart by regular and comes first
+struct OrderKey
+{
+    uint64_t order;
+    bool regular;
+};
+
+static inline OrderKey regularKey(uint64_t hash)
+{
+    return {hash, true};
+}
+
+static inline OrderKey dummyKey(uint64_t bucket)
+{
+    return {reverse(bucket), false};
+}
+
+} // namespace splitOrderUtils
+
+template <>
+struct KeyTraits<splitOrderUtils::OrderKey> : InlineKeyTraits<splitOrderUtils::OrderKey>
+{
+    typedef splitOrderUtils::OrderKey OrderKey;
+    static const bool uniqueHash = true;
+
+    static OrderKey min()
+    {
+        return {0, false};
+    }
+
+    static OrderKey max()
+    {
+        return {UINT64_MAX, true};
+    }
+
+    // compared as one 65-bit number, which takes no branch
+    static bool less(const OrderKey &a, const OrderKey &b)
+    {
+        return wide(a) < wide(b);
+    }
+
+    static bool equal(const OrderKey &a, const OrderKey &b)
+    {
+        return ((a.order ^ b.order) | (uint64_t)(a.regular ^ b.regular)) == 0;
+    }
+
+    static uint64_t hash(const OrderKey &k)
+    {
+        return k.order;
+    }
+
+  private:
+    static unsigned __int128 wide(const OrderKey &k)
+    {
+        return ((unsigned __int128)k.order << 1) | k.regular;
+    }
+};
+
+namespace splitOrderUtils
+{
+
+typedef KeyTraits<OrderKey> OrderTraits;
+
+// average keys per bucket above which the buckets double, and below a quarter of
+// which they halve
+static const uint64_t LOAD_FACTOR = 2;
+static const int MAX_BUCKET_BITS = 32;
+
+// the bucket that bucket splits from: bucket without its top bit
+static inline uint64_t parentOf(uint64_t bucket)
+{
+    return bucket & ~(1ULL << (63 - __builtin_clzll(bucket)));
+}
+
+// the bucket with the rank-th smallest dummy key among the first size buckets
+static inline uint64_t bucketOfRank(uint64_t rank, uint64_t size)
+{
+    int bits = __builtin_ctzll(size);
+    return bits == 0 ? 0 : reverse(rank) >> (64 - bits);
+}
+
+// The dummies of the buckets, in segments that are allocated when the buckets
+// reach them: segment 0 holds bucket 0 and segment s > 0 the buckets [2^(s-1), 2^s)
+template <class Node>
+class Buckets
+{
+  public:
+    Buckets(uint64_t size) : size(size), minSize(size)
+    {
+        for (int s = 0; s <= MAX_BUCKET_BITS; s++)
+            segments[s].store(nullptr, std::memory_order_relaxed);
+        for (int i = 0; i < COUNTERS; i++)
+            counters[i].count.store(0, std::memory_order_relaxed);
+    }
+
+    // the dummy of bucket, nullptr if it is not linked yet
+    Node *get(uint64_t bucket)
+    {
+        std::atomic<Node *> *segment = segments[segmentOf(bucket)].load();
+        return segment == nullptr ? nullptr : segment[bucket - segmentStart(bucket)].load();
+    }
+
+    // sets the dummy of bucket and returns it, or the dummy that another thread set
+    Node *set(uint64_t bucket, Node *dummy)
+    {
+        int s = segmentOf(bucket);
+        std::atomic<Node *> *segment = segments[s].load();
+        if (UNLIKELY(segment == nullptr))
+        {
+            size_t entries = s == 0 ? 1 : 1ULL << (s - 1);
+            std::atomic<Node *> *newSegment = static_cast<std::atomic<Node *> *>(calloc(entries, sizeof(std::atomic<Node *>)));
+            if (segments[s].compare_exchange_strong(segment, newSegment))
+                segment = newSegment;
+            else
+                free(newSegment);
+        }
+        Node *expected = nullptr;
+        if (segment[bucket - segmentStart(bucket)].compare_exchange_strong(expected, dummy))
+            return dummy;
+        return expected;
+    }
+
+    // the bucket of a key with hash
+    uint64_t bucketOf(uint64_t hash)
+    {
+        return reverse(hash) & (size.load(std::memory_order_relaxed) - 1);
+    }
+
+    uint64_t buckets()
+    {
+        return size.load();
+    }
+
+    // counts an insertion (delta 1) or a removal (-1) of thread tid. Every thread
+    // has its own counter, and once in a while the counters are summed up to
+    // double or halve the buckets
+    void count(int tid, int delta)
+    {
+        Counter &counter = counters[tid & (COUNTERS - 1)];
+        int64_t local = counter.count.fetch_add(delta, std::memory_order_relaxed) + delta;
+        if (LIKELY(local % CHECK_PERIOD != 0))
+            return;
+        uint64_t keys = this->keys();
+        uint64_t curr = size.load();
+        if (keys > curr * LOAD_FACTOR && curr < (1ULL << MAX_BUCKET_BITS))
+            size.compare_exchange_strong(curr, curr * 2);
+        else if (keys < curr * LOAD_FACTOR / 4 && curr > minSize)
+            size.compare_exchange_strong(curr, curr / 2);
+    }
+
+    uint64_t keys()
+    {
+        int64_t keys = 0;
+        for (int i = 0; i < COUNTERS; i++)
+            keys += counters[i].count.load(std::memory_order_relaxed);
+        return keys > 0 ? keys : 0;
+    }
+
+    // the state after a recovery of keys keys into size buckets
+    void reset(uint64_t keys, uint64_t size)
+    {
+        for (int i = 0; i < COUNTERS; i++)
+            counters[i].count.store(0, std::memory_order_relaxed);
+        counters[0].count.store(keys);
+        this->size.store(size);
+    }
+
+  private:
+    static const int COUNTERS = 64;
+    static const int CHECK_PERIOD = 64;
+
+    struct Counter
+    {
+        std::atomic<int64_t> count;
+    } __attribute__((aligned((CACHE_LINE_SIZE))));
+
+    static int segmentOf(uint64_t bucket)
+    {
+        return bucket == 0 ? 0 : 64 - __builtin_clzll(bucket);
+    }
+
+    static uint64_t segmentStart(uint64_t bucket)
+    {
+        return bucket == 0 ? 0 : 1ULL << (63 - __builtin_clzll(bucket));
+    }
+
+    std::atomic<uint64_t> size;
+    uint64_t minSize;
+    std::atomic<std::atomic<Node *> *> segments[MAX_BUCKET_BITS + 1];
+    Counter counters[COUNTERS];
+};
+
+// the number of buckets for n recovered keys
+static inline uint64_t recoveredSize(uint64_t n, uint64_t minSize)
+{
+    uint64_t size = minSize;
+    while (n > size * LOAD_FACTOR && size < (1ULL << MAX_BUCKET_BITS))
+        size *= 2;
+    return size;
+}
+
+// links the n recovered nodes, sorted by their split-order keys, and the dummies of the
+// first size buckets into one list that ends at tail, with numThreads threads. Every
+// thread links the buckets of a range of dummy ranks. node(i) is the i-th recovered node,
+// dummy(b) is the dummy of bucket b and link(pred, succ) links succ after pred
+template <class Entry, class Node, class NodeOf, class DummyOf, class Link>
+static inline void linkSplitOrdered(Entry *nodes, uint64_t n, uint64_t size, Node *tail, int numThreads, NodeOf node,
+                                    DummyOf dummy, Link link)
+{
+    recoveryUtils::parallelRun(numThreads, [&](int tid) {
+        uint64_t begin, end;
+        recoveryUtils::split(size, tid, numThreads, &begin, &end);
+        if (begin == end)
+            return;
+        // the first recovered node after the dummy of rank begin
+        uint64_t lo = 0, hi = n;
+        OrderKey first = dummyKey(bucketOfRank(begin, size));
+        while (lo < hi)
+        {
+            uint64_t mid = (lo + hi) / 2;
+            if (OrderTraits::less(nodes[mid].key, first))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        uint64_t i = lo;
+        for (uint64_t rank = begin; rank < end; rank++)
+        {
+            Node *pred = dummy(bucketOfRank(rank, size));
+            bool last = rank + 1 == size;
+            OrderKey limit = last ? OrderTraits::max() : dummyKey(bucketOfRank(rank + 1, size));
+            // the last bucket takes the rest, a key may have the order of the tail
+            for (; i < n && (last || OrderTraits::less(nodes[i].key, limit)); i++)
+            {
+                link(pred, node(i));
+                pred = node(i);
+            }
+            if (last)
+                link(pred, tail);
+            else
+                link(pred, dummy(bucketOfRank(rank + 1, size)));
+        }
+    });
+}
+
+} // namespace splitOrderUtils
+
+#endif
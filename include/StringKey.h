@@ -0,0 +1,179 @@
+#ifndef _STRING_KEY_
+#define _STRING_KEY_
+
+#include <cassert>
+#include <stdint.h>
+#include <string.h>
+#include "common.h"
+#include "KeyTraits.h"
+#include "SlabUtils.h"
+
+// Byte-string keys (URLs, tenant IDs). A key is two words in the node: the first 7 bytes
+// with the length, on which most comparisons of a search end, and a pointer to the rest
+// of the bytes, which a stored key keeps in a durable slab of the pool (see SlabUtils.h):
+// a set copies them to a slab of the node before it publishes the node.
+// The keys are in the order of their bytes (the shorter first when one starts the other).
+// Their hash is not unique, so the split-ordered hash tables do not take them.
+struct StringKey
+{
+    static const size_t INLINE_BYTES = 7;
+    static const size_t MAX_LENGTH = 0xFFFF;
+
+    // the first 7 bytes big-endian, so that the words compare like the bytes, and the
+    // length in the low byte, 8 for all the longer keys. A key of up to 7 bytes is all here
+    uint64_t prefix;
+    // the address of the bytes after the first 7, with the length in the top 16 bits
+    // (user space addresses have 48 bits)
+    uintptr_t rest;
+
+    StringKey() : prefix(0), rest(0) {}
+
+    StringKey(uint64_t prefix, uintptr_t rest) : prefix(prefix), rest(rest) {}
+
+    // the key of the length bytes at bytes, which must stay there while the key is used:
+    // a set copies them when it stores the key
+    StringKey(const void *bytes, size_t length)
+    {
+        assert(length <= MAX_LENGTH);
+        const uchar *b = static_cast<const uchar *>(bytes);
+        rest = (uintptr_t)length << 48;
+        if (length > INLINE_BYTES)
+        {
+            uint64_t word;
+            memcpy(&word, b, sizeof(word));
+            prefix = (__builtin_bswap64(word) & ~0xFFULL) | (INLINE_BYTES + 1);
+            rest |= (uintptr_t)(b + INLINE_BYTES);
+            return;
+        }
+        prefix = length;
+        for (size_t i = 0; i < length; i++)
+            prefix |= (uint64_t)b[i] << (56 - 8 * i);
+    }
+
+    size_t length() const
+    {
+        return rest >> 48;
+    }
+
+    bool isInline() const
+    {
+        return (prefix & 0xFF) <= INLINE_BYTES;
+    }
+
+    const char *restBytes() const
+    {
+        return reinterpret_cast<const char *>(rest & ((1ULL << 48) - 1));
+    }
+
+    size_t restLength() const
+    {
+        return length() > INLINE_BYTES ? length() - INLINE_BYTES : 0;
+    }
+};
+
+namespace stringKeyUtils
+{
+
+static_assert(slabUtils::MAX_BYTES >= StringKey::MAX_LENGTH - StringKey::INLINE_BYTES, "a slab takes the longest key");
+
+// compares the bytes after the prefixes of two keys with the same prefix
+static inline int compareRest(const StringKey &a, const StringKey &b)
+{
+    size_t la = a.restLength(), lb = b.restLength();
+    size_t n = la < lb ? la : lb;
+    int c = n > 0 ? memcmp(a.restBytes(), b.restBytes(), n) : 0;
+    return c != 0 ? c : (la > lb) - (la < lb);
+}
+
+// copies the rest of key to a slab of owner
+static inline StringKey store(const StringKey &key, void *owner)
+{
+    if (key.isInline())
+        return key;
+    char *bytes = slabUtils::store(POOL_KIND_KEY_SLABS, key.restBytes(), key.restLength(), owner, FLUSH_SITE_KEY_SLAB);
+    return StringKey(key.prefix, (uintptr_t)bytes | (uintptr_t)key.length() << 48);
+}
+
+static inline void release(const StringKey &key)
+{
+    if (!key.isInline())
+        slabUtils::release(POOL_KIND_KEY_SLABS, key.restBytes(), key.restLength());
+}
+
+template <class KeyOf>
+static inline void recover(int numThreads, KeyOf keyOf)
+{
+    slabUtils::recover(POOL_KIND_KEY_SLABS, numThreads, [&](void *owner, const char *bytes) {
+        StringKey key;
+        return keyOf(owner, key) && !key.isInline() && key.restBytes() == bytes;
+    });
+}
+
+} // namespace stringKeyUtils
+
+template <>
+struct KeyTraits<StringKey>
+{
+    static const bool uniqueHash = false;
+
+    // the empty key
+    static StringKey min()
+    {
+        return StringKey();
+    }
+
+    // above all the keys, whose prefixes end with a length of at most 8
+    static StringKey max()
+    {
+        return StringKey(UINT64_MAX, 0);
+    }
+
+    static bool less(const StringKey &a, const StringKey &b)
+    {
+        if (LIKELY(a.prefix != b.prefix))
+            return a.prefix < b.prefix;
+        return !a.isInline() && stringKeyUtils::compareRest(a, b) < 0;
+    }
+
+    static bool equal(const StringKey &a, const StringKey &b)
+    {
+        return a.prefix == b.prefix && (a.isInline() || stringKeyUtils::compareRest(a, b) == 0);
+    }
+
+    // the words of the key folded together, with the top bits spread by a Fibonacci
+    // multiplication at the end
+    static uint64_t hash(const StringKey &k)
+    {
+        uint64_t h = k.prefix;
+        const char *p = k.restBytes();
+        for (size_t n = k.restLength(); n > 0;)
+        {
+            uint64_t word = 0;
+            size_t m = n < sizeof(word) ? n : sizeof(word);
+            memcpy(&word, p, m);
+            h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+            h ^= h >> 32;
+            p += m;
+            n -= m;
+        }
+        return h * 0x9E3779B97F4A7C15ULL;
+    }
+
+    static StringKey store(const StringKey &key, void *owner)
+    {
+        return stringKeyUtils::store(key, owner);
+    }
+
+    static void release(const StringKey &key)
+    {
+        stringKeyUtils::release(key);
+    }
+
+    template <class KeyOf>
+    static void recover(int numThreads, KeyOf keyOf)
+    {
+        stringKeyUtils::recover(numThreads, keyOf);
+    }
+};
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef _TOPOLOGY_UTILS_
+#define _TOPOLOGY_UTILS_
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <tuple>
+#include <string.h>
+#include <unistd.h>
+
+// Where the benchmark threads run. The CPUs are read from sysfs with their NUMA node,
+// package, core and rank among the hyperthreads of the core, and a placement policy
+// orders them: the i-th thread runs on the i-th CPU of the order
+namespace topologyUtils
+{
+
+enum placement_t
+{
+    PLACE_LINEAR,  // thread i on CPU i, the ids of the OS
+    PLACE_COMPACT, // the hyperthreads of a core, then the cores of a node, then the next node
+    PLACE_SCATTER, // one core of every node in turn, then the other hyperthreads
+    PLACE_NOSMT,   // as compact, on the first hyperthread of every core only
+    PLACE_NUM
+};
+
+static const char *const PLACEMENT_NAMES[PLACE_NUM] = {"linear", "compact", "scatter", "nosmt"};
+
+struct Cpu
+{
+    int id;
+    int node;
+    int package;
+    int core;
+    int smt;
+};
+
+// the numbers of a sysfs list such as 0-3,8,10-11
+static inline std::vector<int> parseList(const std::string &list)
+{
+    std::vector<int> ids;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ','))
+    {
+        int first, last;
+        int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (n < 1)
+            continue;
+        if (n == 1)
+            last = first;
+        for (int i = first; i <= last; i++)
+            ids.push_back(i);
+    }
+    return ids;
+}
+
+// the first line of a sysfs file, empty if there is none
+static inline std::string readLine(const std::string &path)
+{
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+static inline int readInt(const std::string &path, int otherwise)
+{
+    std::string line = readLine(path);
+    return line.empty() ? otherwise : atoi(line.c_str());
+}
+
+// the online CPUs, by id. Without sysfs every CPU is its own core of node 0
+static inline std::vector<Cpu> readCpus()
+{
+    std::vector<Cpu> cpus;
+    std::string online = readLine("/sys/devices/system/cpu/online");
+    std::vector<int> ids = parseList(online);
+    if (ids.empty())
+    {
+        for (int i = 0; i < sysconf(_SC_NPROCESSORS_ONLN); i++)
+            ids.push_back(i);
+    }
+    for (int id : ids)
+    {
+        std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/topology/";
+        std::vector<int> siblings = parseList(readLine(dir + "thread_siblings_list"));
+        int smt = std::find(siblings.begin(), siblings.end(), id) - siblings.begin();
+        cpus.push_back({id, 0, readInt(dir + "physical_package_id", 0), readInt(dir + "core_id", id),
+                        smt < (int)siblings.size() ? smt : 0});
+    }
+    for (int node : parseList(readLine("/sys/devices/system/node/online")))
+    {
+        std::string list = readLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        for (int id : parseList(list))
+        {
+            for (Cpu &cpu : cpus)
+            {
+                if (cpu.id == id)
+                    cpu.node = node;
+            }
+        }
+    }
+    return cpus;
+}
+
+static inline const std::vector<Cpu> &cpus()
+{
+    static const std::vector<Cpu> all = readCpus();
+    return all;
+}
+
+// the CPUs in the order of placement p
+static inline std::vector<Cpu> orderOf(placement_t p)
+{
+    std::vector<Cpu> order = cpus();
+    auto compact = [](const Cpu &a, const Cpu &b) {
+        return std::tie(a.node, a.package, a.core, a.smt, a.id) < std::tie(b.node, b.package, b.core, b.smt, b.id);
+    };
+    switch (p)
+    {
+    case PLACE_COMPACT:
+        std::sort(order.begin(), order.end(), compact);
+        break;
+    case PLACE_NOSMT:
+        order.erase(std::remove_if(order.begin(), order.end(), [](const Cpu &c) { return c.smt != 0; }),
+                    order.end());
+        std::sort(order.begin(), order.end(), compact);
+        break;
+    case PLACE_SCATTER:
+    {
+        // the rank of every CPU among the CPUs of its node with the same smt rank
+        std::sort(order.begin(), order.end(), compact);
+        std::vector<std::tuple<int, int, int, Cpu>> ranked;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            int rank = 0;
+            for (size_t j = 0; j < i; j++)
+                rank += order[j].node == order[i].node && order[j].smt == order[i].smt;
+            ranked.emplace_back(order[i].smt, rank, order[i].node, order[i]);
+        }
+        std::sort(ranked.begin(), ranked.end(), [](const std::tuple<int, int, int, Cpu> &a,
+                                                   const std::tuple<int, int, int, Cpu> &b) {
+            return std::tie(std::get<0>(a), std::get<1>(a), std::get<2>(a)) <
+                   std::tie(std::get<0>(b), std::get<1>(b), std::get<2>(b));
+        });
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = std::get<3>(ranked[i]);
+        break;
+    }
+    default:
+        break;
+    }
+    return order;
+}
+
+static inline bool placementFromName(const char *name, placement_t *p)
+{
+    for (int i = 0; i < PLACE_NUM; i++)
+    {
+        if (strcmp(name, PLACEMENT_NAMES[i]) == 0)
+        {
+            *p = (placement_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// the CPU of the i-th thread (from 0), with more threads than CPUs the order starts over.
+// The linear placement keeps the old pinning: CPU i, none past the last CPU
+static inline int cpuFor(placement_t p, int i)
+{
+    if (p == PLACE_LINEAR)
+        return i;
+    static const std::vector<Cpu> orders[PLACE_NUM] = {{}, orderOf(PLACE_COMPACT), orderOf(PLACE_SCATTER),
+                                                       orderOf(PLACE_NOSMT)};
+    const std::vector<Cpu> &order = orders[p];
+    return order.empty() ? i : order[i % order.size()].id;
+}
+
+// the NUMA node of the CPU, -1 if it is not online
+static inline int nodeOf(int cpu)
+{
+    for (const Cpu &c : cpus())
+    {
+        if (c.id == cpu)
+            return c.node;
+    }
+    return -1;
+}
+
+} // namespace topologyUtils
+
+#endif
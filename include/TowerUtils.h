@@ -0,0 +1,71 @@
+#ifndef _TOWER_UTILS_
+#define _TOWER_UTILS_
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "ssmem.h"
+#include "common.h"
+#include "RecoveryUtils.h"
+
+// Skip-list nodes sized to their towers: a node takes the smallest size class of ssmem
+// that holds its fields and its links (see ssmem_alloc_sized), so the many short towers
+// do not pay for MAX_LEVEL links. Every thread has one sized allocator for the durable
+// nodes, in the chunks of kind POOL_KIND_TOWERS of the pool, and one in DRAM for the
+// volatile towers
+namespace towerUtils
+{
+
+static const size_t TOWER_CHUNK_SIZE = SSMEM_POOL_ALIGN;
+// the most bytes a node takes
+static const size_t MAX_TOWER = 512;
+
+// the allocators of the thread, volatile and durable, made when the thread allocates its
+// first node
+static __thread ssmem_allocator_t *towerAllocs[2];
+
+static inline ssmem_allocator_t *newTowerAlloc(bool durable)
+{
+    ssmem_allocator_t *a = (ssmem_allocator_t *)malloc(sizeof(ssmem_allocator_t));
+    if (durable && ssmem_pool_is_open())
+        ssmem_alloc_init_pool_kind(a, TOWER_CHUNK_SIZE, 0, POOL_KIND_TOWERS);
+    else
+        ssmem_alloc_init(a, TOWER_CHUNK_SIZE, 0);
+    return towerAllocs[durable] = a;
+}
+
+static inline ssmem_allocator_t *towerAlloc(bool durable)
+{
+    ssmem_allocator_t *a = towerAllocs[durable];
+    return LIKELY(a != nullptr) ? a : newTowerAlloc(durable);
+}
+
+// a node of bytes bytes. The durable ones start on a cache line or within one
+static inline void *allocTower(bool durable, size_t bytes)
+{
+    return ssmem_alloc_sized(towerAlloc(durable), bytes);
+}
+
+static inline void freeTower(bool durable, void *node, size_t bytes)
+{
+    ssmem_free_sized(towerAlloc(durable), node, bytes);
+}
+
+// the chunks of the durable nodes in the pool, for the recovery. They are handed to a new
+// allocator of this thread, which takes the nodes the recovery frees and goes on with the
+// partly used segments
+static inline std::vector<ssmem_list_t *> adoptChunks()
+{
+    if (!ssmem_pool_is_open() || ssmem_pool_kind_chunk_num(POOL_KIND_TOWERS) == 0)
+        return {};
+    ssmem_allocator_t *a = newTowerAlloc(true);
+    ssmem_pool_adopt(a);
+    auto chunks = recoveryUtils::getChunks(a);
+    recoveryUtils::resumeSegments(a, chunks);
+    return chunks;
+}
+
+} // namespace towerUtils
+
+#endif
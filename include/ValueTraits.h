@@ -0,0 +1,35 @@
+#ifndef _VALUE_TRAITS_
+#define _VALUE_TRAITS_
+
+// The values of the sets, a word in the node that the sets read, swap and compare
+// atomically. ValueTraits<T> tells a set what a value of type T refers to outside the node:
+//   outOfLine whether it refers to anything
+//   store     the value as the node owner keeps it, persistent once store returns. Called
+//             before the node or the value update is published
+//   release   frees what a value refers to, once no node holds it
+//   recover   frees what the values of the nodes that did not survive a crash refer to,
+//             once the recovery found the nodes that did: valueOf(owner, value) returns
+//             whether the node owner is in the set, and its value in value
+// A value that is all in the word has nothing to store, release or recover (see Blob.h for
+// one that is not)
+template <class T>
+struct ValueTraits
+{
+    static const bool outOfLine = false;
+
+    static T store(const T &value, void *owner)
+    {
+        return value;
+    }
+
+    static void release(const T &value)
+    {
+    }
+
+    template <class ValueOf>
+    static void recover(int numThreads, ValueOf valueOf)
+    {
+    }
+};
+
+#endif
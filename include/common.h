@@ -5,6 +5,7 @@
 #include <stddef.h> //for null
 #include <climits>  //for max int
 #include <fstream>
+#include <stdint.h>
 
 #define compiler_fence std::atomic_thread_fence(std::memory_order_release)
 #define MFENCE __sync_synchronize
@@ -15,20 +16,165 @@
 
 typedef unsigned char uchar;
 
-static inline void FLUSH(void *p)
+// the smallest power of two that is at least n
+static inline uint64_t roundUpPow2(uint64_t n)
 {
-    asm volatile("clflush (%0)" ::"r"(p));
+    return n <= 1 ? 1 : 1ULL << (64 - __builtin_clzll(n - 1));
 }
 
+// how the persistent writes reach the persistence domain
+enum flush_policy_t
+{
+    FLUSH_POLICY_CLFLUSH,    // clflush: ordered, evicts the line
+    FLUSH_POLICY_CLFLUSHOPT, // clflushopt + sfence: unordered, evicts the line
+    FLUSH_POLICY_CLWB,       // clwb + sfence: unordered, may keep the line in the cache
+    FLUSH_POLICY_EADR,       // the caches are in the persistence domain (eADR), no flushes
+    FLUSH_POLICY_VOLATILE,   // no persistence at all, a baseline
+    FLUSH_POLICY_NUM
+};
+
+// set at startup to the best policy that the CPU supports (see flush.c)
+extern flush_policy_t flush_policy;
+
+flush_policy_t flush_detect_policy();
+bool flush_policy_supported(flush_policy_t policy);
+const char *flush_policy_name(flush_policy_t policy);
+// returns FLUSH_POLICY_NUM if name is not a policy
+flush_policy_t flush_policy_from_name(const char *name);
+
+// per-thread counts of the flushes and fences, compiled out with -DFLUSH_STATS=0
+#ifndef FLUSH_STATS
+#define FLUSH_STATS 1
+#endif
+
+// the call sites that flush, to tell where the flushes of an operation come from
+enum flush_site_t
+{
+    FLUSH_SITE_OTHER,
+    FLUSH_SITE_LINK_FREE_INSERT, // FLUSH_INSERT of the link-free structures
+    FLUSH_SITE_LINK_FREE_DELETE, // FLUSH_DELETE of the link-free structures
+    FLUSH_SITE_SOFT_CREATE,      // PNode::create
+    FLUSH_SITE_SOFT_DESTROY,     // PNode::destroy
+    FLUSH_SITE_ALLOC,            // new memory chunks of ssmem
+    FLUSH_SITE_POOL,             // the pool header
+    FLUSH_SITE_EPOCH,            // the sync of a persistence epoch (buffered durability)
+    FLUSH_SITE_VALUE,            // value updates, and the reads that see one in flight
+    FLUSH_SITE_KEY_SLAB,         // the out-of-line bytes of the string keys
+    FLUSH_SITE_VALUE_BLOB,       // the bytes of the blob values
+    FLUSH_SITE_LINK_FREE_REBUILD, // the splits and merges of the unrolled link-free list
+    FLUSH_SITE_NUM
+};
+
+// the kinds of the chunks of the persistent pool, so that every recovery walks its own
+enum pool_kind_t
+{
+    POOL_KIND_NODES = 0,        // the nodes of the sets (alloc)
+    POOL_KIND_KEY_SLABS = 16,   // the slabs of the string keys, in size classes (see ssmem_alloc_sized)
+    POOL_KIND_VALUE_BLOBS = 32, // the slabs of the blob values, likewise
+    POOL_KIND_TOWERS = 48,      // the link-free skip-list nodes, likewise
+};
+
+struct flush_stats_t
+{
+    uint64_t flushes[FLUSH_SITE_NUM]; // flush instructions issued
+    uint64_t elided[FLUSH_SITE_NUM];  // flushes skipped since another thread already did them
+    uint64_t fences;
+    uint64_t cycles; // spent in flushes and fences
+};
+
+extern __thread flush_stats_t flush_stats;
+
+const char *flush_site_name(flush_site_t site);
+
+// NVM emulation on DRAM: extra latency added to every flush and fence and to the first
+// write of every pool line (ssmem_alloc of new memory), all 0 unless flush_set_emulation is called
+struct flush_emulation_t
+{
+    uint32_t flush_ns, fence_ns, write_ns;
+    uint64_t flush_cycles, fence_cycles, write_cycles; // the same, in TSC cycles
+};
+
+extern flush_emulation_t flush_emulation;
+
+// spec is a preset ("none", "optane") or "flush_ns,fence_ns,write_ns"; returns false if it
+// cannot be parsed. Calibrates the TSC against the clock on its first use
+bool flush_set_emulation(const char *spec);
+
+static inline void flush_spin(uint64_t cycles)
+{
+    if (LIKELY(cycles == 0))
+        return;
+    uint64_t start = __builtin_ia32_rdtsc();
+    while (__builtin_ia32_rdtsc() - start < cycles)
+        __builtin_ia32_pause();
+}
+
+// size bytes of pool memory are written for the first time
+static inline void flush_emulate_write(size_t size)
+{
+    flush_spin(flush_emulation.write_cycles * ((size + 63) / 64));
+}
+
+static inline void flush_elided(flush_site_t site)
+{
+#if FLUSH_STATS
+    flush_stats.elided[site]++;
+#endif
+}
+
+// starts writing back the line of p; it is persistent only after the next SFENCE
+static inline void FLUSH(void *p, flush_site_t site = FLUSH_SITE_OTHER)
+{
+    if (flush_policy >= FLUSH_POLICY_EADR)
+        return;
+#if FLUSH_STATS
+    uint64_t start = __builtin_ia32_rdtsc();
+#endif
+    switch (flush_policy)
+    {
+    case FLUSH_POLICY_CLFLUSH:
+        asm volatile("clflush (%0)" ::"r"(p));
+        break;
+    case FLUSH_POLICY_CLFLUSHOPT:
+        asm volatile("clflushopt (%0)" ::"r"(p));
+        break;
+    case FLUSH_POLICY_CLWB:
+        asm volatile("clwb (%0)" ::"r"(p));
+        break;
+    default:
+        break;
+    }
+    flush_spin(flush_emulation.flush_cycles);
+#if FLUSH_STATS
+    flush_stats.flushes[site]++;
+    flush_stats.cycles += __builtin_ia32_rdtsc() - start;
+#endif
+}
+
+// waits for the preceding FLUSHes; clflush is ordered with the later stores already. The
+// emulated fence latency is taken with every policy, since it stands for the NVM itself
 static inline void SFENCE()
 {
-    asm volatile("sfence" ::
-                     : "memory");
+    bool fence = flush_policy == FLUSH_POLICY_CLFLUSHOPT || flush_policy == FLUSH_POLICY_CLWB;
+    if (!fence && LIKELY(flush_emulation.fence_cycles == 0))
+        return;
+#if FLUSH_STATS
+    uint64_t start = __builtin_ia32_rdtsc();
+#endif
+    if (fence)
+        asm volatile("sfence" ::
+                         : "memory");
+    flush_spin(flush_emulation.fence_cycles);
+#if FLUSH_STATS
+    flush_stats.fences += fence;
+    flush_stats.cycles += __builtin_ia32_rdtsc() - start;
+#endif
 }
 
-static inline void BARRIER(void *p)
+static inline void BARRIER(void *p, flush_site_t site = FLUSH_SITE_OTHER)
 {
-    FLUSH(p);
+    FLUSH(p, site);
+    SFENCE();
 }
 
 #endif
\ No newline at end of file
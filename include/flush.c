@@ -0,0 +1,146 @@
+/*
+ *   File: flush.c
+ *   Description: picks the flush instructions (see FLUSH in common.h) from
+ *                what the CPU supports
+ */
+
+#include "common.h"
+#include <cpuid.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+static const char *flush_policy_names[FLUSH_POLICY_NUM] = {
+	"clflush", "clflushopt", "clwb", "eadr", "volatile"};
+
+static const char *flush_site_names[FLUSH_SITE_NUM] = {
+	"other", "link-free insert", "link-free delete", "SOFT create", "SOFT destroy", "alloc", "pool", "epoch sync", "value", "key slab", "value blob", "link-free rebuild"};
+
+flush_policy_t flush_policy = flush_detect_policy();
+
+__thread flush_stats_t flush_stats;
+
+flush_emulation_t flush_emulation = {0, 0, 0, 0, 0, 0};
+
+/* flush, fence and first write latencies (ns) added on top of DRAM */
+static const struct
+{
+	const char *name;
+	uint32_t flush_ns, fence_ns, write_ns;
+} flush_emulation_presets[] = {
+	{"none", 0, 0, 0},
+	/* first generation Optane DC PMM: a write back to the ADR domain of the memory controller
+	   costs ~100ns more than to DRAM, and a line that is written for the first time is read
+	   from the media (~300ns against ~80ns) */
+	{"optane", 100, 50, 220},
+};
+
+/*
+ * clflush is on every x86-64 CPU, clflushopt and clwb are reported by leaf 7
+ */
+bool flush_policy_supported(flush_policy_t policy)
+{
+	unsigned int eax, ebx = 0, ecx, edx;
+	switch (policy)
+	{
+	case FLUSH_POLICY_CLFLUSHOPT:
+		return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_CLFLUSHOPT);
+	case FLUSH_POLICY_CLWB:
+		return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_CLWB);
+	case FLUSH_POLICY_NUM:
+		return false;
+	default:
+		return true;
+	}
+}
+
+/*
+ * the cheapest flush that persists the line: clwb does not have to evict it
+ */
+flush_policy_t flush_detect_policy()
+{
+	if (flush_policy_supported(FLUSH_POLICY_CLWB))
+	{
+		return FLUSH_POLICY_CLWB;
+	}
+	if (flush_policy_supported(FLUSH_POLICY_CLFLUSHOPT))
+	{
+		return FLUSH_POLICY_CLFLUSHOPT;
+	}
+	return FLUSH_POLICY_CLFLUSH;
+}
+
+const char *flush_policy_name(flush_policy_t policy)
+{
+	return policy < FLUSH_POLICY_NUM ? flush_policy_names[policy] : "unknown";
+}
+
+flush_policy_t flush_policy_from_name(const char *name)
+{
+	for (int i = 0; i < FLUSH_POLICY_NUM; i++)
+	{
+		if (strcmp(name, flush_policy_names[i]) == 0)
+		{
+			return (flush_policy_t)i;
+		}
+	}
+	return FLUSH_POLICY_NUM;
+}
+
+const char *flush_site_name(flush_site_t site)
+{
+	return site < FLUSH_SITE_NUM ? flush_site_names[site] : "unknown";
+}
+
+/*
+ * TSC cycles per ns, measured by spinning for 20ms
+ */
+static double flush_tsc_per_ns()
+{
+	static double tsc_per_ns = 0;
+	if (tsc_per_ns > 0)
+	{
+		return tsc_per_ns;
+	}
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uint64_t tsc_start = __builtin_ia32_rdtsc();
+	double ns;
+	do
+	{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ns = (now.tv_sec - start.tv_sec) * 1e9 + (now.tv_nsec - start.tv_nsec);
+	} while (ns < 20e6);
+	tsc_per_ns = (__builtin_ia32_rdtsc() - tsc_start) / ns;
+	return tsc_per_ns;
+}
+
+bool flush_set_emulation(const char *spec)
+{
+	flush_emulation_t e = {0, 0, 0, 0, 0, 0};
+	bool found = false;
+	for (size_t i = 0; i < sizeof(flush_emulation_presets) / sizeof(flush_emulation_presets[0]); i++)
+	{
+		if (strcmp(spec, flush_emulation_presets[i].name) == 0)
+		{
+			e.flush_ns = flush_emulation_presets[i].flush_ns;
+			e.fence_ns = flush_emulation_presets[i].fence_ns;
+			e.write_ns = flush_emulation_presets[i].write_ns;
+			found = true;
+		}
+	}
+	if (!found && sscanf(spec, "%u,%u,%u", &e.flush_ns, &e.fence_ns, &e.write_ns) != 3)
+	{
+		return false;
+	}
+
+	if (e.flush_ns > 0 || e.fence_ns > 0 || e.write_ns > 0)
+	{
+		double tsc_per_ns = flush_tsc_per_ns();
+		e.flush_cycles = e.flush_ns * tsc_per_ns;
+		e.fence_cycles = e.fence_ns * tsc_per_ns;
+		e.write_cycles = e.write_ns * tsc_per_ns;
+	}
+	flush_emulation = e;
+	return true;
+}
@@ -35,6 +35,13 @@
 #include <malloc.h>
 #include <assert.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
 #include "common.h"
 
 ssmem_ts_t *ssmem_ts_list = nullptr;
@@ -43,6 +50,47 @@ __thread volatile ssmem_ts_t *ssmem_ts_local = nullptr;
 __thread size_t ssmem_num_allocators = 0;
 __thread ssmem_list_t *ssmem_allocator_list = nullptr;
 
+/* the file-backed pool: the header is the first page of the mapping */
+static ssmem_pool_header_t *ssmem_pool = nullptr;
+static int ssmem_pool_fd = -1;
+static pthread_mutex_t ssmem_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+/* the chunks of the pool start on this boundary (a page of the file system on hugetlbfs) */
+static size_t ssmem_pool_align = SSMEM_POOL_ALIGN;
+static int ssmem_pool_hugetlbfs = 0;
+/* the state of the end of every chunk of the directory in this process: a chunk of the
+ * previous run is spare once its recovery is done, until an allocator takes it over */
+#define SSMEM_POOL_TAIL_NONE   0
+#define SSMEM_POOL_TAIL_SPARE  1
+#define SSMEM_POOL_TAIL_TAKEN  2
+static uint8_t ssmem_pool_tails[SSMEM_POOL_MAX_CHUNKS];
+
+/* the objects that the recoveries freed, per kind: the sets of every size class and of
+ * the plain objects (the last), and the segments of every class with room after their used
+ * objects. They are popped by the allocators of the kind */
+typedef struct ssmem_pool_stock
+{
+	int kind;
+	ssmem_free_set_t *sets[SSMEM_CLASS_NUM + 1];
+	ssmem_seg_tail_t *seg_tails[SSMEM_CLASS_NUM]; /* the segments that the recoveries resumed */
+	struct ssmem_pool_stock *next;
+} ssmem_pool_stock_t;
+static ssmem_pool_stock_t *volatile ssmem_pool_stocks = nullptr;
+
+/* the pages of the chunks */
+static ssmem_pages_t ssmem_pages = SSMEM_TRANSPARENT_HUGE_PAGES ? SSMEM_PAGES_THP : SSMEM_PAGES_SMALL;
+static const char *const ssmem_pages_names[SSMEM_PAGES_NUM] = {"small", "thp", "2mb", "1gb"};
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+/* NUMA placement: the node of every granule of the address space plus 1 (0 if unknown) */
+#define SSMEM_NUMA_MAP_SIZE    ((1UL << 47) >> SSMEM_NUMA_GRANULE_SHIFT)
+#define SSMEM_MPOL_PREFERRED   1
+#define SSMEM_MPOL_MF_MOVE     (1 << 1)
+static int ssmem_numa = 0;
+static uint8_t *ssmem_numa_map = nullptr;
+static __thread int ssmem_numa_local = -1;
+
 inline int
 ssmem_get_id()
 {
@@ -53,8 +101,23 @@ ssmem_get_id()
 	return -1;
 }
 
-static ssmem_list_t *ssmem_list_node_new(void *mem, ssmem_list_t *next);
+static ssmem_list_t *ssmem_list_node_new(void *mem, size_t size, ssmem_list_t *next);
 static void ssmem_zero_memory(ssmem_allocator_t *a);
+static void *ssmem_mem_chunk_new(ssmem_allocator_t *a, size_t size);
+static void *ssmem_pool_chunk_new(size_t size, int kind);
+static size_t ssmem_pages_size(ssmem_pages_t pages);
+static void *ssmem_huge_chunk_new(size_t size);
+static void ssmem_mem_chunk_free(void *mem, size_t size);
+static void ssmem_numa_bind(void *mem, size_t size);
+static int ssmem_numa_is_remote(void *obj);
+static void *ssmem_class_pop(ssmem_allocator_t *a, ssmem_class_t *cls);
+static void *ssmem_sets_pop(ssmem_allocator_t *a, ssmem_free_set_t **list, size_t *num);
+static size_t *ssmem_ts_set_collect_len(size_t *ts_set, size_t len);
+static void *ssmem_pool_stock_pop(ssmem_allocator_t *a, int c, ssmem_free_set_t **list, size_t *num);
+static ssmem_seg_tail_t *ssmem_pool_seg_tail_pop(ssmem_allocator_t *a, int c);
+static void *ssmem_pool_tail_take(int kind, size_t size, size_t *chunk_size, size_t *used);
+static void ssmem_class_push(ssmem_allocator_t *a, ssmem_class_t *cls, void *obj);
+static int ssmem_pool_contains(void *mem);
 
 /* 
  * explicitely subscribe to the list of threads in order to used timestamps for GC
@@ -83,36 +146,40 @@ void ssmem_gc_thread_init(ssmem_allocator_t *a, int id)
 
 ssmem_free_set_t *ssmem_free_set_new(size_t size, ssmem_free_set_t *next);
 
-/* 
- * initialize allocator a with a custom free_set_size
- * If the thread is not subscribed to the list of timestamps (used for GC),
- * additionally subscribe the thread to the list
- */
-void ssmem_alloc_init_fs_size(ssmem_allocator_t *a, size_t size, size_t free_set_size, int id)
+static void
+ssmem_alloc_init_internal(ssmem_allocator_t *a, size_t size, size_t free_set_size, int id, int pool, int kind)
 {
 	ssmem_num_allocators++;
-	ssmem_allocator_list = ssmem_list_node_new((void *)a, ssmem_allocator_list);
-
-#if SSMEM_TRANSPARENT_HUGE_PAGES
-	int ret = posix_memalign(&a->mem, CACHE_LINE_SIZE, size);
-	assert(ret == 0);
-#else
-	a->mem = (void *)aligned_alloc(CACHE_LINE_SIZE, size);
-#endif
-	assert(a->mem != nullptr);
+	ssmem_allocator_list = ssmem_list_node_new((void *)a, 0, ssmem_allocator_list);
 
-	a->mem_curr = 0;
+	a->pool = pool;
+	a->pool_kind = kind;
+	a->pool_adopted = 0;
 	a->mem_size = size;
-	a->tot_size = size;
 	a->fs_size = free_set_size;
+	if (pool)
+	{
+		/* the first chunk is taken on the first allocation, from the spare ones if it can */
+		a->mem = nullptr;
+		a->mem_curr = size;
+		a->tot_size = 0;
+		a->mem_chunks = nullptr;
+	}
+	else
+	{
+		a->mem = ssmem_mem_chunk_new(a, size);
 
-	ssmem_zero_memory(a);
+		a->mem_curr = 0;
+		a->tot_size = size;
 
-	struct ssmem_list* new_mem_chunks = ssmem_list_node_new(a->mem, nullptr);
-	BARRIER(new_mem_chunks);
+		ssmem_zero_memory(a);
 
-	a->mem_chunks = new_mem_chunks;
-	BARRIER(&a->mem_chunks);
+		struct ssmem_list* new_mem_chunks = ssmem_list_node_new(a->mem, size, nullptr);
+		BARRIER(new_mem_chunks, FLUSH_SITE_ALLOC);
+
+		a->mem_chunks = new_mem_chunks;
+		BARRIER(&a->mem_chunks, FLUSH_SITE_ALLOC);
+	}
 	ssmem_gc_thread_init(a, id);
 
 	a->free_set_list = ssmem_free_set_new(a->fs_size, nullptr);
@@ -125,6 +192,36 @@ void ssmem_alloc_init_fs_size(ssmem_allocator_t *a, size_t size, size_t free_set
 
 	a->released_mem_list = nullptr;
 	a->released_num = 0;
+
+	a->classes = nullptr;
+	a->remote = nullptr;
+}
+
+/* 
+ * initialize allocator a with a custom free_set_size
+ * If the thread is not subscribed to the list of timestamps (used for GC),
+ * additionally subscribe the thread to the list
+ */
+void ssmem_alloc_init_fs_size(ssmem_allocator_t *a, size_t size, size_t free_set_size, int id)
+{
+	ssmem_alloc_init_internal(a, size, free_set_size, id, 0, 0);
+}
+
+/* 
+ * initialize allocator a to take its memory chunks from the open pool
+ */
+void ssmem_alloc_init_pool(ssmem_allocator_t *a, size_t size, int id)
+{
+	ssmem_alloc_init_pool_kind(a, size, id, 0);
+}
+
+/* 
+ * the same, with chunks of the given kind
+ */
+void ssmem_alloc_init_pool_kind(ssmem_allocator_t *a, size_t size, int id, int kind)
+{
+	assert(ssmem_pool != nullptr);
+	ssmem_alloc_init_internal(a, size, SSMEM_GC_FREE_SET_SIZE, id, 1, kind);
 }
 
 /* 
@@ -141,12 +238,13 @@ void ssmem_alloc_init(ssmem_allocator_t *a, size_t size, int id)
  * 
  */
 static ssmem_list_t *
-ssmem_list_node_new(void *mem, ssmem_list_t *next)
+ssmem_list_node_new(void *mem, size_t size, ssmem_list_t *next)
 {
 	ssmem_list_t *mc;
 	mc = (ssmem_list_t *)malloc(sizeof(ssmem_list_t));
 	assert(mc != nullptr);
 	mc->obj = mem;
+	mc->size = size;
 	mc->next = next;
 	return mc;
 }
@@ -158,8 +256,10 @@ inline ssmem_released_t *
 ssmem_released_node_new(void *mem, ssmem_released_t *next)
 {
 	ssmem_released_t *rel;
-	rel = (ssmem_released_t *)malloc(sizeof(ssmem_released_t) + (ssmem_ts_list_len * sizeof(size_t)));
+	size_t ts_len = ssmem_ts_list_len;
+	rel = (ssmem_released_t *)malloc(sizeof(ssmem_released_t) + (ts_len * sizeof(size_t)));
 	assert(rel != nullptr);
+	rel->ts_len = ts_len;
 	rel->mem = mem;
 	rel->next = next;
 	rel->ts_set = (size_t *)(rel + 1);
@@ -173,8 +273,9 @@ ssmem_released_node_new(void *mem, ssmem_released_t *next)
 ssmem_free_set_t *
 ssmem_free_set_new(size_t size, ssmem_free_set_t *next)
 {
-	/* allocate both the ssmem_free_set_t and the free_set with one call */
-	ssmem_free_set_t *fs = (ssmem_free_set_t *)aligned_alloc(CACHE_LINE_SIZE, sizeof(ssmem_free_set_t) + (size * sizeof(uintptr_t)));
+	/* allocate both the ssmem_free_set_t and the free_set with one call (whole cache lines, for aligned_alloc) */
+	size_t bytes = (sizeof(ssmem_free_set_t) + (size * sizeof(uintptr_t)) + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+	ssmem_free_set_t *fs = (ssmem_free_set_t *)aligned_alloc(CACHE_LINE_SIZE, bytes);
 	assert(fs != nullptr);
 
 	fs->size = size;
@@ -182,6 +283,7 @@ ssmem_free_set_new(size_t size, ssmem_free_set_t *next)
 
 	fs->set = (uintptr_t *)(((uintptr_t)fs) + sizeof(ssmem_free_set_t));
 	fs->ts_set = nullptr; /* will get a ts when it becomes full */
+	fs->ts_len = 0;
 	fs->set_next = next;
 
 	return fs;
@@ -242,13 +344,13 @@ void ssmem_alloc_term(ssmem_allocator_t *a)
 	/* printf("[ALLOC] term() : ~ total mem used: %zu bytes = %zu KB = %zu MB\n", */
 	/* 	 a->tot_size, a->tot_size / 1024, a->tot_size / (1024 * 1024)); */
 	ssmem_list_t *mcur = a->mem_chunks;
-	do
+	while (mcur != nullptr)
 	{
 		ssmem_list_t *mnxt = mcur->next;
-		free(mcur->obj);
+		ssmem_mem_chunk_free(mcur->obj, mcur->size);
 		free(mcur);
 		mcur = mnxt;
-	} while (mcur != nullptr);
+	}
 
 	ssmem_list_t *prv = ssmem_allocator_list;
 	ssmem_list_t *cur = ssmem_allocator_list;
@@ -306,6 +408,39 @@ void ssmem_alloc_term(ssmem_allocator_t *a)
 		fs = nxt;
 	}
 
+	/* freeing the sets of the classes (local and remote) and of the remote objects */
+	ssmem_class_t *classes[2] = {a->classes, a->remote};
+	int class_num[2] = {2 * SSMEM_CLASS_NUM, 1};
+	for (int k = 0; k < 2; k++)
+	{
+		if (classes[k] == nullptr)
+		{
+			continue;
+		}
+		for (int c = 0; c < class_num[k]; c++)
+		{
+			ssmem_free_set_t *lists[2] = {classes[k][c].free_set_list, classes[k][c].collected_set_list};
+			for (int l = 0; l < 2; l++)
+			{
+				fs = lists[l];
+				while (fs != nullptr)
+				{
+					ssmem_free_set_t *nxt = fs->set_next;
+					ssmem_free_set_free(fs);
+					fs = nxt;
+				}
+			}
+			ssmem_seg_tail_t *tail = classes[k][c].seg_tails;
+			while (tail != nullptr)
+			{
+				ssmem_seg_tail_t *nxt = tail->next;
+				free(tail);
+				tail = nxt;
+			}
+		}
+		free(classes[k]);
+	}
+
 	/* freeing the relased memory */
 	ssmem_released_t *rel = a->released_mem_list;
 	while (rel != nullptr)
@@ -349,16 +484,48 @@ ssmem_ts_set_collect(size_t *ts_set)
 		assert(ts_set != nullptr);
 	}
 
+	return ssmem_ts_set_collect_len(ts_set, ssmem_ts_list_len);
+}
+
+/* 
+ * the timestamps of the first len threads in ts_set. A thread registered after ts_set was
+ * made has no entry, and needs none: it cannot hold a reference to an object that was
+ * already freed when it started
+ */
+static size_t *
+ssmem_ts_set_collect_len(size_t *ts_set, size_t len)
+{
 	ssmem_ts_t *cur = ssmem_ts_list;
 	while (cur != nullptr)
 	{
-		ts_set[cur->id] = cur->version;
+		if (cur->id < len)
+		{
+			ts_set[cur->id] = cur->version;
+		}
 		cur = cur->next;
 	}
 
 	return ts_set;
 }
 
+/* 
+ * collect the timestamps in the ts_set of fs, which is made again if more threads were
+ * registered since it was made (e.g., a set that a recovery filled, reused by a worker)
+ */
+static void
+ssmem_free_set_ts_collect(ssmem_free_set_t *fs)
+{
+	size_t len = ssmem_ts_list_len;
+	if (fs->ts_set == nullptr || fs->ts_len < len)
+	{
+		free(fs->ts_set);
+		fs->ts_set = (size_t *)malloc(len * sizeof(size_t));
+		assert(fs->ts_set != nullptr);
+		fs->ts_len = len;
+	}
+	ssmem_ts_set_collect_len(fs->ts_set, fs->ts_len);
+}
+
 /* 
  * 
  */
@@ -387,6 +554,61 @@ void ssmem_ts_set_print(size_t *set)
 #endif
 #endif
 
+/* 
+ * give allocator a a new memory chunk that holds at least size bytes
+ */
+static void
+ssmem_mem_chunk_add(ssmem_allocator_t *a, size_t size)
+{
+#if SSMEM_MEM_SIZE_DOUBLE == 1
+	if (a->mem != nullptr)
+	{
+		a->mem_size <<= 1;
+		if (a->mem_size > SSMEM_MEM_SIZE_MAX)
+		{
+			a->mem_size = SSMEM_MEM_SIZE_MAX;
+		}
+	}
+#endif
+	/* printf("[ALLOC] out of mem, need to allocate (chunk = %llu MB)\n", */
+	/* 	 a->mem_size / (1LL<<20)); */
+	if (size > a->mem_size)
+	{
+		/* printf("[ALLOC] asking for large mem. chunk\n"); */
+		while (a->mem_size < size)
+		{
+			if (a->mem_size > SSMEM_MEM_SIZE_MAX)
+			{
+				fprintf(stderr, "[ALLOC] asking for memory chunk larger than max (%llu MB) \n",
+						SSMEM_MEM_SIZE_MAX / (1024 * 1024LL));
+				assert(a->mem_size <= SSMEM_MEM_SIZE_MAX);
+			}
+			a->mem_size <<= 1;
+		}
+		/* printf("[ALLOC] new mem size chunk is %llu MB\n", a->mem_size / (1024 * 1024LL)); */
+	}
+	/* a pool allocator first goes on from where a chunk of the previous run stopped */
+	size_t chunk_size = a->mem_size, used = 0;
+	void *mem = a->pool ? ssmem_pool_tail_take(a->pool_kind, size, &chunk_size, &used) : nullptr;
+	if (mem == nullptr)
+	{
+		mem = ssmem_mem_chunk_new(a, a->mem_size);
+	}
+	a->mem = mem;
+	a->mem_size = chunk_size;
+	a->mem_curr = used;
+
+	a->tot_size += a->mem_size - used;
+
+	ssmem_zero_memory(a);
+
+	struct ssmem_list* new_mem_chunks = ssmem_list_node_new(a->mem, a->mem_size, a->mem_chunks);
+	BARRIER(new_mem_chunks, FLUSH_SITE_ALLOC);
+
+	a->mem_chunks = new_mem_chunks;
+	BARRIER(&a->mem_chunks, FLUSH_SITE_ALLOC);
+}
+
 /* 
  * 
  */
@@ -410,57 +632,26 @@ ssmem_alloc(ssmem_allocator_t *a, size_t size)
 			ssmem_free_set_make_avail(a, cs);
 		}
 	}
-	else
+	else if (__builtin_expect(a->remote == nullptr, 1) || (m = ssmem_class_pop(a, a->remote)) == nullptr)
 	{
-		if ((a->mem_curr + size) >= a->mem_size)
+		/* then the collected memory of other nodes, then fresh memory (in a pool, after
+		   the objects that a recovery freed) */
+		if ((a->mem_curr + size) >= a->mem_size &&
+			(!a->pool || (m = ssmem_pool_stock_pop(a, SSMEM_CLASS_NUM, &a->collected_set_list,
+												   &a->collected_set_num)) == nullptr))
 		{
-#if SSMEM_MEM_SIZE_DOUBLE == 1
-			a->mem_size <<= 1;
-			if (a->mem_size > SSMEM_MEM_SIZE_MAX)
-			{
-				a->mem_size = SSMEM_MEM_SIZE_MAX;
-			}
-#endif
-			/* printf("[ALLOC] out of mem, need to allocate (chunk = %llu MB)\n", */
-			/* 	 a->mem_size / (1LL<<20)); */
-			if (size > a->mem_size)
+			ssmem_mem_chunk_add(a, size);
+		}
+
+		if (m == nullptr)
+		{
+			m = (void *)((char *)(a->mem) + a->mem_curr);
+			a->mem_curr += size;
+			if (a->pool)
 			{
-				/* printf("[ALLOC] asking for large mem. chunk\n"); */
-				while (a->mem_size < size)
-				{
-					if (a->mem_size > SSMEM_MEM_SIZE_MAX)
-					{
-						fprintf(stderr, "[ALLOC] asking for memory chunk larger than max (%llu MB) \n",
-								SSMEM_MEM_SIZE_MAX / (1024 * 1024LL));
-						assert(a->mem_size <= SSMEM_MEM_SIZE_MAX);
-					}
-					a->mem_size <<= 1;
-				}
-				/* printf("[ALLOC] new mem size chunk is %llu MB\n", a->mem_size / (1024 * 1024LL)); */
+				flush_emulate_write(size);
 			}
-#if SSMEM_TRANSPARENT_HUGE_PAGES
-			int ret = posix_memalign(&a->mem, CACHE_LINE_SIZE, a->mem_size);
-			assert(ret == 0);
-#else
-			a->mem = (void *)aligned_alloc(CACHE_LINE_SIZE, a->mem_size);
-#endif
-			assert(a->mem != nullptr);
-
-			a->mem_curr = 0;
-
-			a->tot_size += a->mem_size;
-
-			ssmem_zero_memory(a);
-
-			struct ssmem_list* new_mem_chunks = ssmem_list_node_new(a->mem, a->mem_chunks);
-			BARRIER(new_mem_chunks);
-
-			a->mem_chunks = new_mem_chunks;
-			BARRIER(&a->mem_chunks);
 		}
-
-		m = (void *)((char *)(a->mem) + a->mem_curr);
-		a->mem_curr += size;
 	}
 
 #if SSMEM_TS_INCR_ON == SSMEM_TS_INCR_ON_ALLOC || SSMEM_TS_INCR_ON == SSMEM_TS_INCR_ON_BOTH
@@ -469,12 +660,13 @@ ssmem_alloc(ssmem_allocator_t *a, size_t size)
 	return m;
 }
 
-/* return > 0 iff snew is > sold for each entry */
+/* return > 0 iff snew is > sold for each entry of both (len_new and len_old entries) */
 static int
-ssmem_ts_compare(size_t *s_new, size_t *s_old)
+ssmem_ts_compare(size_t *s_new, size_t len_new, size_t *s_old, size_t len_old)
 {
 	int is_newer = 1;
-	for (unsigned int i = 0; i < ssmem_ts_list_len; i++)
+	size_t len = len_new < len_old ? len_new : len_old;
+	for (size_t i = 0; i < len; i++)
 	{
 		if (s_new[i] <= s_old[i])
 		{
@@ -502,6 +694,8 @@ ssmem_ts_compare_3(size_t *s_1, size_t *s_2, size_t *s_3)
 }
 
 static void ssmem_ts_set_print_no_newline(size_t *set);
+static int ssmem_sets_reclaim(ssmem_free_set_t *fs_cur, size_t *free_set_num, ssmem_free_set_t **collected_set_list,
+							  size_t *collected_set_num);
 
 /* 
  *
@@ -513,7 +707,7 @@ int ssmem_mem_reclaim(ssmem_allocator_t *a)
 		ssmem_released_t *rel_cur = a->released_mem_list;
 		ssmem_released_t *rel_nxt = rel_cur->next;
 
-		if (rel_nxt != nullptr && ssmem_ts_compare(rel_cur->ts_set, rel_nxt->ts_set))
+		if (rel_nxt != nullptr && ssmem_ts_compare(rel_cur->ts_set, rel_cur->ts_len, rel_nxt->ts_set, rel_nxt->ts_len))
 		{
 			rel_cur->next = nullptr;
 			a->released_num = 1;
@@ -521,14 +715,24 @@ int ssmem_mem_reclaim(ssmem_allocator_t *a)
 			do
 			{
 				rel_cur = rel_nxt;
+				rel_nxt = rel_cur->next;
 				free(rel_cur->mem);
 				free(rel_cur);
-				rel_nxt = rel_nxt->next;
 			} while (rel_nxt != nullptr);
 		}
 	}
 
-	ssmem_free_set_t *fs_cur = a->free_set_list;
+	return ssmem_sets_reclaim(a->free_set_list, &a->free_set_num, &a->collected_set_list, &a->collected_set_num);
+}
+
+/* 
+ * move the free sets after the first one of a free set list to the collected sets, if
+ * every thread moved on since the second one got full
+ */
+static int
+ssmem_sets_reclaim(ssmem_free_set_t *fs_cur, size_t *free_set_num, ssmem_free_set_t **collected_set_list,
+				   size_t *collected_set_num)
+{
 	if (fs_cur->ts_set == nullptr)
 	{
 		return 0;
@@ -541,17 +745,17 @@ int ssmem_mem_reclaim(ssmem_allocator_t *a)
 		return 0;
 	}
 
-	if (ssmem_ts_compare(fs_cur->ts_set, fs_nxt->ts_set))
+	if (ssmem_ts_compare(fs_cur->ts_set, fs_cur->ts_len, fs_nxt->ts_set, fs_nxt->ts_len))
 	{
-		gced_num = a->free_set_num - 1;
+		gced_num = *free_set_num - 1;
 		/* take the the suffix of the list (all collected free_sets) away from the
-	 free_set list of a and set the correct num of free_sets*/
+	 free_set list and set the correct num of free_sets*/
 		fs_cur->set_next = nullptr;
-		a->free_set_num = 1;
+		*free_set_num = 1;
 
 		/* find the tail for the collected_set list in order to append the new 
 	 free_sets that were just collected */
-		ssmem_free_set_t *collected_set_cur = a->collected_set_list;
+		ssmem_free_set_t *collected_set_cur = *collected_set_list;
 		if (collected_set_cur != nullptr)
 		{
 			while (collected_set_cur->set_next != nullptr)
@@ -563,9 +767,9 @@ int ssmem_mem_reclaim(ssmem_allocator_t *a)
 		}
 		else
 		{
-			a->collected_set_list = fs_nxt;
+			*collected_set_list = fs_nxt;
 		}
-		a->collected_set_num += gced_num;
+		*collected_set_num += gced_num;
 	}
 
 	/* if (gced_num) */
@@ -576,141 +780,407 @@ int ssmem_mem_reclaim(ssmem_allocator_t *a)
 }
 
 /* 
- *
+ * take an object from the collected sets of cls, nullptr if they are empty
  */
-void ssmem_free(ssmem_allocator_t *a, void *obj)
+static void *
+ssmem_class_pop(ssmem_allocator_t *a, ssmem_class_t *cls)
 {
-	ssmem_free_set_t *fs = a->free_set_list;
-	if ((uintptr_t)fs->curr == (uintptr_t)fs->size)
-	{
-		fs->ts_set = ssmem_ts_set_collect(fs->ts_set);
-		ssmem_mem_reclaim(a);
+	return ssmem_sets_pop(a, &cls->collected_set_list, &cls->collected_set_num);
+}
 
-		/* printf("[ALLOC] free_set is full, doing GC / size of garbage pointers: %10zu = %zu KB\n", garbagep, garbagep / 1024); */
-		ssmem_free_set_t *fs_new = ssmem_free_set_get_avail(a, a->fs_size, a->free_set_list);
-		a->free_set_list = fs_new;
-		a->free_set_num++;
-		fs = fs_new;
+/* 
+ * take an object from the collected sets at *list (*num of them), nullptr if they are empty
+ */
+static void *
+ssmem_sets_pop(ssmem_allocator_t *a, ssmem_free_set_t **list, size_t *num)
+{
+	ssmem_free_set_t *cs = *list;
+	if (cs == nullptr)
+	{
+		return nullptr;
 	}
+	void *m = (void *)cs->set[--cs->curr];
+	PREFETCHW(m);
 
-	fs->set[fs->curr++] = (uintptr_t)obj;
-#if SSMEM_TS_INCR_ON == SSMEM_TS_INCR_ON_FREE || SSMEM_TS_INCR_ON == SSMEM_TS_INCR_ON_BOTH
-	ssmem_ts_next();
-#endif
+	if (cs->curr <= 0)
+	{
+		*list = cs->set_next;
+		(*num)--;
+
+		ssmem_free_set_make_avail(a, cs);
+	}
+	return m;
 }
 
 /* 
- *
+ * put obj in the free sets of cls. A full free set gets the timestamps, which may collect
+ * the older ones, and a new set goes in front
  */
-inline void
-ssmem_release(ssmem_allocator_t *a, void *obj)
+static void
+ssmem_class_push(ssmem_allocator_t *a, ssmem_class_t *cls, void *obj)
 {
-	ssmem_released_t *rel_list = a->released_mem_list;
-	ssmem_released_t *rel = ssmem_released_node_new(obj, rel_list);
-	rel->ts_set = ssmem_ts_set_collect(rel->ts_set);
-	int rn = ++a->released_num;
-	a->released_mem_list = rel;
-	if (rn >= SSMEM_GC_RLSE_SET_SIZE)
+	ssmem_free_set_t *fs = cls->free_set_list;
+	if (fs == nullptr || (uintptr_t)fs->curr == (uintptr_t)fs->size)
 	{
-		ssmem_mem_reclaim(a);
+		if (fs != nullptr)
+		{
+			ssmem_free_set_ts_collect(fs);
+			ssmem_sets_reclaim(fs, &cls->free_set_num, &cls->collected_set_list, &cls->collected_set_num);
+		}
+
+		fs = ssmem_free_set_get_avail(a, a->fs_size, cls->free_set_list);
+		cls->free_set_list = fs;
+		cls->free_set_num++;
 	}
+
+	fs->set[fs->curr++] = (uintptr_t)obj;
 }
 
 /* 
  *
  */
-static void
-ssmem_ts_set_print_no_newline(size_t *set)
+void ssmem_free(ssmem_allocator_t *a, void *obj)
 {
-	printf("[");
-	if (set != nullptr)
+	if (__builtin_expect(ssmem_numa_is_remote(obj), 0))
 	{
-		for (unsigned int i = 0; i < ssmem_ts_list_len; i++)
+		if (a->remote == nullptr)
 		{
-			printf("%zu|", set[i]);
+			a->remote = (ssmem_class_t *)calloc(1, sizeof(ssmem_class_t));
+			assert(a->remote != nullptr);
 		}
+		ssmem_class_push(a, a->remote, obj);
 	}
 	else
 	{
-		printf(" no timestamp yet ");
+		ssmem_free_set_t *fs = a->free_set_list;
+		if ((uintptr_t)fs->curr == (uintptr_t)fs->size)
+		{
+			ssmem_free_set_ts_collect(fs);
+			ssmem_mem_reclaim(a);
+
+			/* printf("[ALLOC] free_set is full, doing GC / size of garbage pointers: %10zu = %zu KB\n", garbagep, garbagep / 1024); */
+			ssmem_free_set_t *fs_new = ssmem_free_set_get_avail(a, a->fs_size, a->free_set_list);
+			a->free_set_list = fs_new;
+			a->free_set_num++;
+			fs = fs_new;
+		}
+
+		fs->set[fs->curr++] = (uintptr_t)obj;
 	}
-	printf("]");
+#if SSMEM_TS_INCR_ON == SSMEM_TS_INCR_ON_FREE || SSMEM_TS_INCR_ON == SSMEM_TS_INCR_ON_BOTH
+	ssmem_ts_next();
+#endif
 }
 
 /* 
- *
+ * the size class of objects of size bytes
  */
-void ssmem_free_list_print(ssmem_allocator_t *a)
+static inline int
+ssmem_class_of(size_t size)
 {
-	printf("[ALLOC] free_set list (%zu sets): \n", a->free_set_num);
+	assert(size <= SSMEM_CLASS_MAX);
+	return __builtin_ctzll(roundUpPow2((size + SSMEM_CLASS_MIN - 1) / SSMEM_CLASS_MIN));
+}
 
-	int n = 0;
-	ssmem_free_set_t *cur = a->free_set_list;
-	while (cur != nullptr)
+size_t
+ssmem_class_size(size_t size)
+{
+	return (size_t)SSMEM_CLASS_MIN << ssmem_class_of(size);
+}
+
+/* 
+ * the classes of allocator a, made on its first sized allocation or free
+ */
+static inline ssmem_class_t *
+ssmem_classes(ssmem_allocator_t *a)
+{
+	if (__builtin_expect(a->classes == nullptr, 0))
 	{
-		printf("(%-3d | %p::", n++, cur);
-		ssmem_ts_set_print_no_newline(cur->ts_set);
-		printf(") -> \n");
-		cur = cur->set_next;
+		/* the local classes, then the classes of the objects of other nodes */
+		a->classes = (ssmem_class_t *)calloc(2 * SSMEM_CLASS_NUM, sizeof(ssmem_class_t));
+		assert(a->classes != nullptr);
 	}
-	printf("nullptr\n");
+	return a->classes;
 }
 
 /* 
- *
+ * cut a new segment for class c from the chunks of allocator a. The class is persistent
+ * before any object of the segment is handed out
  */
-void ssmem_collected_list_print(ssmem_allocator_t *a)
+static void
+ssmem_segment_new(ssmem_allocator_t *a, ssmem_class_t *cls, int c)
 {
-	printf("[ALLOC] collected_set list (%zu sets): \n", a->collected_set_num);
+	/* a chunk of the previous run goes on from a segment boundary */
+	a->mem_curr = (a->mem_curr + SSMEM_SEGMENT_SIZE - 1) & ~(SSMEM_SEGMENT_SIZE - 1);
+	assert(a->mem_size % SSMEM_SEGMENT_SIZE == 0);
+	if (a->mem_curr + SSMEM_SEGMENT_SIZE > a->mem_size)
+	{
+		ssmem_mem_chunk_add(a, SSMEM_SEGMENT_SIZE);
+	}
+	ssmem_segment_t *seg = (ssmem_segment_t *)((char *)(a->mem) + a->mem_curr);
+	a->mem_curr += SSMEM_SEGMENT_SIZE;
+	seg->class_id = c + 1;
+	if (a->pool)
+	{
+		BARRIER(seg, FLUSH_SITE_ALLOC);
+	}
+	cls->seg = (char *)seg;
+	cls->seg_curr = SSMEM_SEGMENT_HEADER;
+}
 
-	int n = 0;
-	ssmem_free_set_t *cur = a->collected_set_list;
-	while (cur != nullptr)
+/* 
+ * go on with a segment of class c that a recovery resumed (of a, then of the pool stock),
+ * or cut a new one
+ */
+static void
+ssmem_segment_next(ssmem_allocator_t *a, ssmem_class_t *cls, int c)
+{
+	ssmem_seg_tail_t *tail = cls->seg_tails;
+	if (tail != nullptr)
 	{
-		printf("(%-3d | %p::", n++, cur);
-		ssmem_ts_set_print_no_newline(cur->ts_set);
-		printf(") -> \n");
-		cur = cur->set_next;
+		cls->seg_tails = tail->next;
 	}
-	printf("nullptr\n");
+	else if (a->pool)
+	{
+		tail = ssmem_pool_seg_tail_pop(a, c);
+	}
+	if (tail == nullptr)
+	{
+		ssmem_segment_new(a, cls, c);
+		return;
+	}
+	cls->seg = tail->seg;
+	cls->seg_curr = tail->seg_curr;
+	free(tail);
 }
 
 /* 
  *
  */
-void ssmem_available_list_print(ssmem_allocator_t *a)
+void *
+ssmem_alloc_sized(ssmem_allocator_t *a, size_t size)
 {
-	printf("[ALLOC] avail_set list: \n");
+	int c = ssmem_class_of(size);
+	size_t obj_size = (size_t)SSMEM_CLASS_MIN << c;
+	ssmem_class_t *cls = &ssmem_classes(a)[c];
 
-	int n = 0;
-	ssmem_free_set_t *cur = a->available_set_list;
-	while (cur != nullptr)
+	/* 1st try to use from the collected memory of the class, local and then of other nodes */
+	void *m = ssmem_class_pop(a, cls);
+	if (m == nullptr)
 	{
-		printf("(%-3d | %p::", n++, cur);
-		ssmem_ts_set_print_no_newline(cur->ts_set);
-		printf(") -> \n");
-		cur = cur->set_next;
+		m = ssmem_class_pop(a, cls + SSMEM_CLASS_NUM);
 	}
-	printf("nullptr\n");
+	/* then, in a pool, the objects of the class that a recovery freed */
+	if (m == nullptr && a->pool && (cls->seg == nullptr || cls->seg_curr + obj_size > SSMEM_SEGMENT_SIZE))
+	{
+		m = ssmem_pool_stock_pop(a, c, &cls->collected_set_list, &cls->collected_set_num);
+	}
+	if (m == nullptr)
+	{
+		if (cls->seg == nullptr || cls->seg_curr + obj_size > SSMEM_SEGMENT_SIZE)
+		{
+			ssmem_segment_next(a, cls, c);
+		}
+
+		m = (void *)(cls->seg + cls->seg_curr);
+		cls->seg_curr += obj_size;
+		if (a->pool)
+		{
+			flush_emulate_write(obj_size);
+		}
+	}
+
+#if SSMEM_TS_INCR_ON == SSMEM_TS_INCR_ON_ALLOC || SSMEM_TS_INCR_ON == SSMEM_TS_INCR_ON_BOTH
+	ssmem_ts_next();
+#endif
+	return m;
 }
 
 /* 
  *
  */
-void ssmem_all_list_print(ssmem_allocator_t *a, int id)
+void
+ssmem_free_sized(ssmem_allocator_t *a, void *obj, size_t size)
 {
-	printf("[ALLOC] [%-2d] free_set list: %-4zu / collected_set list: %-4zu\n",
-		   id, a->free_set_num, a->collected_set_num);
+	ssmem_class_t *cls = &ssmem_classes(a)[ssmem_class_of(size)];
+	if (__builtin_expect(ssmem_numa_is_remote(obj), 0))
+	{
+		cls += SSMEM_CLASS_NUM;
+	}
+	ssmem_class_push(a, cls, obj);
+#if SSMEM_TS_INCR_ON == SSMEM_TS_INCR_ON_FREE || SSMEM_TS_INCR_ON == SSMEM_TS_INCR_ON_BOTH
+	ssmem_ts_next();
+#endif
 }
 
 /* 
  *
  */
-void ssmem_ts_list_print()
+size_t
+ssmem_segment_obj_size(void *seg)
 {
-	printf("[ALLOC] ts list (%u elems): ", ssmem_ts_list_len);
-	ssmem_ts_t *cur = ssmem_ts_list;
-	while (cur != nullptr)
+	uint64_t class_id = ((ssmem_segment_t *)seg)->class_id;
+	if (class_id == 0 || class_id > SSMEM_CLASS_NUM)
+	{
+		return 0;
+	}
+	return (size_t)SSMEM_CLASS_MIN << (class_id - 1);
+}
+
+/* 
+ * as ssmem_pool_tail_take does for a chunk: an object that was handed out and persisted
+ * has a non-zero word
+ */
+size_t
+ssmem_segment_used(void *seg)
+{
+	size_t size = ssmem_segment_obj_size(seg);
+	if (size == 0)
+	{
+		return SSMEM_SEGMENT_HEADER;
+	}
+	uint64_t *begin = (uint64_t *)((char *)seg + SSMEM_SEGMENT_HEADER);
+	uint64_t *end = (uint64_t *)((char *)seg + SSMEM_SEGMENT_SIZE);
+	while (end > begin && end[-1] == 0)
+	{
+		end--;
+	}
+	return SSMEM_SEGMENT_HEADER + ((char *)end - (char *)begin + size - 1) / size * size;
+}
+
+/* 
+ *
+ */
+void
+ssmem_segment_resume(ssmem_allocator_t *a, void *seg)
+{
+	size_t size = ssmem_segment_obj_size(seg);
+	size_t used = ssmem_segment_used(seg);
+	if (size == 0 || used + size > SSMEM_SEGMENT_SIZE)
+	{
+		return;
+	}
+	ssmem_class_t *cls = &ssmem_classes(a)[ssmem_class_of(size)];
+	ssmem_seg_tail_t *tail = (ssmem_seg_tail_t *)malloc(sizeof(ssmem_seg_tail_t));
+	assert(tail != nullptr);
+	tail->seg = (char *)seg;
+	tail->seg_curr = used;
+	tail->next = cls->seg_tails;
+	cls->seg_tails = tail;
+}
+
+/* 
+ *
+ */
+inline void
+ssmem_release(ssmem_allocator_t *a, void *obj)
+{
+	ssmem_released_t *rel_list = a->released_mem_list;
+	ssmem_released_t *rel = ssmem_released_node_new(obj, rel_list);
+	ssmem_ts_set_collect_len(rel->ts_set, rel->ts_len);
+	int rn = ++a->released_num;
+	a->released_mem_list = rel;
+	if (rn >= SSMEM_GC_RLSE_SET_SIZE)
+	{
+		ssmem_mem_reclaim(a);
+	}
+}
+
+/* 
+ *
+ */
+static void
+ssmem_ts_set_print_no_newline(size_t *set)
+{
+	printf("[");
+	if (set != nullptr)
+	{
+		for (unsigned int i = 0; i < ssmem_ts_list_len; i++)
+		{
+			printf("%zu|", set[i]);
+		}
+	}
+	else
+	{
+		printf(" no timestamp yet ");
+	}
+	printf("]");
+}
+
+/* 
+ *
+ */
+void ssmem_free_list_print(ssmem_allocator_t *a)
+{
+	printf("[ALLOC] free_set list (%zu sets): \n", a->free_set_num);
+
+	int n = 0;
+	ssmem_free_set_t *cur = a->free_set_list;
+	while (cur != nullptr)
+	{
+		printf("(%-3d | %p::", n++, cur);
+		ssmem_ts_set_print_no_newline(cur->ts_set);
+		printf(") -> \n");
+		cur = cur->set_next;
+	}
+	printf("nullptr\n");
+}
+
+/* 
+ *
+ */
+void ssmem_collected_list_print(ssmem_allocator_t *a)
+{
+	printf("[ALLOC] collected_set list (%zu sets): \n", a->collected_set_num);
+
+	int n = 0;
+	ssmem_free_set_t *cur = a->collected_set_list;
+	while (cur != nullptr)
+	{
+		printf("(%-3d | %p::", n++, cur);
+		ssmem_ts_set_print_no_newline(cur->ts_set);
+		printf(") -> \n");
+		cur = cur->set_next;
+	}
+	printf("nullptr\n");
+}
+
+/* 
+ *
+ */
+void ssmem_available_list_print(ssmem_allocator_t *a)
+{
+	printf("[ALLOC] avail_set list: \n");
+
+	int n = 0;
+	ssmem_free_set_t *cur = a->available_set_list;
+	while (cur != nullptr)
+	{
+		printf("(%-3d | %p::", n++, cur);
+		ssmem_ts_set_print_no_newline(cur->ts_set);
+		printf(") -> \n");
+		cur = cur->set_next;
+	}
+	printf("nullptr\n");
+}
+
+/* 
+ *
+ */
+void ssmem_all_list_print(ssmem_allocator_t *a, int id)
+{
+	printf("[ALLOC] [%-2d] free_set list: %-4zu / collected_set list: %-4zu\n",
+		   id, a->free_set_num, a->collected_set_num);
+}
+
+/* 
+ *
+ */
+void ssmem_ts_list_print()
+{
+	printf("[ALLOC] ts list (%u elems): ", ssmem_ts_list_len);
+	ssmem_ts_t *cur = ssmem_ts_list;
+	while (cur != nullptr)
 	{
 		printf("(id: %-2zu / version: %zu) -> ", cur->id, cur->version);
 		cur = cur->next;
@@ -721,9 +1191,780 @@ void ssmem_ts_list_print()
 
 void ssmem_zero_memory(ssmem_allocator_t *a) {
 #if SSMEM_ZERO_MEMORY == 1
+	if (a->pool)
+	{
+		return; /* fresh pool chunks are holes in the file and read as 0 */
+	}
 	memset(a->mem, 0, a->mem_size);
-	for (size_t i = 0; i < a->mem_size / CACHE_LINE_SIZE; i += CACHE_LINE_SIZE) {
-		BARRIER((int8_t*)a->mem + i); // An asynchronous flush would be sufficient here, since another BARRIER will be placed next, after creating a new node for the mem_chunks list
+	for (size_t i = 0; i < a->mem_size; i += CACHE_LINE_SIZE) {
+		FLUSH((int8_t*)a->mem + i, FLUSH_SITE_ALLOC); // An asynchronous flush is sufficient here, a single fence waits for all of them
 	}
+	SFENCE();
 #endif
-}
\ No newline at end of file
+}
+/* 
+ * get a new memory chunk of size bytes for allocator a
+ */
+static void *
+ssmem_mem_chunk_new(ssmem_allocator_t *a, size_t size)
+{
+	void *mem;
+	if (a->pool)
+	{
+		mem = ssmem_pool_chunk_new(size, a->pool_kind);
+	}
+	else if (ssmem_pages != SSMEM_PAGES_SMALL)
+	{
+		mem = ssmem_huge_chunk_new(size);
+	}
+	else if (ssmem_numa)
+	{
+		/* the chunk owns whole granules, so that they have the node of the chunk */
+		mem = (void *)aligned_alloc(SSMEM_NUMA_GRANULE, (size + SSMEM_NUMA_GRANULE - 1) & ~(SSMEM_NUMA_GRANULE - 1));
+	}
+	else
+	{
+		mem = (void *)aligned_alloc(CACHE_LINE_SIZE, (size + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1));
+	}
+	assert(mem != nullptr);
+	ssmem_numa_bind(mem, size);
+	return mem;
+}
+
+/* 
+ * give back the chunk mem of size bytes (the chunks of the pool stay in the pool)
+ */
+static void
+ssmem_mem_chunk_free(void *mem, size_t size)
+{
+	if (ssmem_pool_contains(mem))
+	{
+		return;
+	}
+	if (ssmem_pages == SSMEM_PAGES_SMALL)
+	{
+		free(mem);
+		return;
+	}
+	size_t page = ssmem_pages_size(ssmem_pages);
+	munmap(mem, (size + page - 1) & ~(page - 1));
+}
+
+/* **************************************************************************************** */
+/* huge pages */
+/* **************************************************************************************** */
+
+/* 
+ * the bytes of a page, which the anonymous chunks in huge pages are rounded up to
+ */
+static size_t
+ssmem_pages_size(ssmem_pages_t pages)
+{
+	switch (pages)
+	{
+	case SSMEM_PAGES_SMALL:
+		return (size_t)sysconf(_SC_PAGESIZE);
+	case SSMEM_PAGES_1GB:
+		return 1024 * 1024 * 1024L;
+	default:
+		return SSMEM_THP_SIZE;
+	}
+}
+
+int
+ssmem_pages_set(ssmem_pages_t pages)
+{
+	static const char *const dirs[SSMEM_PAGES_NUM] = {nullptr, "/sys/kernel/mm/transparent_hugepage",
+													  "/sys/kernel/mm/hugepages/hugepages-2048kB",
+													  "/sys/kernel/mm/hugepages/hugepages-1048576kB"};
+	if (pages < SSMEM_PAGES_SMALL || pages >= SSMEM_PAGES_NUM ||
+		(dirs[pages] != nullptr && access(dirs[pages], F_OK) != 0))
+	{
+		return -1;
+	}
+	ssmem_pages = pages;
+	return 0;
+}
+
+ssmem_pages_t
+ssmem_pages_get()
+{
+	return ssmem_pages;
+}
+
+const char *
+ssmem_pages_name(ssmem_pages_t pages)
+{
+	return pages >= SSMEM_PAGES_SMALL && pages < SSMEM_PAGES_NUM ? ssmem_pages_names[pages] : "unknown";
+}
+
+/* 
+ * a chunk of (at least) size bytes in huge pages: from the hugetlb pool of the kernel, or
+ * an anonymous mapping on a huge page boundary that asks for transparent huge pages
+ */
+static void *
+ssmem_huge_chunk_new(size_t size)
+{
+	size_t page = ssmem_pages_size(ssmem_pages);
+	size_t len = (size + page - 1) & ~(page - 1);
+	if (ssmem_pages != SSMEM_PAGES_THP)
+	{
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (__builtin_ctzll(page) << MAP_HUGE_SHIFT);
+		void *m = mmap(nullptr, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (m != MAP_FAILED)
+		{
+			return m;
+		}
+		static volatile int warned = 0;
+		if (!warned)
+		{
+			warned = 1;
+			fprintf(stderr, "[ALLOC] the hugetlb pool has too few %s pages for a chunk of %zu MB "
+							"(see /proc/sys/vm/nr_hugepages), using transparent huge pages\n",
+					ssmem_pages_names[ssmem_pages], len / (1024 * 1024));
+		}
+	}
+
+	/* one huge page more than needed, trimmed to the first boundary */
+	char *m = (char *)mmap(nullptr, len + SSMEM_THP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (m == MAP_FAILED)
+	{
+		return nullptr;
+	}
+	char *start = (char *)(((uintptr_t)m + SSMEM_THP_SIZE - 1) & ~(SSMEM_THP_SIZE - 1));
+	if (start > m)
+	{
+		munmap(m, start - m);
+	}
+	munmap(start + len, m + SSMEM_THP_SIZE - start);
+	madvise(start, len, MADV_HUGEPAGE);
+	return start;
+}
+
+/* **************************************************************************************** */
+/* NUMA placement */
+/* **************************************************************************************** */
+
+/* 
+ * the number of NUMA nodes of the machine (the last one online plus 1)
+ */
+static int
+ssmem_numa_node_num()
+{
+	int nodes = 1;
+	FILE *f = fopen("/sys/devices/system/node/online", "r");
+	if (f != nullptr)
+	{
+		/* a list of ranges, such as 0-1,3 */
+		int first, last;
+		while (fscanf(f, "%d", &first) == 1)
+		{
+			last = first;
+			if (fscanf(f, "-%d", &last) < 0)
+			{
+				last = first;
+			}
+			nodes = last + 1;
+			if (fgetc(f) != ',')
+			{
+				break;
+			}
+		}
+		fclose(f);
+	}
+	return nodes < SSMEM_NUMA_MAX_NODES ? nodes : SSMEM_NUMA_MAX_NODES;
+}
+
+int
+ssmem_numa_init(int force)
+{
+	int nodes = ssmem_numa_node_num();
+	if ((nodes > 1 || force) && ssmem_numa_map == nullptr)
+	{
+		/* one byte per granule, only the touched pages of the map take memory */
+		void *map = mmap(nullptr, SSMEM_NUMA_MAP_SIZE, PROT_READ | PROT_WRITE,
+						 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (map == MAP_FAILED)
+		{
+			perror("[ALLOC] ssmem_numa_init: mmap");
+			return nodes;
+		}
+		ssmem_numa_map = (uint8_t *)map;
+		ssmem_numa = 1;
+	}
+	return nodes;
+}
+
+void
+ssmem_numa_set_node(int node)
+{
+	ssmem_numa_local = node;
+}
+
+/* 
+ * the node of the calling thread, the one it runs on if it did not set one
+ */
+static int
+ssmem_numa_local_node()
+{
+	if (ssmem_numa_local < 0)
+	{
+		unsigned int cpu, node;
+		ssmem_numa_local = syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 ? (int)node : 0;
+	}
+	return ssmem_numa_local;
+}
+
+int
+ssmem_numa_node_of(void *obj)
+{
+	uintptr_t g = (uintptr_t)obj >> SSMEM_NUMA_GRANULE_SHIFT;
+	if (!ssmem_numa || g >= SSMEM_NUMA_MAP_SIZE)
+	{
+		return -1;
+	}
+	return (int)ssmem_numa_map[g] - 1;
+}
+
+/* 
+ * 1 if obj is known to be in the memory of another node than the one of the calling thread
+ */
+static inline int
+ssmem_numa_is_remote(void *obj)
+{
+	if (__builtin_expect(!ssmem_numa, 1))
+	{
+		return 0;
+	}
+	int node = ssmem_numa_node_of(obj);
+	return node >= 0 && node != ssmem_numa_local_node();
+}
+
+/* 
+ * prefer the node of the calling thread for the pages of the new chunk mem (size bytes),
+ * before they are first touched, and note the node of its granules. The pages of a pool
+ * chunk come from the page cache of the file and follow the first touch, by the same
+ * thread, so their policy is only a hint
+ */
+static void
+ssmem_numa_bind(void *mem, size_t size)
+{
+	if (!ssmem_numa)
+	{
+		return;
+	}
+	int node = ssmem_numa_local_node();
+	uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)mem & ~(page - 1);
+	uintptr_t end = ((uintptr_t)mem + size + page - 1) & ~(page - 1);
+	unsigned long mask = 1UL << node;
+	syscall(SYS_mbind, start, end - start, SSMEM_MPOL_PREFERRED, &mask, 8 * sizeof(mask) + 1,
+			SSMEM_MPOL_MF_MOVE);
+
+	for (uintptr_t g = start >> SSMEM_NUMA_GRANULE_SHIFT;
+		 g <= (end - 1) >> SSMEM_NUMA_GRANULE_SHIFT && g < SSMEM_NUMA_MAP_SIZE; g++)
+	{
+		ssmem_numa_map[g] = (uint8_t)(node + 1);
+	}
+}
+
+/* **************************************************************************************** */
+/* file-backed persistent pool */
+/* **************************************************************************************** */
+
+/* 
+ * map len bytes of the pool file starting at offset into the reserved area
+ */
+static void *
+ssmem_pool_map(uint64_t offset, size_t len)
+{
+	void *addr = (void *)((uintptr_t)ssmem_pool + offset);
+	void *m = MAP_FAILED;
+#if defined(MAP_SYNC) && defined(MAP_SHARED_VALIDATE)
+	/* DAX file: stores reach the media without msync (fails on other file systems) */
+	m = mmap(addr, len, PROT_READ | PROT_WRITE, MAP_SHARED_VALIDATE | MAP_SYNC | MAP_FIXED,
+			 ssmem_pool_fd, offset);
+#endif
+	if (m == MAP_FAILED)
+	{
+		m = mmap(addr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, ssmem_pool_fd, offset);
+	}
+	if (m == MAP_FAILED)
+	{
+		perror("[ALLOC] ssmem_pool_map: mmap");
+		return nullptr;
+	}
+	if (!ssmem_pool_hugetlbfs && ssmem_pages != SSMEM_PAGES_SMALL)
+	{
+		/* honored by DAX and by tmpfs with shmem_enabled=advise (or huge=advise) */
+		madvise(m, len, MADV_HUGEPAGE);
+	}
+	return m;
+}
+
+static int
+ssmem_pool_contains(void *mem)
+{
+	return ssmem_pool != nullptr && (uintptr_t)mem >= (uintptr_t)ssmem_pool &&
+		   (uintptr_t)mem < (uintptr_t)ssmem_pool + SSMEM_POOL_MAX_SIZE;
+}
+
+/* 
+ * reserve the virtual range of the pool at base (or anywhere on a chunk boundary if base is 0)
+ */
+static void *
+ssmem_pool_reserve(uintptr_t base)
+{
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#ifdef MAP_FIXED_NOREPLACE
+	if (base != 0)
+	{
+		flags |= MAP_FIXED_NOREPLACE;
+	}
+#endif
+	size_t extra = base == 0 ? ssmem_pool_align : 0;
+	void *m = mmap((void *)base, SSMEM_POOL_MAX_SIZE + extra, PROT_NONE, flags, -1, 0);
+	if (m == MAP_FAILED)
+	{
+		return nullptr;
+	}
+	if (base != 0 && (uintptr_t)m != base)
+	{
+		/* old kernels treat the address as a hint only */
+		munmap(m, SSMEM_POOL_MAX_SIZE);
+		return nullptr;
+	}
+	if (extra > 0)
+	{
+		/* the pages of hugetlbfs are mapped only on their own boundaries */
+		uintptr_t start = ((uintptr_t)m + extra - 1) & ~(extra - 1);
+		if (start > (uintptr_t)m)
+		{
+			munmap(m, start - (uintptr_t)m);
+		}
+		munmap((void *)(start + SSMEM_POOL_MAX_SIZE), (uintptr_t)m + extra - start);
+		m = (void *)start;
+	}
+	return m;
+}
+
+/* 
+ * map (and create if needed) the pool file
+ */
+int ssmem_pool_open(const char *path)
+{
+	assert(ssmem_pool == nullptr);
+
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		perror("[ALLOC] ssmem_pool_open: open");
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		perror("[ALLOC] ssmem_pool_open: fstat");
+		close(fd);
+		return -1;
+	}
+
+	/* on hugetlbfs the file is mapped in whole pages of the file system */
+	struct statfs sfs;
+	ssmem_pool_hugetlbfs = fstatfs(fd, &sfs) == 0 && (unsigned long)sfs.f_type == SSMEM_HUGETLBFS_MAGIC;
+	ssmem_pool_align = SSMEM_POOL_ALIGN;
+	if (ssmem_pool_hugetlbfs && (size_t)sfs.f_bsize > ssmem_pool_align)
+	{
+		ssmem_pool_align = sfs.f_bsize;
+	}
+
+	uint64_t hdr[5] = {0};
+	int existing = st.st_size >= (off_t)SSMEM_POOL_HEADER_SIZE &&
+				   pread(fd, hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+				   hdr[0] == SSMEM_POOL_MAGIC;
+	if (existing && hdr[1] != SSMEM_POOL_VERSION)
+	{
+		fprintf(stderr, "[ALLOC] %s: pool version %llu is not supported\n", path, (unsigned long long)hdr[1]);
+		close(fd);
+		return -1;
+	}
+
+	void *base = ssmem_pool_reserve(existing ? hdr[2] : SSMEM_POOL_BASE_ADDR);
+	if (base == nullptr && !existing)
+	{
+		base = ssmem_pool_reserve(0);
+	}
+	if (base == nullptr)
+	{
+		fprintf(stderr, "[ALLOC] %s: cannot map the pool at %p\n", path, (void *)hdr[2]);
+		close(fd);
+		return -1;
+	}
+
+	/* a new pool starts from an empty file; an existing one loses the space of an
+	   interrupted growth, so that every chunk handed out later is zeroed by the fs */
+	size_t used = existing ? hdr[3] : (SSMEM_POOL_HEADER_SIZE + ssmem_pool_align - 1) & ~(ssmem_pool_align - 1);
+	if ((!existing && ftruncate(fd, 0) != 0) || ftruncate(fd, used) != 0)
+	{
+		perror("[ALLOC] ssmem_pool_open: ftruncate");
+		munmap(base, SSMEM_POOL_MAX_SIZE);
+		close(fd);
+		return -1;
+	}
+
+	ssmem_pool = (ssmem_pool_header_t *)base;
+	ssmem_pool_fd = fd;
+	if (ssmem_pool_map(0, used) == nullptr)
+	{
+		ssmem_pool_close();
+		return -1;
+	}
+
+	if (!existing)
+	{
+		ssmem_pool->version = SSMEM_POOL_VERSION;
+		ssmem_pool->base = (uint64_t)base;
+		ssmem_pool->size = used;
+		ssmem_pool->chunk_num = 0;
+		BARRIER(ssmem_pool, FLUSH_SITE_POOL);
+		/* the magic number makes the header valid, so it is persisted last */
+		ssmem_pool->magic = SSMEM_POOL_MAGIC;
+		BARRIER(ssmem_pool, FLUSH_SITE_POOL);
+	}
+	return existing;
+}
+
+/* 
+ * unmap the pool
+ */
+void ssmem_pool_close()
+{
+	if (ssmem_pool == nullptr)
+	{
+		return;
+	}
+	munmap(ssmem_pool, SSMEM_POOL_MAX_SIZE);
+	close(ssmem_pool_fd);
+	ssmem_pool = nullptr;
+	ssmem_pool_fd = -1;
+
+	/* the stocks and the tails were in the pool */
+	while (ssmem_pool_stocks != nullptr)
+	{
+		ssmem_pool_stock_t *stock = ssmem_pool_stocks;
+		ssmem_pool_stocks = stock->next;
+		for (int c = 0; c <= SSMEM_CLASS_NUM; c++)
+		{
+			while (stock->sets[c] != nullptr)
+			{
+				ssmem_free_set_t *nxt = stock->sets[c]->set_next;
+				ssmem_free_set_free(stock->sets[c]);
+				stock->sets[c] = nxt;
+			}
+		}
+		for (int c = 0; c < SSMEM_CLASS_NUM; c++)
+		{
+			while (stock->seg_tails[c] != nullptr)
+			{
+				ssmem_seg_tail_t *nxt = stock->seg_tails[c]->next;
+				free(stock->seg_tails[c]);
+				stock->seg_tails[c] = nxt;
+			}
+		}
+		free(stock);
+	}
+	memset(ssmem_pool_tails, SSMEM_POOL_TAIL_NONE, sizeof(ssmem_pool_tails));
+}
+
+int ssmem_pool_is_open()
+{
+	return ssmem_pool != nullptr;
+}
+
+size_t ssmem_pool_chunk_num()
+{
+	return ssmem_pool == nullptr ? 0 : ssmem_pool->chunk_num;
+}
+
+size_t ssmem_pool_kind_chunk_num(int kind)
+{
+	size_t n = 0;
+	for (uint64_t i = 0; i < ssmem_pool_chunk_num(); i++)
+	{
+		n += ssmem_pool->chunks[i].kind == (uint64_t)kind;
+	}
+	return n;
+}
+
+/* 
+ * grow the pool file by a chunk of (at least) size bytes
+ */
+static void *
+ssmem_pool_chunk_new(size_t size, int kind)
+{
+	size_t len = (size + ssmem_pool_align - 1) & ~(ssmem_pool_align - 1);
+	void *mem = nullptr;
+
+	pthread_mutex_lock(&ssmem_pool_lock);
+	uint64_t offset = ssmem_pool->size;
+	uint64_t n = ssmem_pool->chunk_num;
+	if (n == SSMEM_POOL_MAX_CHUNKS || offset + len > (uint64_t)SSMEM_POOL_MAX_SIZE)
+	{
+		fprintf(stderr, "[ALLOC] the pool is full (%llu chunks, %llu MB)\n",
+				(unsigned long long)n, (unsigned long long)(offset / (1024 * 1024LL)));
+	}
+	else if (ftruncate(ssmem_pool_fd, offset + len) != 0)
+	{
+		perror("[ALLOC] ssmem_pool_chunk_new: ftruncate");
+	}
+	else if ((mem = ssmem_pool_map(offset, len)) != nullptr)
+	{
+		ssmem_pool_chunk_t *chunk = &ssmem_pool->chunks[n];
+		chunk->offset = offset;
+		chunk->size = size;
+		chunk->kind = kind;
+		BARRIER(chunk, FLUSH_SITE_POOL);
+		ssmem_pool->size = offset + len;
+		ssmem_pool->chunk_num = n + 1;
+		BARRIER(ssmem_pool, FLUSH_SITE_POOL);
+		ssmem_pool_tails[n] = SSMEM_POOL_TAIL_TAKEN;
+	}
+	pthread_mutex_unlock(&ssmem_pool_lock);
+	return mem;
+}
+
+/* 
+ * hand the chunks of the pool directory of the kind of a to allocator a (for recovery)
+ */
+void ssmem_pool_adopt(ssmem_allocator_t *a)
+{
+	assert(ssmem_pool != nullptr);
+	for (uint64_t i = 0; i < ssmem_pool->chunk_num; i++)
+	{
+		ssmem_pool_chunk_t *chunk = &ssmem_pool->chunks[i];
+		if (chunk->kind != (uint64_t)a->pool_kind)
+		{
+			continue;
+		}
+		void *mem = (void *)((uintptr_t)ssmem_pool + chunk->offset);
+		a->mem_chunks = ssmem_list_node_new(mem, chunk->size, a->mem_chunks);
+	}
+	a->pool_adopted = 1;
+}
+
+/* 
+ * append the sets at list to the sets at *stock; the empty ones are freed
+ */
+static void
+ssmem_pool_stock_put(ssmem_free_set_t **stock, ssmem_free_set_t *list)
+{
+	while (list != nullptr)
+	{
+		ssmem_free_set_t *nxt = list->set_next;
+		if (list->curr > 0)
+		{
+			list->set_next = *stock;
+			*stock = list;
+		}
+		else
+		{
+			ssmem_free_set_free(list);
+		}
+		list = nxt;
+	}
+}
+
+/* 
+ * the stock of the given kind, made if there is none (under ssmem_pool_lock)
+ */
+static ssmem_pool_stock_t *
+ssmem_pool_stock_of(int kind)
+{
+	ssmem_pool_stock_t *stock = ssmem_pool_stocks;
+	while (stock != nullptr && stock->kind != kind)
+	{
+		stock = stock->next;
+	}
+	if (stock == nullptr)
+	{
+		stock = (ssmem_pool_stock_t *)calloc(1, sizeof(ssmem_pool_stock_t));
+		assert(stock != nullptr);
+		stock->kind = kind;
+		stock->next = ssmem_pool_stocks;
+		ssmem_pool_stocks = stock;
+	}
+	return stock;
+}
+
+/* 
+ * hand the objects that the allocators of this thread freed during a recovery, and the
+ * ends of the chunks they adopted, to every allocator of their kind. Nothing refers to the
+ * freed objects any more, so they are reused right away
+ */
+void ssmem_pool_recovered()
+{
+	assert(ssmem_pool != nullptr);
+	pthread_mutex_lock(&ssmem_pool_lock);
+	for (ssmem_list_t *cur = ssmem_allocator_list; cur != nullptr; cur = cur->next)
+	{
+		ssmem_allocator_t *a = (ssmem_allocator_t *)cur->obj;
+		if (!a->pool || !a->pool_adopted)
+		{
+			continue;
+		}
+		a->pool_adopted = 0;
+		ssmem_pool_stock_t *stock = ssmem_pool_stock_of(a->pool_kind);
+
+		/* the plain objects, of this node and of the others */
+		ssmem_free_set_t **plain = &stock->sets[SSMEM_CLASS_NUM];
+		ssmem_pool_stock_put(plain, a->free_set_list);
+		ssmem_pool_stock_put(plain, a->collected_set_list);
+		a->free_set_list = ssmem_free_set_new(a->fs_size, nullptr);
+		a->free_set_num = 1;
+		a->collected_set_list = nullptr;
+		a->collected_set_num = 0;
+		if (a->remote != nullptr)
+		{
+			ssmem_pool_stock_put(plain, a->remote->free_set_list);
+			ssmem_pool_stock_put(plain, a->remote->collected_set_list);
+			memset(a->remote, 0, sizeof(ssmem_class_t));
+		}
+
+		/* the sized objects, by class */
+		for (int c = 0; a->classes != nullptr && c < 2 * SSMEM_CLASS_NUM; c++)
+		{
+			ssmem_class_t *cls = &a->classes[c];
+			ssmem_pool_stock_put(&stock->sets[c % SSMEM_CLASS_NUM], cls->free_set_list);
+			ssmem_pool_stock_put(&stock->sets[c % SSMEM_CLASS_NUM], cls->collected_set_list);
+			cls->free_set_list = cls->collected_set_list = nullptr;
+			cls->free_set_num = cls->collected_set_num = 0;
+			while (cls->seg_tails != nullptr)
+			{
+				ssmem_seg_tail_t *nxt = cls->seg_tails->next;
+				cls->seg_tails->next = stock->seg_tails[c];
+				stock->seg_tails[c] = cls->seg_tails;
+				cls->seg_tails = nxt;
+			}
+		}
+
+		for (uint64_t i = 0; i < ssmem_pool->chunk_num; i++)
+		{
+			if (ssmem_pool->chunks[i].kind == (uint64_t)a->pool_kind && ssmem_pool_tails[i] == SSMEM_POOL_TAIL_NONE)
+			{
+				ssmem_pool_tails[i] = SSMEM_POOL_TAIL_SPARE;
+			}
+		}
+	}
+	pthread_mutex_unlock(&ssmem_pool_lock);
+}
+
+/* 
+ * take a set of objects of class c (SSMEM_CLASS_NUM for the plain ones) that a recovery
+ * freed, put it at *list (*num sets) and pop an object from it. nullptr if there is none
+ */
+static void *
+ssmem_pool_stock_pop(ssmem_allocator_t *a, int c, ssmem_free_set_t **list, size_t *num)
+{
+	if (ssmem_pool_stocks == nullptr)
+	{
+		return nullptr;
+	}
+	pthread_mutex_lock(&ssmem_pool_lock);
+	ssmem_pool_stock_t *stock = ssmem_pool_stocks;
+	while (stock != nullptr && stock->kind != a->pool_kind)
+	{
+		stock = stock->next;
+	}
+	ssmem_free_set_t *fs = stock == nullptr ? nullptr : stock->sets[c];
+	if (fs != nullptr)
+	{
+		stock->sets[c] = fs->set_next;
+	}
+	pthread_mutex_unlock(&ssmem_pool_lock);
+	if (fs == nullptr)
+	{
+		return nullptr;
+	}
+	fs->set_next = *list;
+	*list = fs;
+	(*num)++;
+	return ssmem_sets_pop(a, list, num);
+}
+
+/* 
+ * take a segment of class c that a recovery resumed, nullptr if there is none
+ */
+static ssmem_seg_tail_t *
+ssmem_pool_seg_tail_pop(ssmem_allocator_t *a, int c)
+{
+	if (ssmem_pool_stocks == nullptr)
+	{
+		return nullptr;
+	}
+	pthread_mutex_lock(&ssmem_pool_lock);
+	ssmem_pool_stock_t *stock = ssmem_pool_stocks;
+	while (stock != nullptr && stock->kind != a->pool_kind)
+	{
+		stock = stock->next;
+	}
+	ssmem_seg_tail_t *tail = stock == nullptr ? nullptr : stock->seg_tails[c];
+	if (tail != nullptr)
+	{
+		stock->seg_tails[c] = tail->next;
+	}
+	pthread_mutex_unlock(&ssmem_pool_lock);
+	return tail;
+}
+
+/* 
+ * take over a spare chunk of the kind that has room for objects of size bytes after its
+ * last used one, and return it with its size and the offset of the room. An object of a
+ * set that was persisted has a non-zero word, so the room starts after the last one, at an
+ * object boundary: the objects in it were never persisted, and the recoveries skip them
+ */
+static void *
+ssmem_pool_tail_take(int kind, size_t size, size_t *chunk_size, size_t *used)
+{
+	for (uint64_t i = 0;; i++)
+	{
+		pthread_mutex_lock(&ssmem_pool_lock);
+		while (i < ssmem_pool->chunk_num &&
+			   (ssmem_pool_tails[i] != SSMEM_POOL_TAIL_SPARE || ssmem_pool->chunks[i].kind != (uint64_t)kind))
+		{
+			i++;
+		}
+		int found = i < ssmem_pool->chunk_num;
+		if (found)
+		{
+			ssmem_pool_tails[i] = SSMEM_POOL_TAIL_TAKEN;
+		}
+		pthread_mutex_unlock(&ssmem_pool_lock);
+		if (!found)
+		{
+			return nullptr;
+		}
+
+		char *mem = (char *)ssmem_pool + ssmem_pool->chunks[i].offset;
+		size_t len = ssmem_pool->chunks[i].size;
+		uint64_t *end = (uint64_t *)(mem + len);
+		while (end > (uint64_t *)mem && end[-1] == 0)
+		{
+			end--;
+		}
+		size_t off = ((char *)end - mem + size - 1) / size * size;
+		if (off + size < len)
+		{
+			ssmem_numa_bind(mem + off, len - off);
+			*chunk_size = len;
+			*used = off;
+			return mem;
+		}
+	}
+}
+
+uint64_t* ssmem_pool_root(int i)
+{
+	assert(i >= 0 && i < SSMEM_POOL_ROOTS);
+	return ssmem_pool == nullptr ? nullptr : &ssmem_pool->roots[i];
+}
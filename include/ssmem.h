@@ -39,7 +39,8 @@
 /* parameters */
 /* **************************************************************************************** */
 
-#define SSMEM_TRANSPARENT_HUGE_PAGES 0 /* Use or not Linux transparent huge pages */
+#define SSMEM_TRANSPARENT_HUGE_PAGES 0 /* 1 to back the chunks with transparent huge pages
+					  unless ssmem_pages_set() picks other pages */
 #define SSMEM_ZERO_MEMORY            1 /* Initialize allocated memory to 0 or not */
 #define SSMEM_GC_FREE_SET_SIZE 507 /* mem objects to free before doing a GC pass */
 #define SSMEM_GC_RLSE_SET_SIZE 3   /* num of released object before doing a GC pass */
@@ -51,6 +52,36 @@
 #define SSMEM_MEM_SIZE_MAX     (4 * 1024 * 1024 * 1024LL) /* absolute max chunk size 
 							   (e.g., if doubling is 1) */
 
+/* size classes (see ssmem_alloc_sized()) */
+#define SSMEM_CLASS_MIN        16 /* bytes of the smallest class; every class doubles it */
+#define SSMEM_CLASS_NUM        13 /* so the largest class is 64KB */
+#define SSMEM_CLASS_MAX        (SSMEM_CLASS_MIN << (SSMEM_CLASS_NUM - 1))
+#define SSMEM_SEGMENT_SIZE     (256 * 1024L) /* the chunks of a sized allocator are cut in
+					    segments of this size, each of one class */
+#define SSMEM_SEGMENT_HEADER   CACHE_LINE_SIZE /* the class of the segment, before its objects */
+
+/* NUMA placement (see ssmem_numa_init()) */
+#define SSMEM_NUMA_GRANULE_SHIFT 21 /* the node of the memory is kept per 2MB */
+#define SSMEM_NUMA_GRANULE     (1L << SSMEM_NUMA_GRANULE_SHIFT)
+#define SSMEM_NUMA_MAX_NODES   64
+
+/* huge pages (see ssmem_pages_set()) */
+#define SSMEM_THP_SIZE         (2 * 1024 * 1024L) /* the size of a transparent huge page */
+#define SSMEM_HUGETLBFS_MAGIC  0x958458f6 /* the f_type of hugetlbfs */
+
+/* file-backed persistent pool (see ssmem_pool_open()) */
+#define SSMEM_POOL_MAGIC       0x4c4f4f504d454d53ULL /* "SMEMPOOL" */
+#define SSMEM_POOL_VERSION     3
+#define SSMEM_POOL_MAX_CHUNKS  8192 /* entries in the persistent chunk directory */
+#define SSMEM_POOL_ALIGN       (2 * 1024 * 1024L) /* chunks start on 2MB boundaries */
+#define SSMEM_POOL_ROOTS       3 /* durable words in the pool header */
+#define SSMEM_POOL_HEADER_SIZE SSMEM_POOL_ALIGN /* header + chunk directory */
+#define SSMEM_POOL_MAX_SIZE    (1024 * 1024 * 1024 * 1024LL) /* virtual space reserved
+							  for the pool (1TB) */
+#define SSMEM_POOL_BASE_ADDR   0x100000000000ULL /* preferred mapping address; the pool
+						   is position-dependent, so a reattached
+						   pool is always mapped at its old base */
+
 /* increase the thread-local timestamp of activity on each ssmem_alloc() and/or ssmem_free() 
    call. If enabled (>0), after some memory is alloced and/or freed, the thread should not 
    access ANY ssmem-protected memory that was read (the reference were taken) before the
@@ -100,11 +131,44 @@ typedef struct ALIGNED(CACHE_LINE_SIZE) ssmem_allocator
 						  and can be used as free sets */
       size_t released_num;	/* number of released memory objects */
       struct ssmem_released* released_mem_list; /* list of release memory objects */
+      int pool;			/* 1 if the memory chunks come from the persistent pool */
+      int pool_kind;		/* the kind of its pool chunks */
+      int pool_adopted;		/* 1 if it adopted the pool chunks for a recovery */
+      struct ssmem_class* classes; /* the size classes, for the sized allocations */
+      struct ssmem_class* remote; /* the sets of the objects of other NUMA nodes */
     };
-    uint8_t padding[2 * CACHE_LINE_SIZE];
+    uint8_t padding[3 * CACHE_LINE_SIZE];
   };
 } ssmem_allocator_t;
 
+/* a size class of an allocator: the segment its objects are cut from, and its own free
+ * and collected sets, so that a freed object is only handed back for its class */
+typedef struct ssmem_class
+{
+  char* seg;			/* the current segment of the class */
+  size_t seg_curr;		/* offset of the next object in it */
+  struct ssmem_seg_tail* seg_tails; /* the segments to go on with before a new one is cut */
+  struct ssmem_free_set* free_set_list;
+  size_t free_set_num;
+  struct ssmem_free_set* collected_set_list;
+  size_t collected_set_num;
+} ssmem_class_t;
+
+/* the header of a segment of a sized allocator. A segment of a pool chunk that was never
+ * used reads as class 0 */
+typedef struct ssmem_segment
+{
+  uint64_t class_id;		/* the class of the segment + 1 */
+} ssmem_segment_t;
+
+/* the room of a segment of a previous run after its last used object */
+typedef struct ssmem_seg_tail
+{
+  char* seg;
+  size_t seg_curr;		/* offset of the first object of the room */
+  struct ssmem_seg_tail* next;
+} ssmem_seg_tail_t;
+
 /* a timestamp used by a thread */
 typedef struct ALIGNED(CACHE_LINE_SIZE) ssmem_ts
 {
@@ -130,6 +194,7 @@ typedef struct ALIGNED(CACHE_LINE_SIZE) ssmem_ts
 typedef struct ALIGNED(CACHE_LINE_SIZE) ssmem_free_set
 {
   size_t* ts_set;		/* set of timestamps for GC */
+  size_t ts_len;		/* entries of ts_set: the threads registered when it was made */
   size_t size;
   long int curr;		
   struct ssmem_free_set* set_next;
@@ -144,6 +209,7 @@ typedef struct ALIGNED(CACHE_LINE_SIZE) ssmem_free_set
 typedef struct ssmem_released
 {
   size_t* ts_set;
+  size_t ts_len;
   void* mem;
   struct ssmem_released* next;
 } ssmem_released_t;
@@ -155,9 +221,47 @@ typedef struct ssmem_released
 typedef struct ssmem_list
 {
   void* obj;
+  size_t size;			/* size of obj in bytes (0 if obj is not a memory chunk) */
   struct ssmem_list* next;
 } ssmem_list_t;
 
+/* the pages that back the memory chunks */
+typedef enum ssmem_pages
+{
+  SSMEM_PAGES_SMALL,		/* the base pages of the system */
+  SSMEM_PAGES_THP,		/* transparent huge pages (MADV_HUGEPAGE) */
+  SSMEM_PAGES_2MB,		/* 2MB pages of the hugetlb pool of the kernel (MAP_HUGETLB) */
+  SSMEM_PAGES_1GB,		/* 1GB pages of the hugetlb pool */
+  SSMEM_PAGES_NUM
+} ssmem_pages_t;
+
+/* an entry of the persistent chunk directory: a chunk at offset..offset+size of the pool.
+ * The kind tells the users of the pool which of them the chunk belongs to, so that a
+ * recovery only walks the objects it allocated (0 for the nodes of the sets) */
+typedef struct ssmem_pool_chunk
+{
+  uint64_t offset;
+  uint64_t size;
+  uint64_t kind;
+  uint64_t padding;		/* so that an entry never spans two lines, which one flush persists */
+} ssmem_pool_chunk_t;
+
+/*
+ * the persistent header at the start of the pool file. size and chunk_num are
+ * persisted only after the new directory entry, so a crash while growing the
+ * pool leaves at most some unused space at the end of the file
+ */
+typedef struct ALIGNED(CACHE_LINE_SIZE) ssmem_pool_header
+{
+  uint64_t magic;
+  uint64_t version;
+  uint64_t base;		/* virtual address the pool is mapped at */
+  uint64_t size;		/* bytes in use (header + all chunks) */
+  uint64_t chunk_num;		/* valid entries in chunks */
+  uint64_t roots[SSMEM_POOL_ROOTS]; /* durable words for the users of the pool */
+  ssmem_pool_chunk_t chunks[SSMEM_POOL_MAX_CHUNKS];
+} ssmem_pool_header_t;
+
 /* **************************************************************************************** */
 /* ssmem interface */
 /* **************************************************************************************** */
@@ -175,11 +279,82 @@ void ssmem_term();
  * might have been freed (and is still in use) by other allocators */
 void ssmem_alloc_term(ssmem_allocator_t* a);
 
+/* back the memory chunks with the given pages, and return 0, or -1 if the system does not
+ * have them. A chunk that the hugetlb pool has too few pages for gets transparent huge
+ * pages instead (with a warning). A pool file on hugetlbfs always has the huge pages of
+ * its file system, and on another file system it is advised to use transparent huge pages
+ * for any pages but SSMEM_PAGES_SMALL (MAP_HUGETLB takes anonymous memory only). Call it
+ * before any allocator is initialized and before the pool is opened */
+int ssmem_pages_set(ssmem_pages_t pages);
+/* the pages of the chunks */
+ssmem_pages_t ssmem_pages_get();
+/* the name of the pages: small, thp, 2mb or 1gb */
+const char* ssmem_pages_name(ssmem_pages_t pages);
+
+/* map the pool file at path, creating it if it does not exist.
+ * Returns 1 if an existing pool was reattached, 0 if a new pool was created
+ * and -1 on error. Only one pool can be open at a time */
+int ssmem_pool_open(const char* path);
+/* unmap the pool. Allocators that use it must not be used afterwards */
+void ssmem_pool_close();
+/* is a pool currently open? */
+int ssmem_pool_is_open();
+/* number of chunks in the pool directory */
+size_t ssmem_pool_chunk_num();
+/* number of chunks of the given kind in the pool directory */
+size_t ssmem_pool_kind_chunk_num(int kind);
+/* initialize an allocator whose memory chunks come from the open pool. It takes its first
+ * chunk on its first allocation, so an allocator that allocates nothing takes none */
+void ssmem_alloc_init_pool(ssmem_allocator_t* a, size_t size, int id);
+/* the same, with chunks of the given kind */
+void ssmem_alloc_init_pool_kind(ssmem_allocator_t* a, size_t size, int id, int kind);
+/* append every chunk of the pool directory of the kind of a to a->mem_chunks, so
+ * that a recovery procedure can walk the memory of a reattached pool. The chunks
+ * are not used for new allocations until ssmem_pool_recovered() */
+void ssmem_pool_adopt(ssmem_allocator_t* a);
+/* the recovery of the calling thread is done: the objects that its allocators freed on the
+ * chunks they adopted, and the unused ends of these chunks, go to every allocator of their
+ * kind, before any new chunk. Call it before the recovered set is used */
+void ssmem_pool_recovered();
+/* the i-th durable word of the pool header (i < SSMEM_POOL_ROOTS), nullptr if no
+ * pool is open. The words of a new pool are 0 */
+uint64_t* ssmem_pool_root(int i);
+
 /* allocate some memory using allocator a */
 void* ssmem_alloc(ssmem_allocator_t* a, size_t size);
 /* free some memory using allocator a */
 void ssmem_free(ssmem_allocator_t* a, void* obj);
 
+/* allocate an object of size bytes (at most SSMEM_CLASS_MAX) in the smallest size class
+ * that holds it. An allocator takes either sized or plain objects, never both: its chunks
+ * are cut in segments of one class, which the recoveries walk with ssmem_segment_obj_size() */
+void* ssmem_alloc_sized(ssmem_allocator_t* a, size_t size);
+/* free an object of size bytes that ssmem_alloc_sized() returned. It is only reused for
+ * the same class, once every thread moved on */
+void ssmem_free_sized(ssmem_allocator_t* a, void* obj, size_t size);
+/* the bytes an object of size bytes takes in its class */
+size_t ssmem_class_size(size_t size);
+/* the bytes of the objects of the segment at seg, 0 if it holds none */
+size_t ssmem_segment_obj_size(void* seg);
+/* the offset after the last object of the segment at seg that has a non-zero word: the
+ * objects after it were never handed out */
+size_t ssmem_segment_used(void* seg);
+/* have allocator a cut the objects of the class of the segment at seg (of a previous run)
+ * from its room after ssmem_segment_used(), before it cuts new segments */
+void ssmem_segment_resume(ssmem_allocator_t* a, void* seg);
+
+/* turn on the NUMA placement if the machine has more than one node (or if force is set),
+ * and return the number of nodes. The chunks of every allocator are then bound to the node
+ * of the thread that takes them, and a free of an object of another node puts it aside,
+ * so that the thread reuses it only when it has no local object left. Call it before any
+ * allocator is initialized */
+int ssmem_numa_init(int force);
+/* the NUMA node of the calling thread, for its next chunks (-1, the default, for the node
+ * it runs on when it takes its first chunk) */
+void ssmem_numa_set_node(int node);
+/* the node whose memory holds obj, -1 if ssmem does not know it */
+int ssmem_numa_node_of(void* obj);
+
 /* release some memory to the OS using allocator a */
 void ssmem_release(ssmem_allocator_t* a, void* obj);
 